@@ -5,40 +5,173 @@
 #include "leptjson.h"
 #include <assert.h>  /* assert() */
 #include <errno.h>   /* errno, ERANGE */
+#include <locale.h>  /* localeconv() */
 #include <math.h>    /* HUGE_VAL */
-#include <stdio.h>   /* sprintf() */
+#include <stdint.h>  /* uint64_t, UINT64_C() */
+#include <stdio.h>   /* sprintf(), fwrite() */
 #include <stdlib.h>  /* NULL, malloc(), realloc(), free(), strtod() */
-#include <string.h>  /* memcpy() */
+#include <string.h>  /* memcpy(), strlen() */
+#include "leptjson_pow10.h"
+
+#if !defined(LEPT_NO_SIMD) && (defined(__GNUC__) || defined(_MSC_VER)) && \
+    (defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86))
+#define LEPT_SIMD_X86 1
+#include <immintrin.h> /* SSE2, AVX2 */
+#ifdef _MSC_VER
+#include <intrin.h>    /* __cpuid(), _BitScanForward() */
+#define LEPT_TARGET(isa)
+#else
+#define LEPT_TARGET(isa) __attribute__((target(isa)))
+#endif
+#endif
+
+/* Threads for lept_parse_lines(); without them it parses everything on the calling thread. */
+#if !defined(LEPT_NO_THREADS) && defined(_WIN32)
+#include <windows.h>   /* CreateThread(), SRWLOCK, CONDITION_VARIABLE */
+#elif !defined(LEPT_NO_THREADS) && (defined(__unix__) || defined(__APPLE__))
+#include <pthread.h>
+#elif !defined(LEPT_NO_THREADS)
+#define LEPT_NO_THREADS 1
+#endif
+
+/* Whether double arithmetic is evaluated in double precision, needed by the exact fast path */
+#if (defined(__FLT_EVAL_METHOD__) && __FLT_EVAL_METHOD__ == 0) || defined(_M_X64) || defined(_M_ARM64)
+#define LEPT_DOUBLE_EVAL 1
+#endif
 
 #ifndef LEPT_PARSE_STACK_INIT_SIZE
 #define LEPT_PARSE_STACK_INIT_SIZE 256
 #endif
 
+#ifndef LEPT_PARSE_MAX_DEPTH
+#define LEPT_PARSE_MAX_DEPTH 1024
+#endif
+
+/* lept_parse_lines() hands out work in chunks of about this many bytes */
+#ifndef LEPT_PARSE_LINES_CHUNK
+#define LEPT_PARSE_LINES_CHUNK (1 << 20)
+#endif
+
 #ifndef LEPT_PARSE_STRINGIFY_INIT_SIZE
 #define LEPT_PARSE_STRINGIFY_INIT_SIZE 256
 #endif
 
+#ifndef LEPT_OBJECT_INDEX_MIN
+#define LEPT_OBJECT_INDEX_MIN 16
+#endif
+
+#ifndef LEPT_WRITER_BUFFER_SIZE
+#define LEPT_WRITER_BUFFER_SIZE 4096
+#endif
+
+#ifndef LEPT_DOCUMENT_CHUNK_SIZE
+#define LEPT_DOCUMENT_CHUNK_SIZE 4096
+#endif
+
+/* Token positions that stage one of lept_parse_indexed() finds ahead of stage two, at least 64 */
+#ifndef LEPT_PARSE_INDEX_SIZE
+#define LEPT_PARSE_INDEX_SIZE 4096
+#endif
+
 #define EXPECT(c, ch)       do { assert(*c->json == (ch)); c->json++; } while(0)
+#define PEEK(c)             ((c)->json != (c)->end ? *(c)->json : '\0')
+#define ISWHITESPACE(ch)    ((ch) == ' ' || (ch) == '\t' || (ch) == '\n' || (ch) == '\r')
 #define ISDIGIT(ch)         ((ch) >= '0' && (ch) <= '9')
 #define ISDIGIT1TO9(ch)     ((ch) >= '1' && (ch) <= '9')
 #define PUTC(c, ch)         do { *(char*)lept_context_push(c, sizeof(char)) = (ch); } while(0)
 #define PUTS(c, s, len)     memcpy(lept_context_push(c, len), s, len)
 
+/* lept_value.flags */
+#define LEPT_FLAG_INT64     0x01    /* LEPT_NUMBER holds u.i instead of u.n */
+#define LEPT_FLAG_BORROWED  0x02    /* LEPT_STRING bytes, or LEPT_OBJECT keys, are not owned (in-situ) */
+#define LEPT_FLAG_ARENA     0x04    /* storage comes from an allocator without release, e.g. a lept_document */
+#define LEPT_FLAG_INDEXED   0x08    /* LEPT_OBJECT hash index is up to date */
+#define LEPT_FLAG_INTERNED  0x10    /* LEPT_OBJECT keys are interned by a lept_document */
+#define LEPT_FLAG_INLINE    0x20    /* LEPT_STRING is stored in the value itself */
+#define LEPT_FLAG_LAZY      0x40    /* LEPT_ARRAY or LEPT_OBJECT not parsed yet, u.s and size are its input bytes */
+#define LEPT_FLAG_LAZY_A    0x80    /* with LEPT_FLAG_LAZY, u.s points to a lept_lazy instead */
+
+/* What a lazy container parsed with an allocator needs besides its size: the allocator to load it with. */
 typedef struct {
     const char* json;
+    const lept_allocator* a;
+}lept_lazy;
+
+#define LEPT_LAZY_JSON(v)       ((v)->flags & LEPT_FLAG_LAZY_A ? ((const lept_lazy*)(v)->u.s)->json : (const char*)(v)->u.s)
+
+/*
+ * Strings up to LEPT_SSO_MAX bytes need no allocation: they fill the value up to the type byte.
+ * The last of those bytes holds LEPT_SSO_MAX - len, which doubles as the null of a full string.
+ */
+#define LEPT_SSO_MAX            (offsetof(lept_value, type) - 1)
+#define LEPT_STRING_DATA(v)     ((v)->flags & LEPT_FLAG_INLINE ? (const char*)(v) : (v)->u.s)
+#define LEPT_STRING_LEN(v)      ((v)->flags & LEPT_FLAG_INLINE ? \
+                                    LEPT_SSO_MAX - ((const unsigned char*)(v))[LEPT_SSO_MAX] : (size_t)(v)->size)
+
+/* Arrays and objects keep their capacity in a header right in front of u.e or u.m */
+typedef union {
+    size_t capacity;
+    double n;   /* aligns the elements behind it */
+    int64_t i;
+    void* p;
+}lept_block;
+
+#define LEPT_BLOCK(p)           ((lept_block*)(p) - 1)
+#define LEPT_CAPACITY(p)        ((p) != NULL ? LEPT_BLOCK(p)->capacity : 0)
+/* The capacity to grow a full container of n to, doubling up to the 32-bit size limit. */
+#define LEPT_GROW(n)            ((n) == 0 ? 1 : (n) > UINT32_MAX / 2 ? (size_t)UINT32_MAX : (size_t)(n) * 2)
+
+typedef struct {
+    const char* json, * end;
     char* stack;
     size_t size, top;
+    int insitu;  /* decode strings in place, json is writable */
+    int lazy;    /* containers below the top level are checked and kept as input ranges */
+    const lept_allocator* a;   /* allocates the tree */
+    const lept_allocator* sa;  /* allocates the stack */
+    lept_document* doc;        /* interns keys, or NULL */
 }lept_context;
 
+/* A NULL allocator stands for malloc(), realloc() and free(). */
+static void* lept_alloc(const lept_allocator* a, size_t size) {
+    return a != NULL ? a->alloc(a->ctx, size) : malloc(size);
+}
+
+static void* lept_resize(const lept_allocator* a, void* ptr, size_t old_size, size_t new_size) {
+    return a != NULL ? a->resize(a->ctx, ptr, old_size, new_size) : realloc(ptr, new_size);
+}
+
+static void lept_release(const lept_allocator* a, void* ptr, size_t size) {
+    if (a == NULL)
+        free(ptr);
+    else if (a->release != NULL && ptr != NULL)
+        a->release(a->ctx, ptr, size);
+}
+
+/* Storage from an allocator without release is reclaimed all at once, never value by value. */
+#define LEPT_STORAGE_FLAGS(a)   ((a) != NULL && (a)->release == NULL ? LEPT_FLAG_ARENA : 0)
+
+/* Grows, or first allocates when p is NULL, the block in front of p; size includes the header. */
+static void* lept_block_resize(const lept_allocator* a, void* p, size_t old_size, size_t size, size_t capacity) {
+    lept_block* b = (lept_block*)(p != NULL ? lept_resize(a, LEPT_BLOCK(p), old_size, size) : lept_alloc(a, size));
+    b->capacity = capacity;
+    return b + 1;
+}
+
+static void lept_block_release(const lept_allocator* a, void* p, size_t size) {
+    lept_release(a, LEPT_BLOCK(p), size);
+}
+
 static void* lept_context_push(lept_context* c, size_t size) {
     void* ret;
     assert(size > 0);
     if (c->top + size >= c->size) {
+        size_t old = c->size;
         if (c->size == 0)
             c->size = LEPT_PARSE_STACK_INIT_SIZE;
         while (c->top + size >= c->size)
             c->size += c->size >> 1;  /* c->size * 1.5 */
-        c->stack = (char*)realloc(c->stack, c->size);
+        c->stack = (char*)lept_resize(c->sa, c->stack, old, c->size);
     }
     ret = c->stack + c->top;
     c->top += size;
@@ -50,54 +183,762 @@ static void* lept_context_pop(lept_context* c, size_t size) {
     return c->stack + (c->top -= size);
 }
 
+struct lept_chunk {
+    lept_chunk* next;
+    size_t size, used;
+};
+
+#define LEPT_ARENA_ALIGN        8
+#define LEPT_ARENA_ROUND(n)     (((n) + (LEPT_ARENA_ALIGN - 1)) & ~(size_t)(LEPT_ARENA_ALIGN - 1))
+#define LEPT_CHUNK_DATA(k)      ((char*)(k) + LEPT_ARENA_ROUND(sizeof(lept_chunk)))
+
+/* Bump allocation from the newest chunk; chunks double in size up to 256 times the first one. */
+static void* lept_arena_alloc(void* ctx, size_t size) {
+    lept_document* d = (lept_document*)ctx;
+    lept_chunk* k = d->chunks;
+    void* ret;
+    size = LEPT_ARENA_ROUND(size);
+    if (k == NULL || k->size - k->used < size) {
+        size_t n = k == NULL ? LEPT_DOCUMENT_CHUNK_SIZE :
+            k->size < LEPT_DOCUMENT_CHUNK_SIZE * 128 ? k->size * 2 : LEPT_DOCUMENT_CHUNK_SIZE * 256;
+        if (n < size)
+            n = size;
+        k = (lept_chunk*)lept_alloc(d->upstream, LEPT_ARENA_ROUND(sizeof(lept_chunk)) + n);
+        k->next = d->chunks;
+        k->size = n;
+        k->used = 0;
+        d->chunks = k;
+    }
+    ret = LEPT_CHUNK_DATA(k) + k->used;
+    k->used += size;
+    return ret;
+}
+
+/* The newest block grows in place while its chunk has room, any other block is copied. */
+static void* lept_arena_resize(void* ctx, void* ptr, size_t old, size_t size) {
+    lept_chunk* k = ((lept_document*)ctx)->chunks;
+    void* ret;
+    old = LEPT_ARENA_ROUND(old);
+    size = LEPT_ARENA_ROUND(size);
+    if (ptr != NULL && (char*)ptr + old == LEPT_CHUNK_DATA(k) + k->used &&
+        (size_t)((char*)ptr - LEPT_CHUNK_DATA(k)) + size <= k->size) {
+        k->used = (size_t)((char*)ptr - LEPT_CHUNK_DATA(k)) + size;
+        return ptr;
+    }
+    if (size <= old)
+        return ptr;
+    ret = lept_arena_alloc(ctx, size);
+    if (old > 0)
+        memcpy(ret, ptr, old);
+    return ret;
+}
+
+/* FNV-1a */
+static uint32_t lept_hash(const char* s, size_t len) {
+    uint32_t h = UINT32_C(2166136261);
+    while (len--)
+        h = (h ^ (unsigned char)*s++) * UINT32_C(16777619);
+    return h;
+}
+
+/* An interned key is preceded by its length and hash, in the document's region. */
+typedef struct {
+    size_t len;
+    uint32_t hash;
+}lept_key;
+
+#define LEPT_KEY_HEADER(k)      ((const lept_key*)(k) - 1)
+/* The document that owns a region allocator, so parsing into it interns keys */
+#define LEPT_DOCUMENT_OF(a)     ((a) != NULL && (a)->alloc == lept_arena_alloc ? (lept_document*)(a)->ctx : NULL)
+
+static void lept_intern_grow(lept_document* d) {
+    size_t buckets = d->key_buckets == 0 ? 64 : d->key_buckets * 2, i, j;
+    char** keys = (char**)lept_alloc(d->upstream, buckets * sizeof(char*));
+    memset(keys, 0, buckets * sizeof(char*));
+    for (i = 0; i < d->key_buckets; i++)
+        if (d->keys[i] != NULL) {
+            for (j = LEPT_KEY_HEADER(d->keys[i])->hash & (buckets - 1); keys[j] != NULL; j = (j + 1) & (buckets - 1))
+                ;
+            keys[j] = d->keys[i];
+        }
+    if (d->keys != NULL)
+        lept_release(d->upstream, d->keys, d->key_buckets * sizeof(char*));
+    d->keys = keys;
+    d->key_buckets = buckets;
+}
+
+/* Returns the document's copy of the key, adding one if needed. */
+static char* lept_intern(lept_document* d, const char* s, size_t len) {
+    uint32_t hash = lept_hash(s, len);
+    lept_key* header;
+    size_t i;
+    char* k;
+    if ((d->key_count + 1) * 2 > d->key_buckets)
+        lept_intern_grow(d);
+    for (i = hash & (d->key_buckets - 1); (k = d->keys[i]) != NULL; i = (i + 1) & (d->key_buckets - 1))
+        if (LEPT_KEY_HEADER(k)->hash == hash && LEPT_KEY_HEADER(k)->len == len && memcmp(k, s, len) == 0)
+            return k;
+    header = (lept_key*)lept_arena_alloc(d, sizeof(lept_key) + len + 1);
+    header->len = len;
+    header->hash = hash;
+    k = (char*)(header + 1);
+    memcpy(k, s, len);
+    k[len] = '\0';
+    d->keys[i] = k;
+    d->key_count++;
+    return k;
+}
+
+static const char* lept_skip_whitespace_scalar(const char* p, const char* end) {
+    while (p != end && ISWHITESPACE(*p))
+        p++;
+    return p;
+}
+
+/* Find the next byte that ends a plain run inside a string: '"', '\\' or a control character. */
+static const char* lept_scan_string_scalar(const char* p, const char* end) {
+    while (p != end && *p != '"' && *p != '\\' && (unsigned char)*p >= 0x20)
+        p++;
+    return p;
+}
+
+/*
+ * Stage one of lept_parse_indexed(): classifies the input 64 bytes at a time and records
+ * where every token starts, skipping whitespace and string contents, while checking that
+ * the input is UTF-8. String and escape state carry over from one block to the next.
+ */
+typedef struct {
+    const char* json;
+    size_t len, off;            /* input, and how much of it is indexed */
+    const char* base;           /* the positions are offsets from here */
+    uint32_t* pos;              /* LEPT_PARSE_INDEX_SIZE token positions */
+    size_t count, next;
+    uint64_t in_string;         /* all ones while inside a string */
+    uint64_t escaped;           /* 1 when the next block starts with an escaped byte */
+    uint64_t scalar;            /* 1 when the last byte was part of a number or literal */
+    unsigned utf8_need;         /* continuation bytes still expected, scalar stage one only */
+    unsigned char utf8_lo, utf8_hi;
+    int done, invalid;          /* the input is indexed to the end; it is not UTF-8 */
+}lept_indexer;
+
+/* Byte classes of a block, bit i for byte i */
+typedef struct {
+    uint64_t quote, backslash, op, ws;
+}lept_classes;
+
+static unsigned lept_ctz64(uint64_t x) {
+    unsigned n = 0;
+    assert(x != 0);
+#if defined(__GNUC__)
+    n = (unsigned)__builtin_ctzll(x);
+#else
+    while (!(x & 1)) {
+        x >>= 1;
+        n++;
+    }
+#endif
+    return n;
+}
+
+/* Bit i is the parity of bits 0..i, which turns quote bits into the spans between them. */
+static uint64_t lept_prefix_xor(uint64_t x) {
+    x ^= x << 1;
+    x ^= x << 2;
+    x ^= x << 4;
+    x ^= x << 8;
+    x ^= x << 16;
+    x ^= x << 32;
+    return x;
+}
+
+/*
+ * Turns the byte classes of a block into its token starts: structural characters and the
+ * first byte of every string, number or literal, outside strings.
+ */
+static uint64_t lept_index_bits(lept_indexer* x, const lept_classes* k) {
+    const uint64_t odd = UINT64_C(0xAAAAAAAAAAAAAAAA);
+    uint64_t quote = k->quote, backslash = k->backslash, escaped, in_string, scalar, follows;
+    if (backslash == 0) {
+        escaped = x->escaped;
+        x->escaped = 0;
+    }
+    else {
+        /* a run of backslashes escapes the byte after it when it has odd length */
+        uint64_t b = backslash & ~x->escaped;
+        uint64_t codes = (((b << 1) | odd) - b) ^ odd;
+        escaped = codes ^ (backslash | x->escaped);
+        x->escaped = (codes & backslash) >> 63;
+    }
+    quote &= ~escaped;
+    in_string = lept_prefix_xor(quote) ^ x->in_string;
+    x->in_string = 0 - (in_string >> 63);
+    scalar = ~(k->op | k->ws);
+    follows = ((scalar & ~quote) << 1) | x->scalar;
+    x->scalar = (scalar & ~quote) >> 63;
+    /* in_string ^ quote covers string bodies and closing quotes, not opening quotes */
+    return (k->op | (scalar & ~follows)) & ~(in_string ^ quote);
+}
+
+/* One byte of the UTF-8 check: a lead byte sets how many continuation bytes follow, and their range. */
+static void lept_utf8_step(lept_indexer* x, unsigned char ch) {
+    if (x->utf8_need == 0) {
+        x->utf8_lo = 0x80;
+        x->utf8_hi = 0xBF;
+        if (ch >= 0xC2 && ch <= 0xDF)
+            x->utf8_need = 1;
+        else if (ch >= 0xE0 && ch <= 0xEF) {
+            x->utf8_need = 2;
+            if (ch == 0xE0)
+                x->utf8_lo = 0xA0;      /* overlong */
+            else if (ch == 0xED)
+                x->utf8_hi = 0x9F;      /* surrogates */
+        }
+        else if (ch >= 0xF0 && ch <= 0xF4) {
+            x->utf8_need = 3;
+            if (ch == 0xF0)
+                x->utf8_lo = 0x90;      /* overlong */
+            else if (ch == 0xF4)
+                x->utf8_hi = 0x8F;      /* above U+10FFFF */
+        }
+        else
+            x->invalid = 1;
+    }
+    else if (ch < x->utf8_lo || ch > x->utf8_hi) {
+        x->utf8_need = 0;
+        x->invalid = 1;
+    }
+    else {
+        x->utf8_need--;
+        x->utf8_lo = 0x80;
+        x->utf8_hi = 0xBF;
+    }
+}
+
+/* Classifies the 64 bytes at p and checks their UTF-8; the three bytes before p must be readable too. */
+static void lept_classify_scalar(lept_indexer* x, const char* p, lept_classes* k) {
+    uint64_t bit;
+    int i;
+    k->quote = k->backslash = k->op = k->ws = 0;
+    for (i = 0; i < 64; i++) {
+        unsigned char ch = (unsigned char)p[i];
+        bit = (uint64_t)1 << i;
+        if (ch >= 0x80 || x->utf8_need != 0)
+            lept_utf8_step(x, ch);
+        switch (ch) {
+            case '"':  k->quote |= bit; break;
+            case '\\': k->backslash |= bit; break;
+            case '{': case '}': case '[': case ']': case ':': case ',':
+                k->op |= bit;
+                break;
+            case ' ': case '\t': case '\n': case '\r':
+                k->ws |= bit;
+                break;
+            default: break;
+        }
+    }
+}
+
+#ifdef LEPT_SIMD_X86
+static unsigned lept_ctz(unsigned x) {
+#ifdef _MSC_VER
+    unsigned long i;
+    _BitScanForward(&i, x);
+    return (unsigned)i;
+#else
+    return (unsigned)__builtin_ctz(x);
+#endif
+}
+
+/* Classify 16 bytes per step, stops at the first non-whitespace byte. */
+LEPT_TARGET("sse2")
+static const char* lept_skip_whitespace_sse2(const char* p, const char* end) {
+    const __m128i sp = _mm_set1_epi8(' '), ht = _mm_set1_epi8('\t');
+    const __m128i lf = _mm_set1_epi8('\n'), cr = _mm_set1_epi8('\r');
+    for (; end - p >= 16; p += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i*)p);
+        __m128i ws = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(x, sp), _mm_cmpeq_epi8(x, ht)),
+            _mm_or_si128(_mm_cmpeq_epi8(x, lf), _mm_cmpeq_epi8(x, cr)));
+        unsigned mask = (unsigned)_mm_movemask_epi8(ws) ^ 0xFFFFu;
+        if (mask != 0)
+            return p + lept_ctz(mask);
+    }
+    return lept_skip_whitespace_scalar(p, end);
+}
+
+LEPT_TARGET("avx2")
+static const char* lept_skip_whitespace_avx2(const char* p, const char* end) {
+    const __m256i sp = _mm256_set1_epi8(' '), ht = _mm256_set1_epi8('\t');
+    const __m256i lf = _mm256_set1_epi8('\n'), cr = _mm256_set1_epi8('\r');
+    for (; end - p >= 32; p += 32) {
+        __m256i x = _mm256_loadu_si256((const __m256i*)p);
+        __m256i ws = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(x, sp), _mm256_cmpeq_epi8(x, ht)),
+            _mm256_or_si256(_mm256_cmpeq_epi8(x, lf), _mm256_cmpeq_epi8(x, cr)));
+        unsigned mask = ~(unsigned)_mm256_movemask_epi8(ws);
+        if (mask != 0)
+            return p + lept_ctz(mask);
+    }
+    return lept_skip_whitespace_sse2(p, end);
+}
+
+LEPT_TARGET("sse2")
+static const char* lept_scan_string_sse2(const char* p, const char* end) {
+    const __m128i quote = _mm_set1_epi8('"'), backslash = _mm_set1_epi8('\\');
+    const __m128i ctrl = _mm_set1_epi8(0x1F);
+    for (; end - p >= 16; p += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i*)p);
+        __m128i stop = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(x, quote), _mm_cmpeq_epi8(x, backslash)),
+            _mm_cmpeq_epi8(_mm_min_epu8(x, ctrl), x)); /* x <= 0x1F, unsigned */
+        unsigned mask = (unsigned)_mm_movemask_epi8(stop);
+        if (mask != 0)
+            return p + lept_ctz(mask);
+    }
+    return lept_scan_string_scalar(p, end);
+}
+
+LEPT_TARGET("avx2")
+static const char* lept_scan_string_avx2(const char* p, const char* end) {
+    const __m256i quote = _mm256_set1_epi8('"'), backslash = _mm256_set1_epi8('\\');
+    const __m256i ctrl = _mm256_set1_epi8(0x1F);
+    for (; end - p >= 32; p += 32) {
+        __m256i x = _mm256_loadu_si256((const __m256i*)p);
+        __m256i stop = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(x, quote), _mm256_cmpeq_epi8(x, backslash)),
+            _mm256_cmpeq_epi8(_mm256_min_epu8(x, ctrl), x));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(stop);
+        if (mask != 0)
+            return p + lept_ctz(mask);
+    }
+    return lept_scan_string_sse2(p, end);
+}
+
+#define LEPT_MASK64(lo, hi) \
+    ((uint64_t)(uint32_t)_mm256_movemask_epi8(lo) | (uint64_t)(uint32_t)_mm256_movemask_epi8(hi) << 32)
+
+/* UTF-8 error classes, one bit each, after Keiser and Lemire's lookup algorithm */
+#define LEPT_U8_TOO_SHORT   0x01
+#define LEPT_U8_TOO_LONG    0x02
+#define LEPT_U8_OVERLONG_3  0x04
+#define LEPT_U8_TOO_LARGE   0x08
+#define LEPT_U8_SURROGATE   0x10
+#define LEPT_U8_OVERLONG_2  0x20
+#define LEPT_U8_TOO_LARGE_1000 0x40
+#define LEPT_U8_OVERLONG_4  0x40
+#define LEPT_U8_TWO_CONTS   0x80
+#define LEPT_U8_CARRY       (LEPT_U8_TOO_SHORT | LEPT_U8_TOO_LONG | LEPT_U8_TWO_CONTS)
+
+#define LEPT_C(x)   ((char)(x))
+#define LEPT_SETR16(a, b, c, d, e, f, g, h, i, j, k, l, m, n, o, p) _mm256_setr_epi8( \
+    LEPT_C(a), LEPT_C(b), LEPT_C(c), LEPT_C(d), LEPT_C(e), LEPT_C(f), LEPT_C(g), LEPT_C(h), \
+    LEPT_C(i), LEPT_C(j), LEPT_C(k), LEPT_C(l), LEPT_C(m), LEPT_C(n), LEPT_C(o), LEPT_C(p), \
+    LEPT_C(a), LEPT_C(b), LEPT_C(c), LEPT_C(d), LEPT_C(e), LEPT_C(f), LEPT_C(g), LEPT_C(h), \
+    LEPT_C(i), LEPT_C(j), LEPT_C(k), LEPT_C(l), LEPT_C(m), LEPT_C(n), LEPT_C(o), LEPT_C(p))
+
+/* Nonzero bytes flag UTF-8 errors ending in the 32 bytes at p, which are checked against the three before. */
+LEPT_TARGET("avx2")
+static __m256i lept_utf8_check_avx2(const char* p) {
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+    const __m256i byte_1_high = LEPT_SETR16(
+        LEPT_U8_TOO_LONG, LEPT_U8_TOO_LONG, LEPT_U8_TOO_LONG, LEPT_U8_TOO_LONG,
+        LEPT_U8_TOO_LONG, LEPT_U8_TOO_LONG, LEPT_U8_TOO_LONG, LEPT_U8_TOO_LONG,
+        LEPT_U8_TWO_CONTS, LEPT_U8_TWO_CONTS, LEPT_U8_TWO_CONTS, LEPT_U8_TWO_CONTS,
+        LEPT_U8_TOO_SHORT | LEPT_U8_OVERLONG_2,
+        LEPT_U8_TOO_SHORT,
+        LEPT_U8_TOO_SHORT | LEPT_U8_OVERLONG_3 | LEPT_U8_SURROGATE,
+        LEPT_U8_TOO_SHORT | LEPT_U8_TOO_LARGE | LEPT_U8_TOO_LARGE_1000 | LEPT_U8_OVERLONG_4);
+    const __m256i byte_1_low = LEPT_SETR16(
+        LEPT_U8_CARRY | LEPT_U8_OVERLONG_3 | LEPT_U8_OVERLONG_2 | LEPT_U8_OVERLONG_4,
+        LEPT_U8_CARRY | LEPT_U8_OVERLONG_2,
+        LEPT_U8_CARRY,
+        LEPT_U8_CARRY,
+        LEPT_U8_CARRY | LEPT_U8_TOO_LARGE,
+        LEPT_U8_CARRY | LEPT_U8_TOO_LARGE | LEPT_U8_TOO_LARGE_1000,
+        LEPT_U8_CARRY | LEPT_U8_TOO_LARGE | LEPT_U8_TOO_LARGE_1000,
+        LEPT_U8_CARRY | LEPT_U8_TOO_LARGE | LEPT_U8_TOO_LARGE_1000,
+        LEPT_U8_CARRY | LEPT_U8_TOO_LARGE | LEPT_U8_TOO_LARGE_1000,
+        LEPT_U8_CARRY | LEPT_U8_TOO_LARGE | LEPT_U8_TOO_LARGE_1000,
+        LEPT_U8_CARRY | LEPT_U8_TOO_LARGE | LEPT_U8_TOO_LARGE_1000,
+        LEPT_U8_CARRY | LEPT_U8_TOO_LARGE | LEPT_U8_TOO_LARGE_1000,
+        LEPT_U8_CARRY | LEPT_U8_TOO_LARGE | LEPT_U8_TOO_LARGE_1000,
+        LEPT_U8_CARRY | LEPT_U8_TOO_LARGE | LEPT_U8_TOO_LARGE_1000 | LEPT_U8_SURROGATE,
+        LEPT_U8_CARRY | LEPT_U8_TOO_LARGE | LEPT_U8_TOO_LARGE_1000,
+        LEPT_U8_CARRY | LEPT_U8_TOO_LARGE | LEPT_U8_TOO_LARGE_1000);
+    const __m256i byte_2_high = LEPT_SETR16(
+        LEPT_U8_TOO_SHORT, LEPT_U8_TOO_SHORT, LEPT_U8_TOO_SHORT, LEPT_U8_TOO_SHORT,
+        LEPT_U8_TOO_SHORT, LEPT_U8_TOO_SHORT, LEPT_U8_TOO_SHORT, LEPT_U8_TOO_SHORT,
+        LEPT_U8_TOO_LONG | LEPT_U8_OVERLONG_2 | LEPT_U8_TWO_CONTS | LEPT_U8_OVERLONG_3 | LEPT_U8_TOO_LARGE_1000 | LEPT_U8_OVERLONG_4,
+        LEPT_U8_TOO_LONG | LEPT_U8_OVERLONG_2 | LEPT_U8_TWO_CONTS | LEPT_U8_OVERLONG_3 | LEPT_U8_TOO_LARGE,
+        LEPT_U8_TOO_LONG | LEPT_U8_OVERLONG_2 | LEPT_U8_TWO_CONTS | LEPT_U8_SURROGATE | LEPT_U8_TOO_LARGE,
+        LEPT_U8_TOO_LONG | LEPT_U8_OVERLONG_2 | LEPT_U8_TWO_CONTS | LEPT_U8_SURROGATE | LEPT_U8_TOO_LARGE,
+        LEPT_U8_TOO_SHORT, LEPT_U8_TOO_SHORT, LEPT_U8_TOO_SHORT, LEPT_U8_TOO_SHORT);
+    __m256i input = _mm256_loadu_si256((const __m256i*)p);
+    __m256i prev1 = _mm256_loadu_si256((const __m256i*)(p - 1));
+    __m256i prev2 = _mm256_loadu_si256((const __m256i*)(p - 2));
+    __m256i prev3 = _mm256_loadu_si256((const __m256i*)(p - 3));
+    __m256i special = _mm256_and_si256(_mm256_and_si256(
+        _mm256_shuffle_epi8(byte_1_high, _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble)),
+        _mm256_shuffle_epi8(byte_1_low, _mm256_and_si256(prev1, nibble))),
+        _mm256_shuffle_epi8(byte_2_high, _mm256_and_si256(_mm256_srli_epi16(input, 4), nibble)));
+    /* the third and fourth bytes of a sequence must be continuations */
+    __m256i must23 = _mm256_or_si256(
+        _mm256_subs_epu8(prev2, _mm256_set1_epi8((char)(0xE0 - 0x80))),
+        _mm256_subs_epu8(prev3, _mm256_set1_epi8((char)(0xF0 - 0x80))));
+    return _mm256_xor_si256(_mm256_and_si256(must23, _mm256_set1_epi8((char)0x80)), special);
+}
+
+LEPT_TARGET("avx2")
+static void lept_classify_avx2(lept_indexer* x, const char* p, lept_classes* k) {
+    const __m256i quote = _mm256_set1_epi8('"'), backslash = _mm256_set1_epi8('\\');
+    const __m256i open = _mm256_set1_epi8('{'), close = _mm256_set1_epi8('}'), lower = _mm256_set1_epi8(0x20);
+    const __m256i colon = _mm256_set1_epi8(':'), comma = _mm256_set1_epi8(',');
+    const __m256i sp = _mm256_set1_epi8(' '), ht = _mm256_set1_epi8('\t');
+    const __m256i lf = _mm256_set1_epi8('\n'), cr = _mm256_set1_epi8('\r');
+    __m256i lo = _mm256_loadu_si256((const __m256i*)p);
+    __m256i hi = _mm256_loadu_si256((const __m256i*)(p + 32));
+    __m256i lo20 = _mm256_or_si256(lo, lower), hi20 = _mm256_or_si256(hi, lower); /* '[' and ']' become '{' and '}' */
+    if (_mm256_movemask_epi8(_mm256_or_si256(lo, hi)) == 0) {
+        /* ASCII, so only a sequence cut at the end of the block before can be wrong */
+        if ((unsigned char)p[-1] >= 0xC0 || (unsigned char)p[-2] >= 0xE0 || (unsigned char)p[-3] >= 0xF0)
+            x->invalid = 1;
+    }
+    else {
+        __m256i error = _mm256_or_si256(lept_utf8_check_avx2(p), lept_utf8_check_avx2(p + 32));
+        if (!_mm256_testz_si256(error, error))
+            x->invalid = 1;
+    }
+    k->quote = LEPT_MASK64(_mm256_cmpeq_epi8(lo, quote), _mm256_cmpeq_epi8(hi, quote));
+    k->backslash = LEPT_MASK64(_mm256_cmpeq_epi8(lo, backslash), _mm256_cmpeq_epi8(hi, backslash));
+    k->op = LEPT_MASK64(
+            _mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi8(lo20, open), _mm256_cmpeq_epi8(lo20, close)),
+                _mm256_or_si256(_mm256_cmpeq_epi8(lo, colon), _mm256_cmpeq_epi8(lo, comma))),
+            _mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi8(hi20, open), _mm256_cmpeq_epi8(hi20, close)),
+                _mm256_or_si256(_mm256_cmpeq_epi8(hi, colon), _mm256_cmpeq_epi8(hi, comma))));
+    k->ws = LEPT_MASK64(
+            _mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi8(lo, sp), _mm256_cmpeq_epi8(lo, ht)),
+                _mm256_or_si256(_mm256_cmpeq_epi8(lo, lf), _mm256_cmpeq_epi8(lo, cr))),
+            _mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi8(hi, sp), _mm256_cmpeq_epi8(hi, ht)),
+                _mm256_or_si256(_mm256_cmpeq_epi8(hi, lf), _mm256_cmpeq_epi8(hi, cr))));
+}
+
+static int lept_cpu_has_avx2(void) {
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return 0;
+    __cpuid(info, 1);
+    if ((info[2] & (1 << 27)) == 0 || (_xgetbv(0) & 6) != 6) /* OSXSAVE, YMM state enabled */
+        return 0;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+static int lept_cpu_has_sse2(void) {
+#if defined(_MSC_VER) || defined(__x86_64__)
+    return 1;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse2");
+#endif
+}
+#endif /* LEPT_SIMD_X86 */
+
+typedef const char* (*lept_skip_func)(const char* p, const char* end);
+typedef void (*lept_classify_func)(lept_indexer* x, const char* p, lept_classes* k);
+
+/*
+ * The widest implementations the running CPU supports, picked once while the program loads,
+ * before any thread can parse; until then the scalar ones serve. They are read-only after.
+ */
+static lept_skip_func lept_skip_whitespace = lept_skip_whitespace_scalar;
+static lept_skip_func lept_scan_string = lept_scan_string_scalar;
+static lept_classify_func lept_classify = lept_classify_scalar;
+
+#ifdef LEPT_SIMD_X86
+#ifdef _MSC_VER
+static void __cdecl lept_simd_init(void);
+#pragma section(".CRT$XCU", read)
+__declspec(allocate(".CRT$XCU")) static void (__cdecl* lept_simd_init_entry)(void) = lept_simd_init;
+static void __cdecl lept_simd_init(void) {
+#else
+__attribute__((constructor)) static void lept_simd_init(void) {
+#endif
+    if (lept_cpu_has_avx2()) {
+        lept_skip_whitespace = lept_skip_whitespace_avx2;
+        lept_scan_string = lept_scan_string_avx2;
+        lept_classify = lept_classify_avx2;
+    }
+    else if (lept_cpu_has_sse2()) {
+        lept_skip_whitespace = lept_skip_whitespace_sse2;
+        lept_scan_string = lept_scan_string_sse2;
+    }
+}
+#endif
+
 static void lept_parse_whitespace(lept_context* c) {
     const char *p = c->json;
-    while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')
+    /* Most runs in compact JSON are empty or a single space */
+    if (p != c->end && ISWHITESPACE(*p)) {
         p++;
-    c->json = p;
+        if (p != c->end && ISWHITESPACE(*p))
+            p = lept_skip_whitespace(p + 1, c->end);
+        c->json = p;
+    }
 }
 
 static int lept_parse_literal(lept_context* c, lept_value* v, const char* literal, lept_type type) {
     size_t i;
     EXPECT(c, literal[0]);
     for (i = 0; literal[i + 1]; i++)
-        if (c->json[i] != literal[i + 1])
+        if (c->json + i == c->end || c->json[i] != literal[i + 1])
             return LEPT_PARSE_INVALID_VALUE;
     c->json += i;
     v->type = type;
     return LEPT_PARSE_OK;
 }
 
+static uint64_t lept_load_u64le(const char* p) {
+    uint64_t x;
+    memcpy(&x, p, sizeof(x));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    x = __builtin_bswap64(x);
+#endif
+    return x;
+}
+
+/* SWAR: are all 8 bytes in '0'..'9'? */
+static int lept_is_8_digits(uint64_t x) {
+    return ((x & UINT64_C(0xF0F0F0F0F0F0F0F0)) |
+        (((x + UINT64_C(0x0606060606060606)) & UINT64_C(0xF0F0F0F0F0F0F0F0)) >> 4)) == UINT64_C(0x3333333333333333);
+}
+
+/* SWAR: value of 8 digits, first digit in the lowest byte */
+static uint64_t lept_parse_8_digits(uint64_t x) {
+    const uint64_t mask = UINT64_C(0x000000FF000000FF);
+    const uint64_t mul1 = UINT64_C(0x000F424000000064); /* 100 + (1000000 << 32) */
+    const uint64_t mul2 = UINT64_C(0x0000271000000001); /* 1 + (10000 << 32) */
+    x -= UINT64_C(0x3030303030303030);
+    x = (x * 10) + (x >> 8);
+    return (((x & mask) * mul1) + (((x >> 16) & mask) * mul2)) >> 32;
+}
+
+/* Accumulates decimal digits into *w, wrapping on overflow; callers count the digits. */
+static const char* lept_parse_digits(const char* p, const char* end, uint64_t* w) {
+    uint64_t x = *w;
+    while (end - p >= 8) {
+        uint64_t chunk = lept_load_u64le(p);
+        if (!lept_is_8_digits(chunk))
+            break;
+        x = x * 100000000 + lept_parse_8_digits(chunk);
+        p += 8;
+    }
+    for (; p != end && ISDIGIT(*p); p++)
+        x = x * 10 + (unsigned)(*p - '0');
+    *w = x;
+    return p;
+}
+
+/* Returns the low 64 bits of a * b and stores the high 64 bits in *hi. */
+static uint64_t lept_mul128(uint64_t a, uint64_t b, uint64_t* hi) {
+#if defined(__SIZEOF_INT128__)
+    __extension__ unsigned __int128 r = (unsigned __int128)a * b;
+    *hi = (uint64_t)(r >> 64);
+    return (uint64_t)r;
+#elif defined(_MSC_VER) && defined(_M_X64)
+    return _umul128(a, b, hi);
+#else
+    uint64_t a0 = a & 0xFFFFFFFFu, a1 = a >> 32, b0 = b & 0xFFFFFFFFu, b1 = b >> 32;
+    uint64_t p00 = a0 * b0, p01 = a0 * b1, p10 = a1 * b0, p11 = a1 * b1;
+    uint64_t mid = (p00 >> 32) + (p01 & 0xFFFFFFFFu) + (p10 & 0xFFFFFFFFu);
+    *hi = p11 + (p01 >> 32) + (p10 >> 32) + (mid >> 32);
+    return (mid << 32) | (p00 & 0xFFFFFFFFu);
+#endif
+}
+
+static int lept_clz64(uint64_t x) {
+    int n = 0;
+    assert(x != 0);
+#if defined(__GNUC__)
+    n = __builtin_clzll(x);
+#else
+    while (!(x & (UINT64_C(1) << 63))) {
+        x <<= 1;
+        n++;
+    }
+#endif
+    return n;
+}
+
+/* floor(log2(10^q)), valid for |q| < 1700 */
+#define LEPT_FLOOR_LOG2_POW10(q) ((q) >= 0 ? ((q) * 217706L) >> 16 : -((-(q) * 217706L + 65535) >> 16))
+
+/*
+ * Eisel-Lemire: w * 10^q rounded to nearest double, using the truncated
+ * 128-bit mantissa of 10^q. Returns 0 when the result cannot be decided
+ * with that precision, or is subnormal or infinite; the caller then falls
+ * back to strtod(). Requires w != 0 and q in [LEPT_POW10_MIN, LEPT_POW10_MAX].
+ */
+static int lept_eisel_lemire(uint64_t w, int q, double* d) {
+    const uint64_t* pow10 = lept_pow10_128[q - LEPT_POW10_MIN];
+    uint64_t upper, lower, mantissa, bits;
+    long exponent;
+    int lz = lept_clz64(w);
+    w <<= lz;
+    lower = lept_mul128(w, pow10[0], &upper);
+    /* The truncated table underestimates by less than w, which could carry into the kept bits */
+    if ((upper & 0x1FF) == 0x1FF && lower + w < lower) {
+        uint64_t low_hi, low_lo = lept_mul128(w, pow10[1], &low_hi);
+        uint64_t middle = lower + low_hi;
+        if (middle < lower)
+            upper++;
+        if (middle + 1 == 0 && (upper & 0x1FF) == 0x1FF && low_lo + w < low_lo)
+            return 0;
+        lower = middle;
+    }
+    /* 54 bits with a leading one, the extra bit is for rounding */
+    mantissa = upper >> ((upper >> 63) + 9);
+    lz += 1 ^ (int)(upper >> 63);
+    if (lower == 0 && (upper & 0x1FF) == 0 && (mantissa & 3) == 1)
+        return 0; /* possibly halfway between two doubles */
+    mantissa += mantissa & 1;
+    mantissa >>= 1;
+    if (mantissa >= (UINT64_C(1) << 53)) { /* rounding carried out */
+        mantissa = UINT64_C(1) << 52;
+        lz--;
+    }
+    exponent = LEPT_FLOOR_LOG2_POW10(q) + 1087 - lz;
+    if (exponent < 1 || exponent > 2046)
+        return 0;
+    bits = (mantissa & ~(UINT64_C(1) << 52)) | ((uint64_t)exponent << 52);
+    memcpy(d, &bits, sizeof(*d));
+    return 1;
+}
+
+/* Locale-independent strtod() for the rare inputs the fast paths cannot decide. */
+static double lept_strtod(lept_context* c, const char* begin, const char* end) {
+    const char* point = localeconv()->decimal_point;
+    size_t len = end - begin, plen = strlen(point), head = c->top;
+    char* buf = lept_context_push(c, len + plen + 1), * p = buf;
+    double d;
+    for (; begin != end; begin++) {
+        if (*begin == '.') {
+            memcpy(p, point, plen);
+            p += plen;
+        }
+        else
+            *p++ = *begin;
+    }
+    *p = '\0';
+    d = strtod(buf, NULL);
+    c->top = head;
+    return d;
+}
+
 static int lept_parse_number(lept_context* c, lept_value* v) {
-    const char* p = c->json;
-    if (*p == '-') p++;
-    if (*p == '0') p++;
+#ifdef LEPT_DOUBLE_EVAL
+    static const double exact_pow10[] = { /* Clinger's fast path, all exactly representable */
+        1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+#endif
+    const char* p = c->json, * end = c->end, * digits;
+    uint64_t w = 0;
+    long exp10 = 0;
+    size_t n;
+    int neg = 0, integer = 1, truncated = 0;
+    double d, d2;
+    if (p != end && *p == '-') {
+        neg = 1;
+        p++;
+    }
+    digits = p;
+    if (p != end && *p == '0') p++;
     else {
-        if (!ISDIGIT1TO9(*p)) return LEPT_PARSE_INVALID_VALUE;
-        for (p++; ISDIGIT(*p); p++);
+        if (p == end || !ISDIGIT1TO9(*p)) return LEPT_PARSE_INVALID_VALUE;
+        p = lept_parse_digits(p, end, &w);
     }
-    if (*p == '.') {
-        p++;
-        if (!ISDIGIT(*p)) return LEPT_PARSE_INVALID_VALUE;
-        for (p++; ISDIGIT(*p); p++);
+    n = p - digits;
+    if (p != end && *p == '.') {
+        const char* frac = ++p;
+        if (p == end || !ISDIGIT(*p)) return LEPT_PARSE_INVALID_VALUE;
+        p = lept_parse_digits(p, end, &w);
+        n += p - frac;
+        exp10 = -(long)(p - frac);
+        integer = 0;
     }
-    if (*p == 'e' || *p == 'E') {
-        p++;
-        if (*p == '+' || *p == '-') p++;
-        if (!ISDIGIT(*p)) return LEPT_PARSE_INVALID_VALUE;
-        for (p++; ISDIGIT(*p); p++);
+    if (p != end && (*p == 'e' || *p == 'E')) {
+        long e = 0;
+        int eneg = 0;
+        integer = 0;
+        if (++p != end && (*p == '+' || *p == '-'))
+            eneg = *p++ == '-';
+        if (p == end || !ISDIGIT(*p)) return LEPT_PARSE_INVALID_VALUE;
+        for (; p != end && ISDIGIT(*p); p++)
+            if (e < 100000)
+                e = e * 10 + (*p - '0');
+        exp10 += eneg ? -e : e;
+    }
+    /* Integers that fit keep full precision; "-0" needs a double to keep its sign */
+    if (integer && n <= 19 && (neg ? w != 0 && w <= (UINT64_C(1) << 63) : w <= INT64_MAX)) {
+        v->u.i = !neg ? (int64_t)w : w == (UINT64_C(1) << 63) ? INT64_MIN : -(int64_t)w;
+        v->type = LEPT_NUMBER;
+        v->flags = LEPT_FLAG_INT64;
+        c->json = p;
+        return LEPT_PARSE_OK;
     }
-    errno = 0;
-    v->u.n = strtod(c->json, NULL);
-    if (errno == ERANGE && (v->u.n == HUGE_VAL || v->u.n == -HUGE_VAL))
+    if (n > 19) {
+        /* w has wrapped: keep the first 19 significant digits and scale the rest away */
+        const char* q = digits;
+        for (; q != p && (*q == '0' || *q == '.'); q++)
+            if (*q == '0')
+                n--;
+        if (n > 19) {
+            size_t i;
+            for (w = 0, i = 0; i < 19; q++)
+                if (*q != '.') {
+                    w = w * 10 + (unsigned)(*q - '0');
+                    i++;
+                }
+            exp10 += (long)(n - 19);
+            truncated = 1;
+        }
+    }
+    if (w == 0 || exp10 < LEPT_POW10_MIN)
+        d = 0.0;
+    else if (exp10 > 308) /* w >= 1, so at least 1e309 */
         return LEPT_PARSE_NUMBER_TOO_BIG;
+#ifdef LEPT_DOUBLE_EVAL
+    else if (!truncated && w <= (UINT64_C(1) << 53) && exp10 >= -22 && exp10 <= 22)
+        d = exp10 < 0 ? (double)w / exact_pow10[-exp10] : (double)w * exact_pow10[exp10];
+#endif
+    else if (!lept_eisel_lemire(w, (int)exp10, &d) ||
+        (truncated && (!lept_eisel_lemire(w + 1, (int)exp10, &d2) || d != d2))) {
+        errno = 0;
+        d = lept_strtod(c, digits, p);
+        if (errno == ERANGE && d == HUGE_VAL)
+            return LEPT_PARSE_NUMBER_TOO_BIG;
+    }
+    v->u.n = neg ? -d : d;
     v->type = LEPT_NUMBER;
+    v->flags = 0;
     c->json = p;
     return LEPT_PARSE_OK;
 }
 
-static const char* lept_parse_hex4(const char* p, unsigned* u) {
+static const char* lept_parse_hex4(const char* p, const char* end, unsigned* u) {
     int i;
+    if (end - p < 4)
+        return NULL;
     *u = 0;
     for (i = 0; i < 4; i++) {
         char ch = *p++;
@@ -110,679 +951,3958 @@ static const char* lept_parse_hex4(const char* p, unsigned* u) {
     return p;
 }
 
-static void lept_encode_utf8(lept_context* c, unsigned u) {
-    if (u <= 0x7F) 
-        PUTC(c, u & 0xFF);
+/* Writes u as UTF-8 and returns the number of bytes, at most 4. */
+static size_t lept_encode_utf8(char* p, unsigned u) {
+    if (u <= 0x7F) {
+        p[0] = (char)(u & 0xFF);
+        return 1;
+    }
     else if (u <= 0x7FF) {
-        PUTC(c, 0xC0 | ((u >> 6) & 0xFF));
-        PUTC(c, 0x80 | ( u       & 0x3F));
+        p[0] = (char)(0xC0 | ((u >> 6) & 0xFF));
+        p[1] = (char)(0x80 | ( u       & 0x3F));
+        return 2;
     }
     else if (u <= 0xFFFF) {
-        PUTC(c, 0xE0 | ((u >> 12) & 0xFF));
-        PUTC(c, 0x80 | ((u >>  6) & 0x3F));
-        PUTC(c, 0x80 | ( u        & 0x3F));
+        p[0] = (char)(0xE0 | ((u >> 12) & 0xFF));
+        p[1] = (char)(0x80 | ((u >>  6) & 0x3F));
+        p[2] = (char)(0x80 | ( u        & 0x3F));
+        return 3;
     }
     else {
         assert(u <= 0x10FFFF);
-        PUTC(c, 0xF0 | ((u >> 18) & 0xFF));
-        PUTC(c, 0x80 | ((u >> 12) & 0x3F));
-        PUTC(c, 0x80 | ((u >>  6) & 0x3F));
-        PUTC(c, 0x80 | ( u        & 0x3F));
+        p[0] = (char)(0xF0 | ((u >> 18) & 0xFF));
+        p[1] = (char)(0x80 | ((u >> 12) & 0x3F));
+        p[2] = (char)(0x80 | ((u >>  6) & 0x3F));
+        p[3] = (char)(0x80 | ( u        & 0x3F));
+        return 4;
     }
 }
 
 #define STRING_ERROR(ret) do { c->top = head; return ret; } while(0)
+/* In-situ decoding writes behind the read position: escapes never expand */
+#define STRING_PUTC(ch)     do { if (w) *w++ = (ch); else PUTC(c, ch); } while(0)
+#define STRING_PUTS(s, len) do { if (w) { memmove(w, s, len); w += len; } else PUTS(c, s, len); } while(0)
 
-static int lept_parse_string_raw(lept_context* c, char** str, size_t* len) {
+/*
+ * On success *str points either into the input, when the string has no escapes,
+ * or to the decoded copy on top of the stack. Either way it is only valid until
+ * the next push.
+ * In in-situ mode the string is always decoded into the input and terminated
+ * with '\0' there, so *str stays valid as long as the input buffer.
+ */
+static int lept_parse_string_raw(lept_context* c, const char** str, size_t* len) {
     size_t head = c->top;
     unsigned u, u2;
-    const char* p;
+    const char* p, * run;
+    char* w = NULL, buf[4];
     EXPECT(c, '\"');
-    p = c->json;
+    p = lept_scan_string(c->json, c->end);
+    if (p != c->end && *p == '\"') {
+        *len = p - c->json;
+        *str = c->json;
+        if (c->insitu)
+            *(char*)p = '\0';
+        c->json = p + 1;
+        return LEPT_PARSE_OK;
+    }
+    run = c->json;
+    if (c->insitu)
+        run = w = (char*)p; /* the clean prefix is already in place */
     for (;;) {
-        char ch = *p++;
-        switch (ch) {
+        char ch;
+        if (p != run)
+            STRING_PUTS(run, p - run);
+        if (p == c->end)
+            STRING_ERROR(LEPT_PARSE_MISS_QUOTATION_MARK);
+        switch (ch = *p++) {
             case '\"':
-                *len = c->top - head;
-                *str = lept_context_pop(c, *len);
+                if (w) {
+                    *w = '\0';
+                    *len = w - c->json;
+                    *str = c->json;
+                }
+                else {
+                    *len = c->top - head;
+                    *str = lept_context_pop(c, *len);
+                }
                 c->json = p;
                 return LEPT_PARSE_OK;
             case '\\':
-                switch (*p++) {
-                    case '\"': PUTC(c, '\"'); break;
-                    case '\\': PUTC(c, '\\'); break;
-                    case '/':  PUTC(c, '/' ); break;
-                    case 'b':  PUTC(c, '\b'); break;
-                    case 'f':  PUTC(c, '\f'); break;
-                    case 'n':  PUTC(c, '\n'); break;
-                    case 'r':  PUTC(c, '\r'); break;
-                    case 't':  PUTC(c, '\t'); break;
+                switch (p != c->end ? *p++ : '\0') {
+                    case '\"': STRING_PUTC('\"'); break;
+                    case '\\': STRING_PUTC('\\'); break;
+                    case '/':  STRING_PUTC('/' ); break;
+                    case 'b':  STRING_PUTC('\b'); break;
+                    case 'f':  STRING_PUTC('\f'); break;
+                    case 'n':  STRING_PUTC('\n'); break;
+                    case 'r':  STRING_PUTC('\r'); break;
+                    case 't':  STRING_PUTC('\t'); break;
                     case 'u':
-                        if (!(p = lept_parse_hex4(p, &u)))
+                        if (!(p = lept_parse_hex4(p, c->end, &u)))
                             STRING_ERROR(LEPT_PARSE_INVALID_UNICODE_HEX);
                         if (u >= 0xD800 && u <= 0xDBFF) { /* surrogate pair */
-                            if (*p++ != '\\')
+                            if (p == c->end || *p++ != '\\')
                                 STRING_ERROR(LEPT_PARSE_INVALID_UNICODE_SURROGATE);
-                            if (*p++ != 'u')
+                            if (p == c->end || *p++ != 'u')
                                 STRING_ERROR(LEPT_PARSE_INVALID_UNICODE_SURROGATE);
-                            if (!(p = lept_parse_hex4(p, &u2)))
+                            if (!(p = lept_parse_hex4(p, c->end, &u2)))
                                 STRING_ERROR(LEPT_PARSE_INVALID_UNICODE_HEX);
                             if (u2 < 0xDC00 || u2 > 0xDFFF)
                                 STRING_ERROR(LEPT_PARSE_INVALID_UNICODE_SURROGATE);
                             u = (((u - 0xD800) << 10) | (u2 - 0xDC00)) + 0x10000;
                         }
-                        lept_encode_utf8(c, u);
+                        STRING_PUTS(buf, lept_encode_utf8(buf, u));
                         break;
                     default:
                         STRING_ERROR(LEPT_PARSE_INVALID_STRING_ESCAPE);
                 }
                 break;
-            case '\0':
-                STRING_ERROR(LEPT_PARSE_MISS_QUOTATION_MARK);
             default:
-                if ((unsigned char)ch < 0x20)
-                    STRING_ERROR(LEPT_PARSE_INVALID_STRING_CHAR);
-                PUTC(c, ch);
+                assert((unsigned char)ch < 0x20);
+                STRING_ERROR(LEPT_PARSE_INVALID_STRING_CHAR);
         }
+        run = p;
+        p = lept_scan_string(p, c->end);
     }
 }
 
 static int lept_parse_string(lept_context* c, lept_value* v) {
     int ret;
-    char* s;
+    const char* s;
     size_t len;
-    if ((ret = lept_parse_string_raw(c, &s, &len)) == LEPT_PARSE_OK)
-        lept_set_string(v, s, len);
-    return ret;
-}
-
-static int lept_parse_value(lept_context* c, lept_value* v);
-
-static int lept_parse_array(lept_context* c, lept_value* v) {
-    size_t i, size = 0;
-    int ret;
-    EXPECT(c, '[');
-    lept_parse_whitespace(c);
-    if (*c->json == ']') {
-        c->json++;
-        lept_set_array(v, 0);
-        return LEPT_PARSE_OK;
-    }
-    for (;;) {
-        lept_value e;
-        lept_init(&e);
-        if ((ret = lept_parse_value(c, &e)) != LEPT_PARSE_OK)
-            break;
-        memcpy(lept_context_push(c, sizeof(lept_value)), &e, sizeof(lept_value));
-        size++;
-        lept_parse_whitespace(c);
-        if (*c->json == ',') {
-            c->json++;
-            lept_parse_whitespace(c);
-        }
-        else if (*c->json == ']') {
-            c->json++;
-            lept_set_array(v, size);
-            memcpy(v->u.a.e, lept_context_pop(c, size * sizeof(lept_value)), size * sizeof(lept_value));
-            v->u.a.size = size;
-            return LEPT_PARSE_OK;
-        }
-        else {
-            ret = LEPT_PARSE_MISS_COMMA_OR_SQUARE_BRACKET;
-            break;
-        }
-    }
-    /* Pop and free values on the stack */
-    for (i = 0; i < size; i++)
-        lept_free((lept_value*)lept_context_pop(c, sizeof(lept_value)));
-    return ret;
-}
-
-static int lept_parse_object(lept_context* c, lept_value* v) {
-    size_t i, size;
-    lept_member m;
-    int ret;
-    EXPECT(c, '{');
-    lept_parse_whitespace(c);
-    if (*c->json == '}') {
-        c->json++;
-        lept_set_object(v, 0);
-        return LEPT_PARSE_OK;
-    }
-    m.k = NULL;
-    size = 0;
-    for (;;) {
-        char* str;
-        lept_init(&m.v);
-        /* parse key */
-        if (*c->json != '"') {
-            ret = LEPT_PARSE_MISS_KEY;
-            break;
-        }
-        if ((ret = lept_parse_string_raw(c, &str, &m.klen)) != LEPT_PARSE_OK)
-            break;
-        memcpy(m.k = (char*)malloc(m.klen + 1), str, m.klen);
-        m.k[m.klen] = '\0';
-        /* parse ws colon ws */
-        lept_parse_whitespace(c);
-        if (*c->json != ':') {
-            ret = LEPT_PARSE_MISS_COLON;
-            break;
-        }
-        c->json++;
-        lept_parse_whitespace(c);
-        /* parse value */
-        if ((ret = lept_parse_value(c, &m.v)) != LEPT_PARSE_OK)
-            break;
-        memcpy(lept_context_push(c, sizeof(lept_member)), &m, sizeof(lept_member));
-        size++;
-        m.k = NULL; /* ownership is transferred to member on stack */
-        /* parse ws [comma | right-curly-brace] ws */
-        lept_parse_whitespace(c);
-        if (*c->json == ',') {
-            c->json++;
-            lept_parse_whitespace(c);
-        }
-        else if (*c->json == '}') {
-            c->json++;
-            lept_set_object(v, size);
-            memcpy(v->u.o.m, lept_context_pop(c, sizeof(lept_member) * size), sizeof(lept_member) * size);
-            v->u.o.size = size;
-            return LEPT_PARSE_OK;
-        }
-        else {
-            ret = LEPT_PARSE_MISS_COMMA_OR_CURLY_BRACKET;
-            break;
+    if ((ret = lept_parse_string_raw(c, &s, &len)) == LEPT_PARSE_OK) {
+        if (len > UINT32_MAX)
+            ret = LEPT_PARSE_TOO_BIG;
+        else if (c->insitu) {
+            v->u.s = (char*)s;
+            v->size = (uint32_t)len;
+            v->type = LEPT_STRING;
+            v->flags = LEPT_FLAG_BORROWED;
         }
+        else
+            lept_set_string_a(c->a, v, s, len);
     }
-    /* Pop and free members on the stack */
-    free(m.k);
-    for (i = 0; i < size; i++) {
-        lept_member* m = (lept_member*)lept_context_pop(c, sizeof(lept_member));
-        free(m->k);
-        lept_free(&m->v);
-    }
-    v->type = LEPT_NULL;
     return ret;
 }
 
-static int lept_parse_value(lept_context* c, lept_value* v) {
+static int lept_parse_scalar(lept_context* c, lept_value* v) {
+    if (c->json == c->end)
+        return LEPT_PARSE_EXPECT_VALUE;
     switch (*c->json) {
         case 't':  return lept_parse_literal(c, v, "true", LEPT_TRUE);
         case 'f':  return lept_parse_literal(c, v, "false", LEPT_FALSE);
         case 'n':  return lept_parse_literal(c, v, "null", LEPT_NULL);
         default:   return lept_parse_number(c, v);
         case '"':  return lept_parse_string(c, v);
-        case '[':  return lept_parse_array(c, v);
-        case '{':  return lept_parse_object(c, v);
-        case '\0': return LEPT_PARSE_EXPECT_VALUE;
     }
 }
 
-int lept_parse(lept_value* v, const char* json) {
-    lept_context c;
+/*
+ * Open containers live on the context stack as a frame followed by the elements
+ * (lept_value) or members (lept_member) parsed so far. Each frame records the slot,
+ * a value in its parent's run, that receives the container once it is closed.
+ */
+typedef struct {
+    size_t slot;    /* stack offset of the lept_value to fill */
+    size_t parent;  /* stack offset of the enclosing frame */
+}lept_frame;
+
+#define LEPT_NO_FRAME           ((size_t)-1)
+#define LEPT_STACK_AT(c, off)   ((void*)((c)->stack + (off)))
+
+static void lept_parse_push_element(lept_context* c, size_t* slot) {
+    lept_value* e;
+    *slot = c->top;
+    e = (lept_value*)lept_context_push(c, sizeof(lept_value));
+    lept_init(e);
+}
+
+/* Pushes a member with the key at c->json and a null value. */
+static int lept_parse_push_member(lept_context* c, size_t* slot) {
+    const char* str;
+    lept_member* m;
+    size_t klen;
+    char* k;
     int ret;
-    assert(v != NULL);
-    c.json = json;
-    c.stack = NULL;
-    c.size = c.top = 0;
-    lept_init(v);
-    lept_parse_whitespace(&c);
-    if ((ret = lept_parse_value(&c, v)) == LEPT_PARSE_OK) {
-        lept_parse_whitespace(&c);
-        if (*c.json != '\0') {
-            v->type = LEPT_NULL;
-            ret = LEPT_PARSE_ROOT_NOT_SINGULAR;
+    if ((ret = lept_parse_string_raw(c, &str, &klen)) != LEPT_PARSE_OK)
+        return ret;
+    if (c->insitu)
+        k = (char*)str;
+    else if (c->doc != NULL)
+        k = lept_intern(c->doc, str, klen);
+    else {
+        memcpy(k = (char*)lept_alloc(c->a, klen + 1), str, klen);
+        k[klen] = '\0';
+    }
+    m = (lept_member*)lept_context_push(c, sizeof(lept_member));
+    m->k = k;
+    m->klen = klen;
+    lept_init(&m->v);
+    *slot = c->top - sizeof(lept_member) + offsetof(lept_member, v);
+    return LEPT_PARSE_OK;
+}
+
+/*
+ * Moves the run above the frame into a new container, stores it in the frame's slot and
+ * pops the frame. A run too long for a container is left on the stack for unwinding.
+ */
+static int lept_parse_close(lept_context* c, size_t* frame) {
+    const lept_frame* f = (const lept_frame*)LEPT_STACK_AT(c, *frame);
+    size_t slot = f->slot, parent = f->parent, run = *frame + sizeof(lept_frame), n;
+    int array = ((lept_value*)LEPT_STACK_AT(c, slot))->type == LEPT_ARRAY;
+    lept_value e;
+    if ((c->top - run) / (array ? sizeof(lept_value) : sizeof(lept_member)) > UINT32_MAX)
+        return LEPT_PARSE_TOO_BIG;
+    lept_init(&e);
+    if (array) {
+        n = (c->top - run) / sizeof(lept_value);
+        lept_set_array_a(c->a, &e, n);
+        if (n > 0)
+            memcpy(e.u.e, LEPT_STACK_AT(c, run), n * sizeof(lept_value));
+        e.size = (uint32_t)n;
+    }
+    else {
+        n = (c->top - run) / sizeof(lept_member);
+        lept_set_object_a(c->a, &e, n);
+        if (n > 0)
+            memcpy(e.u.m, LEPT_STACK_AT(c, run), n * sizeof(lept_member));
+        e.size = (uint32_t)n;
+        if (c->insitu)
+            e.flags |= LEPT_FLAG_BORROWED;
+        else if (c->doc != NULL)
+            e.flags |= LEPT_FLAG_INTERNED;
+    }
+    c->top = *frame;
+    memcpy(LEPT_STACK_AT(c, slot), &e, sizeof(lept_value));
+    *frame = parent;
+    return LEPT_PARSE_OK;
+}
+
+/* After an error, frees every element and member still on the stack, innermost container first. */
+static void lept_parse_unwind(lept_context* c, size_t frame) {
+    while (frame != LEPT_NO_FRAME) {
+        const lept_frame* f = (const lept_frame*)LEPT_STACK_AT(c, frame);
+        size_t parent = f->parent, i = frame + sizeof(lept_frame);
+        if (((lept_value*)LEPT_STACK_AT(c, f->slot))->type == LEPT_ARRAY)
+            for (; i < c->top; i += sizeof(lept_value))
+                lept_free_a(c->a, (lept_value*)LEPT_STACK_AT(c, i));
+        else
+            for (; i < c->top; i += sizeof(lept_member)) {
+                lept_member* m = (lept_member*)LEPT_STACK_AT(c, i);
+                if (!c->insitu)
+                    lept_release(c->a, m->k, m->klen + 1);
+                lept_free_a(c->a, &m->v);
+            }
+        c->top = frame;
+        frame = parent;
+    }
+}
+
+/* Where the iterative parser stands between two tokens. */
+enum {
+    LEPT_WALK_VALUE,            /* a value for the slot */
+    LEPT_WALK_ELEMENT_OR_END,   /* after '[' */
+    LEPT_WALK_KEY_OR_END,       /* after '{' */
+    LEPT_WALK_KEY,              /* after ',' in an object */
+    LEPT_WALK_COLON,
+    LEPT_WALK_NEXT,             /* ',' or the end of the open container */
+    LEPT_WALK_DONE
+};
+
+/*
+ * State of the iterative parser: native stack use does not depend on the nesting of
+ * the input, which is bounded by LEPT_PARSE_MAX_DEPTH. Everything else lives on the
+ * context stack, so a walk can stop at the end of a chunk and resume on the next.
+ */
+typedef struct {
+    size_t root, slot, frame, depth;
+    int state;
+}lept_walk;
+
+/* Internal results of lept_walk_run(), never returned to users */
+#define LEPT_PARSE_NEED_MORE    (-1)    /* input ended between two tokens */
+#define LEPT_PARSE_PARTIAL      (-2)    /* input ended inside the token at c->json */
+
+#define ISBARE(ch)  (ISDIGIT(ch) || ((ch) >= 'a' && (ch) <= 'z') || (ch) == '-' || (ch) == '+' || (ch) == '.' || (ch) == 'E')
+
+/* Finds the end of a string body, after its closing quote; *escape carries a trailing backslash over. */
+static const char* lept_find_string_end(const char* p, const char* end, int* escape) {
+    if (*escape) {
+        if (p == end)
+            return NULL;
+        p++;
+        *escape = 0;
+    }
+    for (;;) {
+        if ((p = lept_scan_string(p, end)) == end)
+            return NULL;
+        if (*p == '"')
+            return p + 1;
+        if (*p == '\\' && ++p == end) {
+            *escape = 1;
+            return NULL;
         }
+        p++;
     }
-    assert(c.top == 0);
-    free(c.stack);
+}
+
+/* Finds the byte that ends a number or literal, which is not part of the token. */
+static const char* lept_find_bare_end(const char* p, const char* end) {
+    while (p != end && ISBARE(*p))
+        p++;
+    return p != end ? p : NULL;
+}
+
+/* Whether the token at c->json ends before c->end, so it can be lexed without more input. */
+static int lept_token_complete(lept_context* c) {
+    int escape = 0;
+    if (*c->json == '"')
+        return lept_find_string_end(c->json + 1, c->end, &escape) != NULL;
+    return lept_find_bare_end(c->json, c->end) != NULL;
+}
+
+static void lept_walk_init(lept_context* c, lept_walk* w) {
+    lept_value* e;
+    w->root = w->slot = c->top;
+    w->frame = LEPT_NO_FRAME;
+    w->depth = 0;
+    w->state = LEPT_WALK_VALUE;
+    e = (lept_value*)lept_context_push(c, sizeof(lept_value));
+    lept_init(e);
+}
+
+static lept_type lept_walk_container(lept_context* c, const lept_walk* w) {
+    return ((lept_value*)LEPT_STACK_AT(c, ((lept_frame*)LEPT_STACK_AT(c, w->frame))->slot))->type;
+}
+
+static int lept_walk_close(lept_context* c, lept_walk* w) {
+    int ret;
+    c->json++;
+    if ((ret = lept_parse_close(c, &w->frame)) != LEPT_PARSE_OK)
+        return ret;
+    w->depth--;
+    w->state = w->frame == LEPT_NO_FRAME ? LEPT_WALK_DONE : LEPT_WALK_NEXT;
+    return LEPT_PARSE_OK;
+}
+
+/*
+ * Runs until the root value is complete (LEPT_PARSE_OK), an error, or the end of the input.
+ * Unless final, a token cut by the end of the input is left for the next run.
+ */
+static int lept_walk_run(lept_context* c, lept_walk* w, int final) {
+    int ret;
+    while (w->state != LEPT_WALK_DONE) {
+        lept_parse_whitespace(c);
+        if (c->json == c->end)
+            return LEPT_PARSE_NEED_MORE;
+        switch (w->state) {
+            case LEPT_WALK_VALUE:
+                if (*c->json == '[' || *c->json == '{') {
+                    lept_value* e = (lept_value*)LEPT_STACK_AT(c, w->slot);
+                    lept_frame* f;
+                    if (w->depth == LEPT_PARSE_MAX_DEPTH)
+                        return LEPT_PARSE_TOO_DEEP;
+                    /* an empty container marks the slot until it is closed */
+                    if (*c->json++ == '[') {
+                        e->type = LEPT_ARRAY;
+                        e->u.e = NULL;
+                        e->size = 0;
+                        w->state = LEPT_WALK_ELEMENT_OR_END;
+                    }
+                    else {
+                        e->type = LEPT_OBJECT;
+                        e->u.m = NULL;
+                        e->size = 0;
+                        w->state = LEPT_WALK_KEY_OR_END;
+                    }
+                    f = (lept_frame*)lept_context_push(c, sizeof(lept_frame));
+                    f->slot = w->slot;
+                    f->parent = w->frame;
+                    w->frame = c->top - sizeof(lept_frame);
+                    w->depth++;
+                }
+                else {
+                    /* string decoding may move the stack, so parse out of place */
+                    lept_value s;
+                    if (!final && !lept_token_complete(c))
+                        return LEPT_PARSE_PARTIAL;
+                    lept_init(&s);
+                    if ((ret = lept_parse_scalar(c, &s)) != LEPT_PARSE_OK)
+                        return ret;
+                    memcpy(LEPT_STACK_AT(c, w->slot), &s, sizeof(lept_value));
+                    w->state = w->frame == LEPT_NO_FRAME ? LEPT_WALK_DONE : LEPT_WALK_NEXT;
+                }
+                break;
+            case LEPT_WALK_ELEMENT_OR_END:
+                if (*c->json == ']') {
+                    if ((ret = lept_walk_close(c, w)) != LEPT_PARSE_OK)
+                        return ret;
+                }
+                else {
+                    lept_parse_push_element(c, &w->slot);
+                    w->state = LEPT_WALK_VALUE;
+                }
+                break;
+            case LEPT_WALK_KEY_OR_END:
+                if (*c->json == '}') {
+                    if ((ret = lept_walk_close(c, w)) != LEPT_PARSE_OK)
+                        return ret;
+                    break;
+                }
+                /* fall through */
+            case LEPT_WALK_KEY:
+                if (*c->json != '"')
+                    return LEPT_PARSE_MISS_KEY;
+                if (!final && !lept_token_complete(c))
+                    return LEPT_PARSE_PARTIAL;
+                if ((ret = lept_parse_push_member(c, &w->slot)) != LEPT_PARSE_OK)
+                    return ret;
+                w->state = LEPT_WALK_COLON;
+                break;
+            case LEPT_WALK_COLON:
+                if (*c->json != ':')
+                    return LEPT_PARSE_MISS_COLON;
+                c->json++;
+                w->state = LEPT_WALK_VALUE;
+                break;
+            case LEPT_WALK_NEXT:
+                if (*c->json == ',') {
+                    c->json++;
+                    if (lept_walk_container(c, w) == LEPT_ARRAY) {
+                        lept_parse_push_element(c, &w->slot);
+                        w->state = LEPT_WALK_VALUE;
+                    }
+                    else
+                        w->state = LEPT_WALK_KEY;
+                }
+                else if (*c->json == (lept_walk_container(c, w) == LEPT_ARRAY ? ']' : '}')) {
+                    if ((ret = lept_walk_close(c, w)) != LEPT_PARSE_OK)
+                        return ret;
+                }
+                else
+                    return lept_walk_container(c, w) == LEPT_ARRAY ?
+                        LEPT_PARSE_MISS_COMMA_OR_SQUARE_BRACKET : LEPT_PARSE_MISS_COMMA_OR_CURLY_BRACKET;
+                break;
+        }
+    }
+    return LEPT_PARSE_OK;
+}
+
+/* The error for input that ends where the walk stands. */
+static int lept_walk_eof(lept_context* c, const lept_walk* w) {
+    switch (w->state) {
+        case LEPT_WALK_KEY_OR_END:
+        case LEPT_WALK_KEY:     return LEPT_PARSE_MISS_KEY;
+        case LEPT_WALK_COLON:   return LEPT_PARSE_MISS_COLON;
+        case LEPT_WALK_NEXT:
+            return lept_walk_container(c, w) == LEPT_ARRAY ?
+                LEPT_PARSE_MISS_COMMA_OR_SQUARE_BRACKET : LEPT_PARSE_MISS_COMMA_OR_CURLY_BRACKET;
+        default:                return LEPT_PARSE_EXPECT_VALUE;
+    }
+}
+
+/* Moves the root value out on success, otherwise frees what was built; pops everything. */
+static int lept_walk_end(lept_context* c, lept_walk* w, lept_value* v, int ret) {
+    if (ret == LEPT_PARSE_OK)
+        memcpy(v, LEPT_STACK_AT(c, w->root), sizeof(lept_value));
+    else
+        lept_parse_unwind(c, w->frame);
+    c->top = w->root;
     return ret;
 }
 
-static void lept_stringify_string(lept_context* c, const char* s, size_t len) {
-    static const char hex_digits[] = { '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'A', 'B', 'C', 'D', 'E', 'F' };
-    size_t i, size;
-    char* head, *p;
-    assert(s != NULL);
-    p = head = lept_context_push(c, size = len * 6 + 2); /* "\u00xx..." */
-    *p++ = '"';
-    for (i = 0; i < len; i++) {
-        unsigned char ch = (unsigned char)s[i];
-        switch (ch) {
-            case '\"': *p++ = '\\'; *p++ = '\"'; break;
-            case '\\': *p++ = '\\'; *p++ = '\\'; break;
-            case '\b': *p++ = '\\'; *p++ = 'b';  break;
-            case '\f': *p++ = '\\'; *p++ = 'f';  break;
-            case '\n': *p++ = '\\'; *p++ = 'n';  break;
-            case '\r': *p++ = '\\'; *p++ = 'r';  break;
-            case '\t': *p++ = '\\'; *p++ = 't';  break;
-            default:
-                if (ch < 0x20) {
-                    *p++ = '\\'; *p++ = 'u'; *p++ = '0'; *p++ = '0';
-                    *p++ = hex_digits[ch >> 4];
-                    *p++ = hex_digits[ch & 15];
+static int lept_parse_value(lept_context* c, lept_value* v) {
+    lept_walk w;
+    int ret;
+    lept_walk_init(c, &w);
+    if ((ret = lept_walk_run(c, &w, 1)) == LEPT_PARSE_NEED_MORE)
+        ret = lept_walk_eof(c, &w);
+    return lept_walk_end(c, &w, v, ret);
+}
+
+/* Indexes blocks from x->off on until the positions might not fit, or to the end of the input. */
+static void lept_indexer_fill(lept_indexer* x) {
+    lept_classes k;
+    char pad[3 + 64];
+    x->base = x->json + x->off;
+    x->count = x->next = 0;
+    while (!x->done && x->count <= LEPT_PARSE_INDEX_SIZE - 64) {
+        size_t rest = x->len - x->off, n = rest < 64 ? rest : 64;
+        uint32_t rel = (uint32_t)(x->json + x->off - x->base);
+        uint64_t bits;
+        if (rest >= 64 && x->off >= 3)
+            lept_classify(x, x->json + x->off, &k);
+        else {
+            /* the first and the last block are read from a copy, padded with spaces */
+            size_t before = x->off < 3 ? x->off : 3;
+            memset(pad, ' ', sizeof(pad));
+            memcpy(pad + 3 - before, x->json + x->off - before, before + n);
+            lept_classify(x, pad + 3, &k);
+            x->done = rest < 64;
+        }
+        bits = lept_index_bits(x, &k);
+        x->off += n;
+        while (bits != 0) {
+            x->pos[x->count++] = rel + lept_ctz64(bits);
+            bits &= bits - 1;
+        }
+        if (rel >= UINT32_MAX - 128)
+            break;
+    }
+}
+
+/* Stage one runs ahead of stage two one batch of positions at a time. */
+static const char* lept_indexer_refill(lept_indexer* x) {
+    do {
+        if (x->done || x->invalid)
+            return x->json + x->len;
+        lept_indexer_fill(x);
+    } while (x->count == 0);
+    return x->base + x->pos[x->next++];
+}
+
+static void lept_indexer_begin(lept_indexer* x, const char* json, size_t len, const lept_allocator* sa) {
+    memset(x, 0, sizeof(*x));
+    x->json = json;
+    x->len = len;
+    x->pos = (uint32_t*)lept_alloc(sa, LEPT_PARSE_INDEX_SIZE * sizeof(uint32_t));
+}
+
+/* Checks the rest of the input, which has to be UTF-8 as well; returns 0 if any of it is not. */
+static int lept_indexer_end(lept_indexer* x, const lept_allocator* sa) {
+    while (!x->done && !x->invalid)
+        lept_indexer_fill(x);
+    lept_release(sa, x->pos, LEPT_PARSE_INDEX_SIZE * sizeof(uint32_t));
+    return !x->invalid;
+}
+
+/* The start of the next token, or the end of the input */
+#define LEPT_INDEXER_NEXT(x) ((x)->next < (x)->count ? (x)->base + (x)->pos[(x)->next++] : lept_indexer_refill(x))
+
+/* The token after the one that ends at c->json, or NULL if anything but whitespace is between them. */
+static const char* lept_indexer_after(lept_context* c, lept_indexer* x) {
+    const char* p = LEPT_INDEXER_NEXT(x);
+    return p == c->json || (p > c->json && ISWHITESPACE(*c->json)) ? p : NULL;
+}
+
+/* Closes the open container, which ends at the current token, and moves *p to the next one. */
+static int lept_indexer_close(lept_context* c, lept_indexer* x, lept_walk* w, const char** p) {
+    int ret;
+    if ((ret = lept_parse_close(c, &w->frame)) != LEPT_PARSE_OK)
+        return ret;
+    w->depth--;
+    w->state = w->frame == LEPT_NO_FRAME ? LEPT_WALK_DONE : LEPT_WALK_NEXT;
+    *p = LEPT_INDEXER_NEXT(x);
+    return LEPT_PARSE_OK;
+}
+
+/*
+ * Checks the value at token *p, below depth open containers, without building it. On
+ * success *p is the token after the value and c->json the byte after its end.
+ */
+static int lept_parse_skip(lept_context* c, lept_indexer* x, const char** p, size_t depth) {
+    size_t base = c->top;
+    const char* q = *p, * str;
+    int state = LEPT_WALK_VALUE, ret = LEPT_PARSE_OK;
+    for (;;) {
+        lept_value s;
+        size_t len;
+        char open;
+        if (q == NULL || q == c->end) {
+            ret = LEPT_PARSE_EXPECT_VALUE;
+            break;
+        }
+        switch (state) {
+            case LEPT_WALK_VALUE:
+                if (*q == '[' || *q == '{') {
+                    if (depth + c->top - base == LEPT_PARSE_MAX_DEPTH) {
+                        ret = LEPT_PARSE_TOO_DEEP;
+                        break;
+                    }
+                    PUTC(c, *q);
+                    state = *q == '[' ? LEPT_WALK_ELEMENT_OR_END : LEPT_WALK_KEY_OR_END;
+                    q = LEPT_INDEXER_NEXT(x);
+                    continue;
+                }
+                c->json = q;
+                lept_init(&s);
+                if ((ret = *q == '"' ? lept_parse_string_raw(c, &str, &len) : lept_parse_scalar(c, &s)) != LEPT_PARSE_OK)
+                    break;
+                q = lept_indexer_after(c, x);
+                if (c->top == base) {
+                    *p = q;
+                    return LEPT_PARSE_OK;
+                }
+                state = LEPT_WALK_NEXT;
+                continue;
+            case LEPT_WALK_ELEMENT_OR_END:
+                if (*q != ']') {
+                    state = LEPT_WALK_VALUE;
+                    continue;
+                }
+                break;
+            case LEPT_WALK_KEY_OR_END:
+                if (*q == '}')
+                    break;
+                /* fall through */
+            case LEPT_WALK_KEY:
+                c->json = q;
+                if (*q != '"')
+                    ret = LEPT_PARSE_MISS_KEY;
+                else if ((ret = lept_parse_string_raw(c, &str, &len)) == LEPT_PARSE_OK) {
+                    if ((q = lept_indexer_after(c, x)) == NULL || q == c->end || *q != ':')
+                        ret = LEPT_PARSE_MISS_COLON;
+                    else {
+                        q = LEPT_INDEXER_NEXT(x);
+                        state = LEPT_WALK_VALUE;
+                        continue;
+                    }
+                }
+                break;
+            case LEPT_WALK_NEXT:
+                open = c->stack[c->top - 1];
+                if (*q == ',') {
+                    q = LEPT_INDEXER_NEXT(x);
+                    state = open == '[' ? LEPT_WALK_VALUE : LEPT_WALK_KEY;
+                    continue;
+                }
+                if (*q != (open == '[' ? ']' : '}'))
+                    ret = LEPT_PARSE_INVALID_VALUE;
+                break;
+        }
+        if (ret != LEPT_PARSE_OK)
+            break;
+        /* q closes the innermost container */
+        c->json = q + 1;
+        q = LEPT_INDEXER_NEXT(x);
+        if (--c->top == base) {
+            *p = q;
+            return LEPT_PARSE_OK;
+        }
+        state = LEPT_WALK_NEXT;
+    }
+    c->top = base;
+    return ret;
+}
+
+/*
+ * Stage two of lept_parse_indexed(): builds the value at token *p from the token positions
+ * with the frames of lept_walk_run(), below depth open containers, but never looks at the
+ * bytes between tokens. Then *p is the token after the value. Its errors are only
+ * approximate, the reference parser names them.
+ */
+static int lept_parse_indexed_token(lept_context* c, lept_indexer* x, const char** pp, size_t depth, lept_value* v) {
+    lept_walk w;
+    const char* p = *pp;
+    int ret = LEPT_PARSE_OK;
+    lept_walk_init(c, &w);
+    w.depth = depth;
+    while (ret == LEPT_PARSE_OK && w.state != LEPT_WALK_DONE) {
+        if (p == NULL || p == c->end) {
+            ret = LEPT_PARSE_EXPECT_VALUE;
+            break;
+        }
+        switch (w.state) {
+            case LEPT_WALK_VALUE:
+                if ((*p == '[' || *p == '{') && c->lazy && w.depth > 0) {
+                    const char* q = p;
+                    lept_value* e;
+                    if ((ret = lept_parse_skip(c, x, &p, w.depth)) != LEPT_PARSE_OK)
+                        break;
+                    if ((size_t)(c->json - q) > UINT32_MAX) {
+                        /* too long for the size field to span, so it is built now */
+                        lept_value s;
+                        lept_init(&s);
+                        c->json = q;
+                        if ((ret = lept_parse_value(c, &s)) != LEPT_PARSE_OK)
+                            break;
+                        memcpy(LEPT_STACK_AT(c, w.slot), &s, sizeof(lept_value));
+                        w.state = LEPT_WALK_NEXT;
+                        break;
+                    }
+                    e = (lept_value*)LEPT_STACK_AT(c, w.slot);
+                    e->type = *q == '[' ? LEPT_ARRAY : LEPT_OBJECT;
+                    e->size = (uint32_t)(c->json - q);
+                    if (c->a == NULL) {
+                        e->flags = LEPT_FLAG_LAZY;
+                        e->u.s = (char*)q;
+                    }
+                    else {
+                        lept_lazy* z = (lept_lazy*)lept_alloc(c->a, sizeof(lept_lazy));
+                        z->json = q;
+                        z->a = c->a;
+                        e->flags = LEPT_FLAG_LAZY | LEPT_FLAG_LAZY_A | LEPT_STORAGE_FLAGS(c->a);
+                        e->u.s = (char*)z;
+                    }
+                    w.state = LEPT_WALK_NEXT;
+                }
+                else if (*p == '[' || *p == '{') {
+                    lept_value* e = (lept_value*)LEPT_STACK_AT(c, w.slot);
+                    lept_frame* f;
+                    if (w.depth == LEPT_PARSE_MAX_DEPTH) {
+                        ret = LEPT_PARSE_TOO_DEEP;
+                        break;
+                    }
+                    if (*p == '[') {
+                        e->type = LEPT_ARRAY;
+                        e->u.e = NULL;
+                        w.state = LEPT_WALK_ELEMENT_OR_END;
+                    }
+                    else {
+                        e->type = LEPT_OBJECT;
+                        e->u.m = NULL;
+                        w.state = LEPT_WALK_KEY_OR_END;
+                    }
+                    e->size = 0;
+                    f = (lept_frame*)lept_context_push(c, sizeof(lept_frame));
+                    f->slot = w.slot;
+                    f->parent = w.frame;
+                    w.frame = c->top - sizeof(lept_frame);
+                    w.depth++;
+                    p = LEPT_INDEXER_NEXT(x);
+                }
+                else {
+                    lept_value s;
+                    lept_init(&s);
+                    c->json = p;
+                    if ((ret = lept_parse_scalar(c, &s)) != LEPT_PARSE_OK)
+                        break;
+                    memcpy(LEPT_STACK_AT(c, w.slot), &s, sizeof(lept_value));
+                    p = lept_indexer_after(c, x);
+                    w.state = w.frame == LEPT_NO_FRAME ? LEPT_WALK_DONE : LEPT_WALK_NEXT;
+                }
+                break;
+            case LEPT_WALK_ELEMENT_OR_END:
+                if (*p == ']')
+                    ret = lept_indexer_close(c, x, &w, &p);
+                else {
+                    lept_parse_push_element(c, &w.slot);
+                    w.state = LEPT_WALK_VALUE;
+                }
+                break;
+            case LEPT_WALK_KEY_OR_END:
+                if (*p == '}') {
+                    ret = lept_indexer_close(c, x, &w, &p);
+                    break;
+                }
+                /* fall through */
+            case LEPT_WALK_KEY:
+                c->json = p;
+                if (*p != '"')
+                    ret = LEPT_PARSE_MISS_KEY;
+                else if ((ret = lept_parse_push_member(c, &w.slot)) == LEPT_PARSE_OK) {
+                    if ((p = lept_indexer_after(c, x)) == NULL || p == c->end || *p != ':')
+                        ret = LEPT_PARSE_MISS_COLON;
+                    else {
+                        p = LEPT_INDEXER_NEXT(x);
+                        w.state = LEPT_WALK_VALUE;
+                    }
+                }
+                break;
+            case LEPT_WALK_NEXT:
+                if (*p == ',') {
+                    p = LEPT_INDEXER_NEXT(x);
+                    if (lept_walk_container(c, &w) == LEPT_ARRAY) {
+                        lept_parse_push_element(c, &w.slot);
+                        w.state = LEPT_WALK_VALUE;
+                    }
+                    else
+                        w.state = LEPT_WALK_KEY;
                 }
+                else if (*p == (lept_walk_container(c, &w) == LEPT_ARRAY ? ']' : '}'))
+                    ret = lept_indexer_close(c, x, &w, &p);
                 else
-                    *p++ = s[i];
+                    ret = LEPT_PARSE_INVALID_VALUE;
+                break;
         }
     }
-    *p++ = '"';
-    c->top -= size - (p - head);
+    *pp = p;
+    return lept_walk_end(c, &w, v, ret);
 }
 
-static void lept_stringify_value(lept_context* c, const lept_value* v) {
-    size_t i;
-    switch (v->type) {
-        case LEPT_NULL:   PUTS(c, "null",  4); break;
-        case LEPT_FALSE:  PUTS(c, "false", 5); break;
-        case LEPT_TRUE:   PUTS(c, "true",  4); break;
-        case LEPT_NUMBER: c->top -= 32 - sprintf(lept_context_push(c, 32), "%.17g", v->u.n); break;
-        case LEPT_STRING: lept_stringify_string(c, v->u.s.s, v->u.s.len); break;
-        case LEPT_ARRAY:
-            PUTC(c, '[');
-            for (i = 0; i < v->u.a.size; i++) {
-                if (i > 0)
-                    PUTC(c, ',');
-                lept_stringify_value(c, &v->u.a.e[i]);
-            }
-            PUTC(c, ']');
+static int lept_parse_indexed_value(lept_context* c, lept_indexer* x, lept_value* v) {
+    const char* p = LEPT_INDEXER_NEXT(x);
+    int ret;
+    if ((ret = lept_parse_indexed_token(c, x, &p, 0, v)) == LEPT_PARSE_OK && p != c->end) {
+        lept_free_a(c->a, v);
+        ret = LEPT_PARSE_ROOT_NOT_SINGULAR;
+    }
+    return ret;
+}
+
+/* A container open in lept_parse_sax, kept on the context stack. */
+typedef struct {
+    size_t count;   /* elements or members so far */
+    int object;
+}lept_sax_frame;
+
+/* Calls back only if the handler has the callback; evaluates to 0 if it asked to stop. */
+#define LEPT_SAX_CALL(h, cb, args) ((h)->cb == NULL || (h)->cb args)
+
+static int lept_sax_key(lept_context* c, const lept_handler* h, void* ctx) {
+    const char* s;
+    size_t len;
+    int ret;
+    if (PEEK(c) != '"')
+        return LEPT_PARSE_MISS_KEY;
+    if ((ret = lept_parse_string_raw(c, &s, &len)) != LEPT_PARSE_OK)
+        return ret;
+    if (!LEPT_SAX_CALL(h, key, (ctx, s, len)))
+        return LEPT_PARSE_STOPPED;
+    lept_parse_whitespace(c);
+    if (PEEK(c) != ':')
+        return LEPT_PARSE_MISS_COLON;
+    c->json++;
+    lept_parse_whitespace(c);
+    return LEPT_PARSE_OK;
+}
+
+static int lept_sax_scalar(lept_context* c, const lept_handler* h, void* ctx) {
+    lept_value v;
+    const char* s;
+    size_t len;
+    int ret, go;
+    if (PEEK(c) == '"') {
+        if ((ret = lept_parse_string_raw(c, &s, &len)) != LEPT_PARSE_OK)
+            return ret;
+        return LEPT_SAX_CALL(h, string, (ctx, s, len)) ? LEPT_PARSE_OK : LEPT_PARSE_STOPPED;
+    }
+    lept_init(&v);
+    if ((ret = lept_parse_scalar(c, &v)) != LEPT_PARSE_OK)
+        return ret;
+    switch (v.type) {
+        case LEPT_NULL:   go = LEPT_SAX_CALL(h, null, (ctx)); break;
+        case LEPT_FALSE:  go = LEPT_SAX_CALL(h, boolean, (ctx, 0)); break;
+        case LEPT_TRUE:   go = LEPT_SAX_CALL(h, boolean, (ctx, 1)); break;
+        default:
+            if ((v.flags & LEPT_FLAG_INT64) && h->int64 != NULL)
+                go = h->int64(ctx, v.u.i);
+            else
+                go = LEPT_SAX_CALL(h, number, (ctx, lept_get_number(&v)));
             break;
-        case LEPT_OBJECT:
-            PUTC(c, '{');
-            for (i = 0; i < v->u.o.size; i++) {
-                if (i > 0)
-                    PUTC(c, ',');
-                lept_stringify_string(c, v->u.o.m[i].k, v->u.o.m[i].klen);
-                PUTC(c, ':');
-                lept_stringify_value(c, &v->u.o.m[i].v);
+    }
+    return go ? LEPT_PARSE_OK : LEPT_PARSE_STOPPED;
+}
+
+/* Same walk as lept_parse_value, but reports each token instead of building values. */
+static int lept_sax_value(lept_context* c, const lept_handler* h, void* ctx) {
+    size_t depth = 0;
+    int ret;
+    for (;;) {
+        lept_sax_frame* f;
+        char ch = PEEK(c);
+        if (ch == '[' || ch == '{') {
+            if (depth == LEPT_PARSE_MAX_DEPTH)
+                return LEPT_PARSE_TOO_DEEP;
+            c->json++;
+            if (!(ch == '[' ? LEPT_SAX_CALL(h, start_array, (ctx)) : LEPT_SAX_CALL(h, start_object, (ctx))))
+                return LEPT_PARSE_STOPPED;
+            f = (lept_sax_frame*)lept_context_push(c, sizeof(lept_sax_frame));
+            f->count = 0;
+            f->object = ch == '{';
+            depth++;
+            lept_parse_whitespace(c);
+            if (PEEK(c) != (ch == '[' ? ']' : '}')) {
+                if (ch == '{' && (ret = lept_sax_key(c, h, ctx)) != LEPT_PARSE_OK)
+                    return ret;
+                continue;
             }
-            PUTC(c, '}');
-            break;
-        default: assert(0 && "invalid type");
+            c->json++;
+            lept_context_pop(c, sizeof(lept_sax_frame));
+            depth--;
+            if (!(ch == '[' ? LEPT_SAX_CALL(h, end_array, (ctx, 0)) : LEPT_SAX_CALL(h, end_object, (ctx, 0))))
+                return LEPT_PARSE_STOPPED;
+        }
+        else if ((ret = lept_sax_scalar(c, h, ctx)) != LEPT_PARSE_OK)
+            return ret;
+        /* a value is complete: close containers until one takes another element */
+        while (depth > 0) {
+            f = (lept_sax_frame*)(c->stack + c->top - sizeof(lept_sax_frame));
+            f->count++;
+            lept_parse_whitespace(c);
+            if (PEEK(c) == ',') {
+                c->json++;
+                lept_parse_whitespace(c);
+                if (f->object && (ret = lept_sax_key(c, h, ctx)) != LEPT_PARSE_OK)
+                    return ret;
+                break;
+            }
+            if (PEEK(c) != (f->object ? '}' : ']'))
+                return f->object ? LEPT_PARSE_MISS_COMMA_OR_CURLY_BRACKET : LEPT_PARSE_MISS_COMMA_OR_SQUARE_BRACKET;
+            c->json++;
+            lept_context_pop(c, sizeof(lept_sax_frame));
+            depth--;
+            if (!(f->object ? LEPT_SAX_CALL(h, end_object, (ctx, f->count)) : LEPT_SAX_CALL(h, end_array, (ctx, f->count))))
+                return LEPT_PARSE_STOPPED;
+        }
+        if (depth == 0)
+            return LEPT_PARSE_OK;
+    }
+}
+
+int lept_parse(lept_value* v, const char* json) {
+    assert(json != NULL);
+    return lept_parse_n(v, json, strlen(json));
+}
+
+static void lept_parse_begin(lept_context* c, const char* json, size_t len, int insitu, const lept_allocator* a, const lept_allocator* sa) {
+    c->json = json;
+    c->end = json + len;
+    c->stack = NULL;
+    c->size = c->top = 0;
+    c->insitu = insitu;
+    c->lazy = 0;
+    c->a = a;
+    c->sa = sa;
+    c->doc = insitu ? NULL : LEPT_DOCUMENT_OF(a);
+}
+
+static int lept_parse_root(lept_value* v, const char* json, size_t len, int insitu, const lept_allocator* a, const lept_allocator* sa) {
+    lept_context c;
+    int ret;
+    assert(v != NULL && json != NULL);
+    lept_parse_begin(&c, json, len, insitu, a, sa);
+    lept_init(v);
+    lept_parse_whitespace(&c);
+    if ((ret = lept_parse_value(&c, v)) == LEPT_PARSE_OK) {
+        lept_parse_whitespace(&c);
+        if (c.json != c.end) {
+            lept_free_a(a, v);
+            ret = LEPT_PARSE_ROOT_NOT_SINGULAR;
+        }
+    }
+    assert(c.top == 0);
+    lept_release(sa, c.stack, c.size);
+    return ret;
+}
+
+/*
+ * The parse stack is temporary, so it never comes from an allocator that cannot release:
+ * a document's comes from its upstream, another region's from the default.
+ */
+#define LEPT_STACK_ALLOCATOR(a) ((a) == NULL || (a)->release != NULL ? (a) : \
+                                    LEPT_DOCUMENT_OF(a) != NULL ? LEPT_DOCUMENT_OF(a)->upstream : NULL)
+
+int lept_parse_n(lept_value* v, const char* json, size_t len) {
+    return lept_parse_root(v, json, len, 0, NULL, NULL);
+}
+
+int lept_parse_a(const lept_allocator* a, lept_value* v, const char* json, size_t len) {
+    return lept_parse_root(v, json, len, 0, a, LEPT_STACK_ALLOCATOR(a));
+}
+
+int lept_parse_sax_a(const lept_allocator* a, const char* json, size_t len, const lept_handler* h, void* ctx) {
+    lept_context c;
+    int ret;
+    assert(json != NULL && h != NULL);
+    lept_parse_begin(&c, json, len, 0, NULL, LEPT_STACK_ALLOCATOR(a));
+    lept_parse_whitespace(&c);
+    if ((ret = lept_sax_value(&c, h, ctx)) == LEPT_PARSE_OK) {
+        lept_parse_whitespace(&c);
+        if (c.json != c.end)
+            ret = LEPT_PARSE_ROOT_NOT_SINGULAR;
+    }
+    lept_release(c.sa, c.stack, c.size);
+    return ret;
+}
+
+int lept_parse_sax(const char* json, size_t len, const lept_handler* h, void* ctx) {
+    return lept_parse_sax_a(NULL, json, len, h, ctx);
+}
+
+int lept_parse_insitu(lept_value* v, char* json, size_t len) {
+    return lept_parse_root(v, json, len, 1, NULL, NULL);
+}
+
+int lept_parse_insitu_a(const lept_allocator* a, lept_value* v, char* json, size_t len) {
+    return lept_parse_root(v, json, len, 1, a, LEPT_STACK_ALLOCATOR(a));
+}
+
+lept_many lept_parse_many_a(const lept_allocator* a, const char* json, size_t len) {
+    lept_many it;
+    assert(json != NULL);
+    it.json = json;
+    it.len = len;
+    it.offset = it.next = 0;
+    it.stack = NULL;
+    it.stack_size = 0;
+    it.allocator = a;
+    return it;
+}
+
+lept_many lept_parse_many(const char* json, size_t len) {
+    return lept_parse_many_a(NULL, json, len);
+}
+
+int lept_next(lept_many* it, lept_value* v) {
+    lept_context c;
+    const char* p;
+    int ret;
+    assert(it != NULL && v != NULL);
+    lept_parse_begin(&c, it->json + it->next, it->len - it->next, 0, it->allocator, LEPT_STACK_ALLOCATOR(it->allocator));
+    c.stack = it->stack;
+    c.size = it->stack_size;
+    lept_init(v);
+    lept_parse_whitespace(&c);
+    it->next = c.json - it->json;
+    if (c.json == c.end)
+        return LEPT_PARSE_END;
+    it->offset = it->next;
+    if ((ret = lept_parse_value(&c, v)) == LEPT_PARSE_OK)
+        it->next = c.json - it->json;
+    else {
+        p = (const char*)memchr(it->json + it->offset, '\n', it->len - it->offset);
+        it->next = p != NULL ? (size_t)(p + 1 - it->json) : it->len;
+    }
+    assert(c.top == 0);
+    it->stack = c.stack;
+    it->stack_size = c.size;
+    return ret;
+}
+
+void lept_many_free(lept_many* it) {
+    assert(it != NULL);
+    lept_release(LEPT_STACK_ALLOCATOR(it->allocator), it->stack, it->stack_size);
+    it->stack = NULL;
+    it->stack_size = 0;
+}
+
+static int lept_parse_indexed_root(lept_value* v, const char* json, size_t len, int lazy, const lept_allocator* a, const lept_allocator* sa) {
+    lept_context c;
+    lept_indexer x;
+    int ret;
+    assert(v != NULL && json != NULL);
+    lept_parse_begin(&c, json, len, 0, a, sa);
+    c.lazy = lazy;
+    lept_indexer_begin(&x, json, len, sa);
+    lept_init(v);
+    ret = lept_parse_indexed_value(&c, &x, v);
+    if (!lept_indexer_end(&x, sa)) {
+        if (ret == LEPT_PARSE_OK)
+            lept_free_a(a, v);
+        ret = LEPT_PARSE_INVALID_UTF8;
+    }
+    assert(c.top == 0);
+    lept_release(sa, c.stack, c.size);
+    if (ret != LEPT_PARSE_OK && ret != LEPT_PARSE_INVALID_UTF8)
+        ret = lept_parse_root(v, json, len, 0, a, sa);
+    return ret;
+}
+
+int lept_parse_indexed(lept_value* v, const char* json, size_t len) {
+    return lept_parse_indexed_root(v, json, len, 0, NULL, NULL);
+}
+
+int lept_parse_indexed_a(const lept_allocator* a, lept_value* v, const char* json, size_t len) {
+    return lept_parse_indexed_root(v, json, len, 0, a, LEPT_STACK_ALLOCATOR(a));
+}
+
+int lept_parse_lazy(lept_value* v, const char* json, size_t len) {
+    return lept_parse_indexed_root(v, json, len, 1, NULL, NULL);
+}
+
+int lept_parse_lazy_a(const lept_allocator* a, lept_value* v, const char* json, size_t len) {
+    return lept_parse_indexed_root(v, json, len, 1, a, LEPT_STACK_ALLOCATOR(a));
+}
+
+/* Parses the top level of a lazy container in place; lept_parse_lazy() has checked its bytes. */
+static void lept_parse_load(lept_value* v) {
+    const lept_allocator* a = v->flags & LEPT_FLAG_LAZY_A ? ((const lept_lazy*)v->u.s)->a : NULL;
+    const lept_allocator* sa = LEPT_STACK_ALLOCATOR(a);
+    const char* json = LEPT_LAZY_JSON(v);
+    lept_context c;
+    lept_indexer x;
+    lept_value e;
+    int ret;
+    lept_parse_begin(&c, json, v->size, 0, a, sa);
+    c.lazy = 1;
+    lept_indexer_begin(&x, json, v->size, sa);
+    lept_init(&e);
+    ret = lept_parse_indexed_value(&c, &x, &e);
+    assert(ret == LEPT_PARSE_OK);
+    (void)ret;
+    lept_indexer_end(&x, sa);
+    lept_release(sa, c.stack, c.size);
+    lept_free_a(a, v);
+    memcpy(v, &e, sizeof(lept_value));
+}
+
+/* Accessors that reach into an array or object parse it first if it is lazy, even through a const pointer. */
+#define LEPT_LOAD(v)    do { if ((v)->flags & LEPT_FLAG_LAZY) lept_parse_load((lept_value*)(v)); } while(0)
+
+/* Whether pointer is "" or starts with '/', and uses '~' only in "~0" and "~1". */
+static int lept_pointer_valid(const char* pointer) {
+    const char* q;
+    if (*pointer != '/' && *pointer != '\0')
+        return 0;
+    for (q = pointer; *q != '\0'; q++)
+        if (*q == '~' && q[1] != '0' && q[1] != '1')
+            return 0;
+    return 1;
+}
+
+/*
+ * Matches the JSON Pointer reference token after the '/' at *q against key, with "~0" and
+ * "~1" standing for '~' and '/'. On a match *q moves to the end of the token.
+ */
+static int lept_pointer_match(const char** q, const char* key, size_t klen) {
+    const char* t = *q + 1;
+    size_t i = 0;
+    assert(**q == '/');
+    for (; *t != '/' && *t != '\0'; t++, i++) {
+        char ch = *t;
+        if (ch == '~') {
+            if (t[1] != '0' && t[1] != '1')
+                return 0;
+            ch = *++t == '0' ? '~' : '/';
+        }
+        if (i == klen || key[i] != ch)
+            return 0;
+    }
+    if (i != klen)
+        return 0;
+    *q = t;
+    return 1;
+}
+
+/* The array index named by the token after the '/' at q, or LEPT_KEY_NOT_EXIST if it names none. */
+static size_t lept_pointer_index(const char* q) {
+    const char* t = q + 1;
+    size_t i = 0;
+    if (*t == '0')
+        return t[1] == '/' || t[1] == '\0' ? 0 : LEPT_KEY_NOT_EXIST;
+    for (; ISDIGIT(*t); t++) {
+        if (i >= ((size_t)-1 - 9) / 10)
+            return LEPT_KEY_NOT_EXIST;
+        i = i * 10 + (size_t)(*t - '0');
+    }
+    return t != q + 1 && (*t == '/' || *t == '\0') ? i : LEPT_KEY_NOT_EXIST;
+}
+
+/* The end of the token after the '/' at q */
+static const char* lept_pointer_skip(const char* q) {
+    for (q++; *q != '/' && *q != '\0'; q++)
+        ;
+    return q;
+}
+
+/*
+ * For lept_parse_select(): builds into v the parts of the container at token *p that the
+ * pointers lead into, and sets *found if there are any. at[i] is the rest of pointer i
+ * from this container on, or NULL if it does not pass through.
+ */
+static int lept_select_value(lept_context* c, lept_indexer* x, const char** p, const char** at, size_t n, size_t depth, lept_value* v, int* found) {
+    const char** next;
+    const char* q = *p, * key = NULL;
+    size_t i, klen = 0, index, * target = NULL;
+    int ret = LEPT_PARSE_OK, object = *q == '{', f;
+    lept_value e, * m = NULL;
+    if (depth == LEPT_PARSE_MAX_DEPTH)
+        return LEPT_PARSE_TOO_DEEP;
+    next = (const char**)lept_alloc(c->sa, n * sizeof(const char*));
+    if (object)
+        lept_set_object_a(c->a, v, 0);
+    else {
+        lept_set_array_a(c->a, v, 0);
+        target = (size_t*)lept_alloc(c->sa, n * sizeof(size_t));
+        for (i = 0; i < n; i++)
+            target[i] = at[i] != NULL ? lept_pointer_index(at[i]) : LEPT_KEY_NOT_EXIST;
+    }
+    *found = 0;
+    lept_init(&e);
+    q = LEPT_INDEXER_NEXT(x);
+    if (q != NULL && q != c->end && *q == (object ? '}' : ']'))
+        q = LEPT_INDEXER_NEXT(x);
+    else for (index = 0; ; index++) {
+        int whole = 0, any = 0;
+        if (object) {
+            c->json = q;
+            if (q == NULL || q == c->end || *q != '"')
+                ret = LEPT_PARSE_MISS_KEY;
+            else if ((ret = lept_parse_string_raw(c, &key, &klen)) == LEPT_PARSE_OK &&
+                ((q = lept_indexer_after(c, x)) == NULL || q == c->end || *q != ':'))
+                ret = LEPT_PARSE_MISS_COLON;
+            if (ret != LEPT_PARSE_OK)
+                break;
+            q = LEPT_INDEXER_NEXT(x);
+        }
+        for (i = 0; i < n; i++) {
+            next[i] = at[i];
+            if (object ? at[i] != NULL && lept_pointer_match(&next[i], key, klen) : target[i] == index)
+                next[i] = object ? next[i] : lept_pointer_skip(at[i]);
+            else
+                next[i] = NULL;
+            any |= next[i] != NULL;
+            whole |= next[i] != NULL && *next[i] == '\0';
+        }
+        if (q == NULL || q == c->end) {
+            ret = LEPT_PARSE_EXPECT_VALUE;
+            break;
+        }
+        /* the key is still on top of the stack, if it was decoded there */
+        if (object && any)
+            m = lept_set_object_value_a(c->a, v, key, klen);
+        f = 0;
+        if (whole)
+            f = (ret = lept_parse_indexed_token(c, x, &q, depth + 1, object ? m : &e)) == LEPT_PARSE_OK;
+        else if (any && (*q == '[' || *q == '{'))
+            ret = lept_select_value(c, x, &q, next, n, depth + 1, object ? m : &e, &f);
+        else
+            ret = lept_parse_skip(c, x, &q, depth + 1);
+        if (ret != LEPT_PARSE_OK)
+            break;
+        if (f) {
+            *found = 1;
+            if (!object) {
+                /* elements before a selected one stay, as null */
+                while (v->size < index)
+                    lept_pushback_array_element_a(c->a, v);
+                lept_move_a(c->a, lept_pushback_array_element_a(c->a, v), &e);
+            }
+        }
+        else if (object && any)
+            lept_remove_object_value_a(c->a, v, v->size - 1);
+        lept_free_a(c->a, &e);
+        if (q == NULL || q == c->end || (*q != ',' && *q != (object ? '}' : ']'))) {
+            ret = object ? LEPT_PARSE_MISS_COMMA_OR_CURLY_BRACKET : LEPT_PARSE_MISS_COMMA_OR_SQUARE_BRACKET;
+            break;
+        }
+        c->json = q + 1;
+        if (*q == ',')
+            q = LEPT_INDEXER_NEXT(x);
+        else {
+            q = LEPT_INDEXER_NEXT(x);
+            break;
+        }
+    }
+    lept_free_a(c->a, &e);
+    lept_release(c->sa, next, n * sizeof(const char*));
+    if (target != NULL)
+        lept_release(c->sa, target, n * sizeof(size_t));
+    *p = q;
+    return ret;
+}
+
+int lept_parse_select_a(const lept_allocator* a, lept_value* v, const char* json, size_t len, const char* const* pointers, size_t n) {
+    const lept_allocator* sa = LEPT_STACK_ALLOCATOR(a);
+    lept_context c;
+    lept_indexer x;
+    const char** at;
+    const char* p;
+    size_t i;
+    int ret, r, found, whole = 0;
+    assert(v != NULL && json != NULL && (pointers != NULL || n == 0));
+    lept_init(v);
+    for (i = 0; i < n; i++) {
+        assert(pointers[i] != NULL);
+        if (!lept_pointer_valid(pointers[i]))
+            return LEPT_PARSE_INVALID_POINTER;
+    }
+    lept_parse_begin(&c, json, len, 0, a, sa);
+    lept_indexer_begin(&x, json, len, sa);
+    at = (const char**)lept_alloc(sa, n * sizeof(const char*));
+    for (i = 0; i < n; i++) {
+        at[i] = pointers[i];
+        whole |= *at[i] == '\0';
+    }
+    p = LEPT_INDEXER_NEXT(&x);
+    if (whole)
+        ret = lept_parse_indexed_token(&c, &x, &p, 0, v);
+    else if (p != c.end && (*p == '[' || *p == '{'))
+        ret = lept_select_value(&c, &x, &p, at, n, 0, v, &found);
+    else
+        ret = lept_parse_skip(&c, &x, &p, 0);
+    if (ret == LEPT_PARSE_OK && p != c.end)
+        ret = LEPT_PARSE_ROOT_NOT_SINGULAR;
+    if (!lept_indexer_end(&x, sa))
+        ret = LEPT_PARSE_INVALID_UTF8;
+    assert(c.top == 0);
+    lept_release(sa, c.stack, c.size);
+    lept_release(sa, at, n * sizeof(const char*));
+    if (ret != LEPT_PARSE_OK) {
+        lept_free_a(a, v);
+        /* the reference parser names the error; if it finds none, keep this one, never OK */
+        if (ret != LEPT_PARSE_INVALID_UTF8) {
+            r = lept_parse_root(v, json, len, 0, a, sa);
+            lept_free_a(a, v);
+            if (r != LEPT_PARSE_OK)
+                ret = r;
+            else
+                assert(!"lept_parse_select() and lept_parse() disagree");
+        }
+    }
+    return ret;
+}
+
+int lept_parse_select(lept_value* v, const char* json, size_t len, const char* const* pointers, size_t n) {
+    return lept_parse_select_a(NULL, v, json, len, pointers, n);
+}
+
+/*
+ * A tape entry has a tag in its top byte, the lept_type and the flags below, and a
+ * payload under it. A number is followed by an entry with its double or int64_t bits.
+ * A string or key points at its bytes in t->strings, behind a uint32_t length. An array
+ * or object points at its closing entry, whose payload is the element or member count.
+ */
+#define LEPT_TAPE_INT64         0x10
+#define LEPT_TAPE_KEY           0x20
+#define LEPT_TAPE_CLOSE         0x40
+#define LEPT_TAPE_ENTRY(tag, payload) ((uint64_t)(tag) << 56 | (uint64_t)(payload))
+#define LEPT_TAPE_TAG(e)        ((unsigned)((e) >> 56))
+#define LEPT_TAPE_TYPE(e)       ((lept_type)(LEPT_TAPE_TAG(e) & 0x0F))
+#define LEPT_TAPE_PAYLOAD(e)    ((size_t)((e) & (((uint64_t)1 << 56) - 1)))
+
+/* An open container in lept_tape_parse(), kept on the context stack */
+typedef struct {
+    size_t open;    /* its entry */
+    size_t count;   /* elements or members so far */
+}lept_tape_frame;
+
+#define LEPT_TAPE_FRAME(c)      ((lept_tape_frame*)((c)->stack + (c)->top - sizeof(lept_tape_frame)))
+
+/* Grows a tape buffer by half until it holds need units. */
+static void* lept_tape_grow(const lept_tape* t, void* p, size_t* capacity, size_t need, size_t unit) {
+    size_t old = *capacity;
+    if (*capacity == 0)
+        *capacity = LEPT_PARSE_STACK_INIT_SIZE;
+    while (need > *capacity)
+        *capacity += *capacity >> 1;
+    return lept_resize(t->allocator, p, old * unit, *capacity * unit);
+}
+
+static uint64_t* lept_tape_push(lept_tape* t, size_t n) {
+    uint64_t* ret;
+    if (t->size + n > t->capacity)
+        t->entries = (uint64_t*)lept_tape_grow(t, t->entries, &t->capacity, t->size + n, sizeof(uint64_t));
+    ret = t->entries + t->size;
+    t->size += n;
+    return ret;
+}
+
+static int lept_tape_string(lept_context* c, lept_tape* t, unsigned tag) {
+    const char* s;
+    size_t len;
+    uint32_t n;
+    char* p;
+    int ret;
+    if ((ret = lept_parse_string_raw(c, &s, &len)) != LEPT_PARSE_OK)
+        return ret;
+    if (len > UINT32_MAX)
+        return LEPT_PARSE_TOO_BIG;
+    if (t->strings_size + sizeof(n) + len + 1 > t->strings_capacity)
+        t->strings = (char*)lept_tape_grow(t, t->strings, &t->strings_capacity, t->strings_size + sizeof(n) + len + 1, 1);
+    p = t->strings + t->strings_size;
+    n = (uint32_t)len;
+    memcpy(p, &n, sizeof(n));
+    memcpy(p + sizeof(n), s, len);
+    p[sizeof(n) + len] = '\0';
+    *lept_tape_push(t, 1) = LEPT_TAPE_ENTRY(tag, t->strings_size);
+    t->strings_size += sizeof(n) + len + 1;
+    return LEPT_PARSE_OK;
+}
+
+static int lept_tape_scalar(lept_context* c, lept_tape* t) {
+    lept_value v;
+    uint64_t* e;
+    int ret;
+    if (*c->json == '"')
+        return lept_tape_string(c, t, LEPT_STRING);
+    lept_init(&v);
+    if ((ret = lept_parse_scalar(c, &v)) != LEPT_PARSE_OK)
+        return ret;
+    if (v.type != LEPT_NUMBER)
+        *lept_tape_push(t, 1) = LEPT_TAPE_ENTRY(v.type, 0);
+    else {
+        e = lept_tape_push(t, 2);
+        e[0] = LEPT_TAPE_ENTRY(LEPT_NUMBER | (v.flags & LEPT_FLAG_INT64 ? LEPT_TAPE_INT64 : 0), 0);
+        memcpy(e + 1, &v.u, sizeof(uint64_t));
+    }
+    return LEPT_PARSE_OK;
+}
+
+/* Closes the innermost container, which ends at the current token, and moves to the next one. */
+static const char* lept_tape_close(lept_context* c, lept_indexer* x, lept_tape* t, int* state) {
+    const lept_tape_frame* f = (const lept_tape_frame*)lept_context_pop(c, sizeof(lept_tape_frame));
+    t->entries[f->open] |= t->size;
+    *lept_tape_push(t, 1) = LEPT_TAPE_ENTRY(LEPT_TAPE_TAG(t->entries[f->open]) | LEPT_TAPE_CLOSE, f->count);
+    *state = c->top == 0 ? LEPT_WALK_DONE : LEPT_WALK_NEXT;
+    return LEPT_INDEXER_NEXT(x);
+}
+
+/* Stage two of lept_tape_parse(), the walk of lept_parse_indexed_value() writing entries instead of values */
+static int lept_tape_value(lept_context* c, lept_indexer* x, lept_tape* t) {
+    const char* p = LEPT_INDEXER_NEXT(x);
+    int state = LEPT_WALK_VALUE, ret = LEPT_PARSE_OK;
+    while (ret == LEPT_PARSE_OK && state != LEPT_WALK_DONE) {
+        lept_tape_frame* f;
+        if (p == NULL || p == c->end) {
+            ret = LEPT_PARSE_EXPECT_VALUE;
+            break;
+        }
+        switch (state) {
+            case LEPT_WALK_VALUE:
+                if (*p == '[' || *p == '{') {
+                    if (c->top == LEPT_PARSE_MAX_DEPTH * sizeof(lept_tape_frame)) {
+                        ret = LEPT_PARSE_TOO_DEEP;
+                        break;
+                    }
+                    f = (lept_tape_frame*)lept_context_push(c, sizeof(lept_tape_frame));
+                    f->open = t->size;
+                    f->count = 0;
+                    *lept_tape_push(t, 1) = LEPT_TAPE_ENTRY(*p == '[' ? LEPT_ARRAY : LEPT_OBJECT, 0);
+                    state = *p == '[' ? LEPT_WALK_ELEMENT_OR_END : LEPT_WALK_KEY_OR_END;
+                    p = LEPT_INDEXER_NEXT(x);
+                }
+                else {
+                    c->json = p;
+                    if ((ret = lept_tape_scalar(c, t)) != LEPT_PARSE_OK)
+                        break;
+                    p = lept_indexer_after(c, x);
+                    state = c->top == 0 ? LEPT_WALK_DONE : LEPT_WALK_NEXT;
+                }
+                break;
+            case LEPT_WALK_ELEMENT_OR_END:
+                if (*p == ']')
+                    p = lept_tape_close(c, x, t, &state);
+                else {
+                    LEPT_TAPE_FRAME(c)->count++;
+                    state = LEPT_WALK_VALUE;
+                }
+                break;
+            case LEPT_WALK_KEY_OR_END:
+                if (*p == '}') {
+                    p = lept_tape_close(c, x, t, &state);
+                    break;
+                }
+                /* fall through */
+            case LEPT_WALK_KEY:
+                c->json = p;
+                if (*p != '"')
+                    ret = LEPT_PARSE_MISS_KEY;
+                else if ((ret = lept_tape_string(c, t, LEPT_STRING | LEPT_TAPE_KEY)) == LEPT_PARSE_OK) {
+                    if ((p = lept_indexer_after(c, x)) == NULL || p == c->end || *p != ':')
+                        ret = LEPT_PARSE_MISS_COLON;
+                    else {
+                        LEPT_TAPE_FRAME(c)->count++;
+                        p = LEPT_INDEXER_NEXT(x);
+                        state = LEPT_WALK_VALUE;
+                    }
+                }
+                break;
+            case LEPT_WALK_NEXT:
+                f = LEPT_TAPE_FRAME(c);
+                if (*p == ',') {
+                    p = LEPT_INDEXER_NEXT(x);
+                    if (LEPT_TAPE_TYPE(t->entries[f->open]) == LEPT_ARRAY) {
+                        f->count++;
+                        state = LEPT_WALK_VALUE;
+                    }
+                    else
+                        state = LEPT_WALK_KEY;
+                }
+                else if (*p == (LEPT_TAPE_TYPE(t->entries[f->open]) == LEPT_ARRAY ? ']' : '}'))
+                    p = lept_tape_close(c, x, t, &state);
+                else
+                    ret = LEPT_PARSE_INVALID_VALUE;
+                break;
+        }
+    }
+    if (ret == LEPT_PARSE_OK && p != c->end)
+        ret = LEPT_PARSE_ROOT_NOT_SINGULAR;
+    return ret;
+}
+
+int lept_tape_parse(lept_tape* t, const char* json, size_t len) {
+    const lept_allocator* sa;
+    lept_context c;
+    lept_indexer x;
+    lept_value v;
+    int ret;
+    assert(t != NULL && json != NULL);
+    sa = LEPT_STACK_ALLOCATOR(t->allocator);
+    lept_parse_begin(&c, json, len, 0, NULL, sa);
+    lept_indexer_begin(&x, json, len, sa);
+    t->size = t->strings_size = 0;
+    ret = lept_tape_value(&c, &x, t);
+    if (!lept_indexer_end(&x, sa))
+        ret = LEPT_PARSE_INVALID_UTF8;
+    lept_release(sa, c.stack, c.size);
+    if (ret != LEPT_PARSE_OK) {
+        t->size = t->strings_size = 0;
+        if (ret != LEPT_PARSE_INVALID_UTF8) {
+            ret = lept_parse_root(&v, json, len, 0, sa, sa);
+            lept_free_a(sa, &v);
+        }
+    }
+    return ret;
+}
+
+struct lept_stream {
+    lept_context c;
+    lept_walk w;
+    char* carry;            /* a token cut by the end of a chunk */
+    size_t carry_len, carry_size;
+    int carry_string;       /* the token is a string or key, otherwise a number or literal */
+    int carry_escape;       /* the carried string ends in a backslash */
+    int ret;                /* the first error, which every later call returns */
+};
+
+lept_stream* lept_stream_create(void) {
+    return lept_stream_create_a(NULL);
+}
+
+lept_stream* lept_stream_create_a(const lept_allocator* a) {
+    const lept_allocator* sa = LEPT_STACK_ALLOCATOR(a);
+    lept_stream* s = (lept_stream*)lept_alloc(sa, sizeof(lept_stream));
+    s->c.stack = NULL;
+    s->c.size = s->c.top = 0;
+    s->c.insitu = 0;
+    s->c.a = a;
+    s->c.sa = sa;
+    s->c.doc = LEPT_DOCUMENT_OF(a);
+    s->carry = NULL;
+    s->carry_len = s->carry_size = 0;
+    s->ret = LEPT_PARSE_OK;
+    lept_walk_init(&s->c, &s->w);
+    return s;
+}
+
+static void lept_stream_append(lept_stream* s, const char* p, size_t len) {
+    if (s->carry_len + len > s->carry_size) {
+        size_t size = s->carry_size + (s->carry_size >> 1);
+        if (size < s->carry_len + len)
+            size = s->carry_len + len;
+        s->carry = (char*)lept_resize(s->c.sa, s->carry, s->carry_size, size);
+        s->carry_size = size;
+    }
+    memcpy(s->carry + s->carry_len, p, len);
+    s->carry_len += len;
+}
+
+/* Walks [p, end); a token cut by end is carried over unless final. */
+static int lept_stream_run(lept_stream* s, const char* p, const char* end, int final) {
+    lept_context* c = &s->c;
+    c->json = p;
+    c->end = end;
+    if (s->w.state != LEPT_WALK_DONE) {
+        int ret = lept_walk_run(c, &s->w, final);
+        if (ret == LEPT_PARSE_PARTIAL) {
+            s->carry_len = 0;
+            s->carry_escape = 0;
+            if ((s->carry_string = (*c->json == '"')))
+                lept_find_string_end(c->json + 1, end, &s->carry_escape);
+            lept_stream_append(s, c->json, end - c->json);
+            return LEPT_PARSE_OK;
+        }
+        if (ret != LEPT_PARSE_OK && ret != LEPT_PARSE_NEED_MORE)
+            return ret;
+    }
+    lept_parse_whitespace(c);
+    return c->json == end ? LEPT_PARSE_OK : LEPT_PARSE_ROOT_NOT_SINGULAR;
+}
+
+/* Completes a carried token once its end is known, then walks it. */
+static int lept_stream_flush(lept_stream* s) {
+    size_t len = s->carry_len;
+    s->carry_len = 0;
+    return lept_stream_run(s, s->carry, s->carry + len, 1);
+}
+
+int lept_stream_feed(lept_stream* s, const char* chunk, size_t len) {
+    const char* end = chunk + len;
+    assert(s != NULL && (chunk != NULL || len == 0));
+    if (s->ret != LEPT_PARSE_OK)
+        return s->ret;
+    if (s->carry_len > 0) {
+        const char* p = s->carry_string ?
+            lept_find_string_end(chunk, end, &s->carry_escape) : lept_find_bare_end(chunk, end);
+        if (p == NULL) {
+            lept_stream_append(s, chunk, len);
+            return LEPT_PARSE_OK;
+        }
+        lept_stream_append(s, chunk, p - chunk);
+        if ((s->ret = lept_stream_flush(s)) != LEPT_PARSE_OK)
+            return s->ret;
+        chunk = p;
+    }
+    return s->ret = lept_stream_run(s, chunk, end, 0);
+}
+
+int lept_stream_finish(lept_stream* s, lept_value* v) {
+    lept_context* c = &s->c;
+    int ret;
+    assert(s != NULL && v != NULL);
+    lept_init(v);
+    if ((ret = s->ret) == LEPT_PARSE_OK && s->carry_len > 0)
+        ret = lept_stream_flush(s);
+    if (ret == LEPT_PARSE_OK && s->w.state != LEPT_WALK_DONE)
+        ret = lept_walk_eof(c, &s->w);
+    if (s->w.state == LEPT_WALK_DONE) {
+        /* a complete root followed by garbage still has to be freed */
+        lept_walk_end(c, &s->w, v, LEPT_PARSE_OK);
+        if (ret != LEPT_PARSE_OK)
+            lept_free_a(c->a, v);
+    }
+    else
+        lept_walk_end(c, &s->w, v, ret);
+    assert(c->top == 0);
+    lept_release(c->sa, c->stack, c->size);
+    lept_release(c->sa, s->carry, s->carry_size);
+    lept_release(c->sa, s, sizeof(lept_stream));
+    return ret;
+}
+
+/* Escapes len bytes of s into p, which has room for len * 6 bytes ("\u00xx..."), and returns the end. */
+static char* lept_escape_string(char* p, const char* s, size_t len) {
+    static const char hex_digits[] = { '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'A', 'B', 'C', 'D', 'E', 'F' };
+    size_t i;
+    for (i = 0; i < len; i++) {
+        unsigned char ch = (unsigned char)s[i];
+        switch (ch) {
+            case '\"': *p++ = '\\'; *p++ = '\"'; break;
+            case '\\': *p++ = '\\'; *p++ = '\\'; break;
+            case '\b': *p++ = '\\'; *p++ = 'b';  break;
+            case '\f': *p++ = '\\'; *p++ = 'f';  break;
+            case '\n': *p++ = '\\'; *p++ = 'n';  break;
+            case '\r': *p++ = '\\'; *p++ = 'r';  break;
+            case '\t': *p++ = '\\'; *p++ = 't';  break;
+            default:
+                if (ch < 0x20) {
+                    *p++ = '\\'; *p++ = 'u'; *p++ = '0'; *p++ = '0';
+                    *p++ = hex_digits[ch >> 4];
+                    *p++ = hex_digits[ch & 15];
+                }
+                else
+                    *p++ = s[i];
+        }
+    }
+    return p;
+}
+
+/*
+ * Copies JSON text without the whitespace between tokens and returns the end of the copy;
+ * *state carries over between slices: 0 between tokens, 1 in a string, 2 after a backslash in one.
+ */
+static char* lept_compact(char* p, const char* s, size_t len, int* state) {
+    const char* end = s + len;
+    while (s != end) {
+        char ch;
+        if (*state == 1) {
+            /* the input was checked, so the scan only stops at a quote or a backslash */
+            const char* q = lept_scan_string(s, end);
+            memcpy(p, s, q - s);
+            p += q - s;
+            if ((s = q) == end)
+                break;
+        }
+        ch = *s++;
+        if (*state == 0) {
+            if (ISWHITESPACE(ch))
+                continue;
+            if (ch == '"')
+                *state = 1;
+        }
+        else if (*state == 2)
+            *state = 1;
+        else
+            *state = ch == '"' ? 0 : 2;
+        *p++ = ch;
+    }
+    return p;
+}
+
+static void lept_stringify_string(lept_context* c, const char* s, size_t len) {
+    size_t size;
+    char* head, *p;
+    assert(s != NULL);
+    p = head = lept_context_push(c, size = len * 6 + 2);
+    *p++ = '"';
+    p = lept_escape_string(p, s, len);
+    *p++ = '"';
+    c->top -= size - (p - head);
+}
+
+/* Writes the decimal form of i, two digits per step, and returns its length (at most 20). */
+static size_t lept_itoa(int64_t i, char* buf) {
+    static const char pairs[] =
+        "0001020304050607080910111213141516171819"
+        "2021222324252627282930313233343536373839"
+        "4041424344454647484950515253545556575859"
+        "6061626364656667686970717273747576777879"
+        "8081828384858687888990919293949596979899";
+    char tmp[20], * p = tmp + sizeof(tmp);
+    uint64_t u = i < 0 ? 0 - (uint64_t)i : (uint64_t)i;
+    size_t len;
+    while (u >= 100) {
+        unsigned d = (unsigned)(u % 100) * 2;
+        u /= 100;
+        *--p = pairs[d + 1];
+        *--p = pairs[d];
+    }
+    if (u >= 10) {
+        *--p = pairs[u * 2 + 1];
+        *--p = pairs[u * 2];
+    }
+    else
+        *--p = (char)('0' + u);
+    if (i < 0)
+        *--p = '-';
+    len = tmp + sizeof(tmp) - p;
+    memcpy(buf, p, len);
+    return len;
+}
+
+/* floor(x / 2^20) without shifting a negative number */
+#define LEPT_FLOOR_SHIFT20(x)       ((x) >= 0 ? (x) >> 20 : -((-(x) + 0xFFFFFL) >> 20))
+/* floor(log10(2^q)) and floor(log10(3/4 * 2^q)), valid for |q| < 2000 */
+#define LEPT_FLOOR_LOG10_POW2(q)    LEPT_FLOOR_SHIFT20((q) * 315653L)
+#define LEPT_FLOOR_LOG10_POW2_3_4(q) LEPT_FLOOR_SHIFT20((q) * 315653L - 131237L)
+
+/*
+ * (g * cp) / 2^128 rounded to odd, i.e. with a one in the last bit whenever it is inexact.
+ * g overestimates by less than 2^-64 in the units of the fraction, which is therefore
+ * zero when it is at most one; an inexact product always has a larger fraction.
+ */
+static uint64_t lept_round_to_odd(uint64_t g_hi, uint64_t g_lo, uint64_t cp) {
+    uint64_t x1, y1, y0 = lept_mul128(g_hi, cp, &y1), z;
+    lept_mul128(g_lo, cp, &x1);
+    z = y0 + x1;
+    return (y1 + (z < y0)) | (z > 1);
+}
+
+/*
+ * Schubfach (R. Giulietti, "The Schubfach way to render doubles"): the shortest f * 10^e
+ * that rounds back to c * 2^q, the closest one when there are several.
+ */
+static int lept_schubfach(uint64_t c, int q, uint64_t* f) {
+    const uint64_t* p10;
+    uint64_t cb = c << 2, cbr = cb + 2, cbl, g_hi, g_lo, vb, vbl, vbr, s, t;
+    int out = (int)(c & 1), k, h, uin, win;
+    if (c != (UINT64_C(1) << 52) || q == -1074) {
+        cbl = cb - 2;
+        k = (int)LEPT_FLOOR_LOG10_POW2(q);
+    }
+    else {
+        /* the gap below a power of two is half as wide */
+        cbl = cb - 1;
+        k = (int)LEPT_FLOOR_LOG10_POW2_3_4(q);
+    }
+    h = q + (int)LEPT_FLOOR_LOG2_POW10(-k) + 1;
+    /* an upper bound of 10^-k, scaled by the same power of two as the table */
+    p10 = lept_pow10_128[-k - LEPT_POW10_MIN];
+    g_lo = p10[1] + 1;
+    g_hi = p10[0] + (g_lo == 0);
+    vb = lept_round_to_odd(g_hi, g_lo, cb << h);
+    vbl = lept_round_to_odd(g_hi, g_lo, cbl << h);
+    vbr = lept_round_to_odd(g_hi, g_lo, cbr << h);
+    /* vb is 4 * c * 2^q * 10^-k, so one of s and s + 1 is within the rounding interval */
+    s = vb >> 2;
+    /* the interval is narrower than 10 units, so it holds at most one multiple of 10 */
+    t = s / 10 * 10;
+    uin = vbl + out <= t << 2;
+    win = ((t + 10) << 2) + out <= vbr;
+    if (uin != win) {
+        *f = uin ? t : t + 10;
+        return k;
+    }
+    t = s + 1;
+    uin = vbl + out <= s << 2;
+    win = (t << 2) + out <= vbr;
+    if (uin != win)
+        *f = uin ? s : t;
+    else /* both fit, take the closer one and the even one on ties */
+        *f = vb < (s + t) << 1 || (vb == (s + t) << 1 && (s & 1) == 0) ? s : t;
+    return k;
+}
+
+/*
+ * Writes the shortest digits that parse back to d, laid out like "%.17g":
+ * positional for decimal exponents in [-4, 17), scientific otherwise.
+ */
+static size_t lept_dtoa(double d, char* buf) {
+    char digits[20], * p = buf;
+    uint64_t bits, c, f;
+    int be, e, n, x, i;
+    memcpy(&bits, &d, sizeof(d));
+    be = (int)(bits >> 52) & 0x7FF;
+    c = bits & ((UINT64_C(1) << 52) - 1);
+    if (be == 0x7FF)
+        return sprintf(buf, "%.17g", d);
+    if (bits >> 63)
+        *p++ = '-';
+    if (be == 0 && c == 0) {
+        *p++ = '0';
+        return p - buf;
+    }
+    if (be == 0)
+        e = lept_schubfach(c, -1074, &f);
+    else
+        e = lept_schubfach(c | (UINT64_C(1) << 52), be - 1075, &f);
+    while (f % 10 == 0) {
+        f /= 10;
+        e++;
+    }
+    n = (int)lept_itoa((int64_t)f, digits);
+    x = e + n - 1; /* exponent of the leading digit */
+    if (x >= -4 && x < 17) {
+        if (e >= 0) {
+            memcpy(p, digits, n);
+            memset(p + n, '0', e);
+            p += n + e;
+        }
+        else if (x >= 0) {
+            memcpy(p, digits, x + 1);
+            p[x + 1] = '.';
+            memcpy(p + x + 2, digits + x + 1, n - x - 1);
+            p += n + 1;
+        }
+        else {
+            *p++ = '0';
+            *p++ = '.';
+            for (i = -1; i > x; i--)
+                *p++ = '0';
+            memcpy(p, digits, n);
+            p += n;
+        }
+    }
+    else {
+        *p++ = digits[0];
+        if (n > 1) {
+            *p++ = '.';
+            memcpy(p, digits + 1, n - 1);
+            p += n - 1;
+        }
+        *p++ = 'e';
+        *p++ = x < 0 ? '-' : '+';
+        if (x < 0)
+            x = -x;
+        if (x >= 100)
+            *p++ = (char)('0' + x / 100);
+        *p++ = (char)('0' + x / 10 % 10);
+        *p++ = (char)('0' + x % 10);
+    }
+    return p - buf;
+}
+
+/* Writes a LEPT_NUMBER in at most 32 bytes and returns its length. */
+static size_t lept_format_number(char* buf, const lept_value* v) {
+    if (v->flags & LEPT_FLAG_INT64)
+        return lept_itoa(v->u.i, buf);
+    return lept_dtoa(v->u.n, buf);
+}
+
+static void lept_stringify_value(lept_context* c, const lept_value* v) {
+    size_t i;
+    int state = 0;
+    char* p;
+    if (v->flags & LEPT_FLAG_LAZY) {
+        p = (char*)lept_context_push(c, v->size);
+        c->top -= v->size - (lept_compact(p, LEPT_LAZY_JSON(v), v->size, &state) - p);
+        return;
+    }
+    switch (v->type) {
+        case LEPT_NULL:   PUTS(c, "null",  4); break;
+        case LEPT_FALSE:  PUTS(c, "false", 5); break;
+        case LEPT_TRUE:   PUTS(c, "true",  4); break;
+        case LEPT_NUMBER:
+            c->top -= 32 - lept_format_number(lept_context_push(c, 32), v);
+            break;
+        case LEPT_STRING: lept_stringify_string(c, LEPT_STRING_DATA(v), LEPT_STRING_LEN(v)); break;
+        case LEPT_ARRAY:
+            PUTC(c, '[');
+            for (i = 0; i < v->size; i++) {
+                if (i > 0)
+                    PUTC(c, ',');
+                lept_stringify_value(c, &v->u.e[i]);
+            }
+            PUTC(c, ']');
+            break;
+        case LEPT_OBJECT:
+            PUTC(c, '{');
+            for (i = 0; i < v->size; i++) {
+                if (i > 0)
+                    PUTC(c, ',');
+                lept_stringify_string(c, v->u.m[i].k, v->u.m[i].klen);
+                PUTC(c, ':');
+                lept_stringify_value(c, &v->u.m[i].v);
+            }
+            PUTC(c, '}');
+            break;
+        default: assert(0 && "invalid type");
+    }
+}
+
+char* lept_stringify_a(const lept_allocator* a, const lept_value* v, size_t* length) {
+    lept_context c;
+    assert(v != NULL);
+    c.sa = a;
+    c.stack = (char*)lept_alloc(a, c.size = LEPT_PARSE_STRINGIFY_INIT_SIZE);
+    c.top = 0;
+    lept_stringify_value(&c, v);
+    if (length)
+        *length = c.top;
+    PUTC(&c, '\0');
+    /* trim to the exact size, which is what the caller passes to release */
+    if (a != NULL && c.top != c.size)
+        c.stack = (char*)lept_resize(a, c.stack, c.size, c.top);
+    return c.stack;
+}
+
+char* lept_stringify(const lept_value* v, size_t* length) {
+    return lept_stringify_a(NULL, v, length);
+}
+
+/* lept_writer.levels[] */
+#define LEPT_LEVEL_OBJECT   0x01
+#define LEPT_LEVEL_MORE     0x02    /* a comma goes before the next element or member */
+#define LEPT_LEVEL_KEY      0x04    /* a key was written, its value is next */
+
+struct lept_writer {
+    int (*write)(void* ctx, const char* s, size_t len);
+    void* ctx;
+    const lept_allocator* a;
+    int ok;                 /* every flush so far succeeded */
+    int more;               /* a root value was written, the next goes on a new line */
+    size_t len, depth;
+    unsigned char levels[LEPT_PARSE_MAX_DEPTH];
+    char buf[LEPT_WRITER_BUFFER_SIZE];
+};
+
+lept_writer* lept_writer_create(int (*write)(void* ctx, const char* s, size_t len), void* ctx) {
+    return lept_writer_create_a(NULL, write, ctx);
+}
+
+lept_writer* lept_writer_create_a(const lept_allocator* a, int (*write)(void* ctx, const char* s, size_t len), void* ctx) {
+    lept_writer* w;
+    assert(write != NULL);
+    w = (lept_writer*)lept_alloc(a, sizeof(lept_writer));
+    w->write = write;
+    w->ctx = ctx;
+    w->a = a;
+    w->ok = 1;
+    w->more = 0;
+    w->len = w->depth = 0;
+    return w;
+}
+
+int lept_write_file(void* ctx, const char* s, size_t len) {
+    return fwrite(s, 1, len, (FILE*)ctx) == len;
+}
+
+static void lept_writer_flush(lept_writer* w) {
+    if (w->len > 0 && w->ok)
+        w->ok = w->write(w->ctx, w->buf, w->len);
+    w->len = 0;
+}
+
+/* Returns room for n bytes at the end of the buffer, flushing it first if needed. */
+static char* lept_writer_room(lept_writer* w, size_t n) {
+    assert(n <= LEPT_WRITER_BUFFER_SIZE);
+    if (w->len + n > LEPT_WRITER_BUFFER_SIZE)
+        lept_writer_flush(w);
+    return w->buf + w->len;
+}
+
+static void lept_writer_putc(lept_writer* w, char ch) {
+    *lept_writer_room(w, 1) = ch;
+    w->len++;
+}
+
+static void lept_writer_puts(lept_writer* w, const char* s, size_t len) {
+    memcpy(lept_writer_room(w, len), s, len);
+    w->len += len;
+}
+
+/* Escapes s in slices that fit the buffer, so a string of any length needs no more memory. */
+static void lept_writer_string_raw(lept_writer* w, const char* s, size_t len) {
+    assert(s != NULL || len == 0);
+    lept_writer_putc(w, '"');
+    while (len > 0) {
+        size_t n = (LEPT_WRITER_BUFFER_SIZE - w->len) / 6;
+        if (n == 0) {
+            lept_writer_flush(w);
+            n = LEPT_WRITER_BUFFER_SIZE / 6;
+        }
+        if (n > len)
+            n = len;
+        w->len = lept_escape_string(w->buf + w->len, s, n) - w->buf;
+        s += n;
+        len -= n;
+    }
+    lept_writer_putc(w, '"');
+}
+
+/* Writes the input bytes of a lazy container, compacted in slices like lept_writer_string_raw(). */
+static void lept_writer_compact(lept_writer* w, const char* s, size_t len) {
+    int state = 0;
+    while (len > 0) {
+        size_t n = LEPT_WRITER_BUFFER_SIZE - w->len;
+        if (n == 0) {
+            lept_writer_flush(w);
+            n = LEPT_WRITER_BUFFER_SIZE;
+        }
+        if (n > len)
+            n = len;
+        w->len = lept_compact(w->buf + w->len, s, n, &state) - w->buf;
+        s += n;
+        len -= n;
+    }
+}
+
+/* Writes the separator that goes before a value at the current level. */
+static void lept_writer_separate(lept_writer* w) {
+    unsigned char* level;
+    if (w->depth == 0) {
+        if (w->more)
+            lept_writer_putc(w, '\n');
+        w->more = 1;
+        return;
+    }
+    level = &w->levels[w->depth - 1];
+    if (*level & LEPT_LEVEL_OBJECT) {
+        assert((*level & LEPT_LEVEL_KEY) && "a value in an object needs a key");
+        *level &= ~LEPT_LEVEL_KEY;
+    }
+    else {
+        if (*level & LEPT_LEVEL_MORE)
+            lept_writer_putc(w, ',');
+        *level |= LEPT_LEVEL_MORE;
+    }
+}
+
+static void lept_writer_start(lept_writer* w, unsigned char level, char ch) {
+    assert(w != NULL && w->depth < LEPT_PARSE_MAX_DEPTH);
+    lept_writer_separate(w);
+    w->levels[w->depth++] = level;
+    lept_writer_putc(w, ch);
+}
+
+static void lept_writer_end(lept_writer* w, unsigned char level, char ch) {
+    assert(w != NULL && w->depth > 0);
+    assert((w->levels[w->depth - 1] & (LEPT_LEVEL_OBJECT | LEPT_LEVEL_KEY)) == level);
+    w->depth--;
+    lept_writer_putc(w, ch);
+}
+
+void lept_writer_start_array(lept_writer* w) {
+    lept_writer_start(w, 0, '[');
+}
+
+void lept_writer_end_array(lept_writer* w) {
+    lept_writer_end(w, 0, ']');
+}
+
+void lept_writer_start_object(lept_writer* w) {
+    lept_writer_start(w, LEPT_LEVEL_OBJECT, '{');
+}
+
+void lept_writer_end_object(lept_writer* w) {
+    lept_writer_end(w, LEPT_LEVEL_OBJECT, '}');
+}
+
+void lept_writer_key(lept_writer* w, const char* s, size_t len) {
+    unsigned char* level;
+    assert(w != NULL && w->depth > 0);
+    level = &w->levels[w->depth - 1];
+    assert((*level & (LEPT_LEVEL_OBJECT | LEPT_LEVEL_KEY)) == LEPT_LEVEL_OBJECT);
+    if (*level & LEPT_LEVEL_MORE)
+        lept_writer_putc(w, ',');
+    *level |= LEPT_LEVEL_MORE | LEPT_LEVEL_KEY;
+    lept_writer_string_raw(w, s, len);
+    lept_writer_putc(w, ':');
+}
+
+void lept_writer_null(lept_writer* w) {
+    assert(w != NULL);
+    lept_writer_separate(w);
+    lept_writer_puts(w, "null", 4);
+}
+
+void lept_writer_boolean(lept_writer* w, int b) {
+    assert(w != NULL);
+    lept_writer_separate(w);
+    if (b)
+        lept_writer_puts(w, "true", 4);
+    else
+        lept_writer_puts(w, "false", 5);
+}
+
+void lept_writer_number(lept_writer* w, double n) {
+    lept_value v;
+    assert(w != NULL);
+    v.u.n = n;
+    v.flags = 0;
+    lept_writer_separate(w);
+    w->len += lept_format_number(lept_writer_room(w, 32), &v);
+}
+
+void lept_writer_int64(lept_writer* w, int64_t i) {
+    assert(w != NULL);
+    lept_writer_separate(w);
+    w->len += lept_itoa(i, lept_writer_room(w, 20));
+}
+
+void lept_writer_string(lept_writer* w, const char* s, size_t len) {
+    assert(w != NULL);
+    lept_writer_separate(w);
+    lept_writer_string_raw(w, s, len);
+}
+
+void lept_writer_value(lept_writer* w, const lept_value* v) {
+    size_t i;
+    assert(w != NULL && v != NULL);
+    if (v->flags & LEPT_FLAG_LAZY) {
+        lept_writer_separate(w);
+        lept_writer_compact(w, LEPT_LAZY_JSON(v), v->size);
+        return;
+    }
+    switch (v->type) {
+        case LEPT_NULL:   lept_writer_null(w); break;
+        case LEPT_FALSE:  lept_writer_boolean(w, 0); break;
+        case LEPT_TRUE:   lept_writer_boolean(w, 1); break;
+        case LEPT_NUMBER:
+            lept_writer_separate(w);
+            w->len += lept_format_number(lept_writer_room(w, 32), v);
+            break;
+        case LEPT_STRING: lept_writer_string(w, LEPT_STRING_DATA(v), LEPT_STRING_LEN(v)); break;
+        case LEPT_ARRAY:
+            lept_writer_start_array(w);
+            for (i = 0; i < v->size; i++)
+                lept_writer_value(w, &v->u.e[i]);
+            lept_writer_end_array(w);
+            break;
+        case LEPT_OBJECT:
+            lept_writer_start_object(w);
+            for (i = 0; i < v->size; i++) {
+                lept_writer_key(w, v->u.m[i].k, v->u.m[i].klen);
+                lept_writer_value(w, &v->u.m[i].v);
+            }
+            lept_writer_end_object(w);
+            break;
+        default: assert(0 && "invalid type");
+    }
+}
+
+int lept_writer_finish(lept_writer* w) {
+    int ok;
+    assert(w != NULL && w->depth == 0);
+    lept_writer_flush(w);
+    ok = w->ok;
+    lept_release(w->a, w, sizeof(lept_writer));
+    return ok;
+}
+
+void lept_copy_a(const lept_allocator* a, lept_value* dst, const lept_value* src) {
+    assert(src != NULL && dst != NULL && src != dst);
+    size_t i = 0;
+    /* a lazy container is copied as its input range, unless an allocator is involved */
+    if (a != NULL || (src->flags & LEPT_FLAG_LAZY_A))
+        LEPT_LOAD(src);
+    switch (src->flags & LEPT_FLAG_LAZY ? LEPT_NULL : src->type) {
+        case LEPT_STRING:
+            lept_set_string_a(a, dst, LEPT_STRING_DATA(src), LEPT_STRING_LEN(src));
+            break;
+        case LEPT_ARRAY:
+            /* \todo */
+            /* Եݹĵlept_copyɿ */
+            lept_set_array_a(a, dst, src->size);
+            for (; i < src->size; ++i) {
+                lept_copy_a(a, lept_pushback_array_element_a(a, dst), &src->u.e[i]);
+            }
+            break;
+        case LEPT_OBJECT:
+            /* \todo */
+            /*ͬ Եݹʹlept_copyɿ*/ 
+            lept_set_object_a(a, dst, LEPT_CAPACITY(src->u.m));
+            for (; i < src->size; ++i) {
+                /* ʹsize_tʱ עַҲܽ */ 
+                lept_copy_a(a, lept_set_object_value_a(a, dst, src->u.m[i].k, src->u.m[i].klen), &src->u.m[i].v);
+            }
+            break;
+        default:
+            lept_free_a(a, dst);
+            memcpy(dst, src, sizeof(lept_value));
+            break;
+    }
+}
+
+void lept_copy(lept_value* dst, const lept_value* src) {
+    lept_copy_a(NULL, dst, src);
+}
+
+void lept_move_a(const lept_allocator* a, lept_value* dst, lept_value* src) {
+    assert(dst != NULL && src != NULL && src != dst);
+    lept_free_a(a, dst);
+    memcpy(dst, src, sizeof(lept_value));
+    lept_init(src);
+}
+
+void lept_move(lept_value* dst, lept_value* src) {
+    lept_move_a(NULL, dst, src);
+}
+
+void lept_swap(lept_value* lhs, lept_value* rhs) {
+    assert(lhs != NULL && rhs != NULL);
+    if (lhs != rhs) {
+        lept_value temp;
+        memcpy(&temp, lhs, sizeof(lept_value));
+        memcpy(lhs,   rhs, sizeof(lept_value));
+        memcpy(rhs, &temp, sizeof(lept_value));
+    }
+}
+
+/*
+ * Objects with capacity >= LEPT_OBJECT_INDEX_MIN keep a hash index right after their
+ * members, in the same block: open addressing over member index + 1, 0 for empty,
+ * with at least twice as many buckets as the capacity. It is only filled by the first
+ * lookup that needs it, and LEPT_FLAG_INDEXED says whether it is current.
+ */
+static size_t lept_index_buckets(size_t capacity) {
+    size_t n = 1;
+    if (capacity < LEPT_OBJECT_INDEX_MIN || capacity > 0x7FFFFFFF)
+        return 0;
+    while (n < capacity * 2)
+        n <<= 1;
+    return n;
+}
+
+/* Sizes of the blocks behind u.e and u.m */
+static size_t lept_elements_size(size_t capacity) {
+    return sizeof(lept_block) + capacity * sizeof(lept_value);
+}
+
+static size_t lept_members_size(size_t capacity) {
+    return sizeof(lept_block) + capacity * sizeof(lept_member) + lept_index_buckets(capacity) * sizeof(uint32_t);
+}
+
+#define LEPT_INDEX(v) ((uint32_t*)((v)->u.m + LEPT_BLOCK((v)->u.m)->capacity))
+
+/* Returns the bucket that holds the first member with the key, or the empty one where it would go. */
+static size_t lept_index_probe(const lept_value* v, size_t buckets, const char* key, size_t klen, uint32_t hash) {
+    const uint32_t* index = LEPT_INDEX(v);
+    size_t i = hash & (buckets - 1);
+    while (index[i] != 0) {
+        const lept_member* m = &v->u.m[index[i] - 1];
+        if (m->klen == klen && (m->k == key || memcmp(m->k, key, klen) == 0))
+            break;
+        i = (i + 1) & (buckets - 1);
+    }
+    return i;
+}
+
+/* Adds member i unless an earlier member has the same key. */
+static void lept_index_insert(lept_value* v, size_t buckets, size_t i) {
+    const lept_member* m = &v->u.m[i];
+    uint32_t hash = v->flags & LEPT_FLAG_INTERNED ? LEPT_KEY_HEADER(m->k)->hash : lept_hash(m->k, m->klen);
+    size_t b = lept_index_probe(v, buckets, m->k, m->klen, hash);
+    if (LEPT_INDEX(v)[b] == 0)
+        LEPT_INDEX(v)[b] = (uint32_t)(i + 1);
+}
+
+static void lept_index_build(lept_value* v, size_t buckets) {
+    size_t i;
+    memset(LEPT_INDEX(v), 0, buckets * sizeof(uint32_t));
+    for (i = 0; i < v->size; i++)
+        lept_index_insert(v, buckets, i);
+    v->flags |= LEPT_FLAG_INDEXED;
+}
+
+void lept_free_a(const lept_allocator* a, lept_value* v) {
+    size_t i;
+    assert(v != NULL);
+    /* a lazy container owns nothing yet, apart from its lept_lazy */
+    if ((v->flags & (LEPT_FLAG_LAZY_A | LEPT_FLAG_ARENA)) == LEPT_FLAG_LAZY_A)
+        lept_release(a, v->u.s, sizeof(lept_lazy));
+    switch (v->flags & LEPT_FLAG_LAZY ? LEPT_NULL : v->type) {
+        case LEPT_STRING:
+            if (!(v->flags & (LEPT_FLAG_BORROWED | LEPT_FLAG_ARENA | LEPT_FLAG_INLINE)))
+                lept_release(a, v->u.s, v->size + 1);
+            break;
+        case LEPT_ARRAY:
+            for (i = 0; i < v->size; i++)
+                lept_free_a(a, &v->u.e[i]);
+            if (!(v->flags & LEPT_FLAG_ARENA) && v->u.e != NULL)
+                lept_block_release(a, v->u.e, lept_elements_size(LEPT_BLOCK(v->u.e)->capacity));
+            break;
+        case LEPT_OBJECT:
+            for (i = 0; i < v->size; i++) {
+                if (!(v->flags & (LEPT_FLAG_BORROWED | LEPT_FLAG_ARENA)))
+                    lept_release(a, v->u.m[i].k, v->u.m[i].klen + 1);
+                lept_free_a(a, &v->u.m[i].v);
+            }
+            if (!(v->flags & LEPT_FLAG_ARENA) && v->u.m != NULL)
+                lept_block_release(a, v->u.m, lept_members_size(LEPT_BLOCK(v->u.m)->capacity));
+            break;
+        default: break;
+    }
+    v->type = LEPT_NULL;
+    v->flags = 0;
+}
+
+void lept_free(lept_value* v) {
+    lept_free_a(NULL, v);
+}
+
+lept_type lept_get_type(const lept_value* v) {
+    assert(v != NULL);
+    return v->type;
+}
+
+int lept_is_equal(const lept_value* lhs, const lept_value* rhs) {
+    size_t i;
+    assert(lhs != NULL && rhs != NULL);
+    if (lhs->type != rhs->type)
+        return 0;
+    switch (lhs->type) {
+        case LEPT_STRING:
+            return LEPT_STRING_LEN(lhs) == LEPT_STRING_LEN(rhs) &&
+                memcmp(LEPT_STRING_DATA(lhs), LEPT_STRING_DATA(rhs), LEPT_STRING_LEN(lhs)) == 0;
+        case LEPT_NUMBER:
+            if (lhs->flags & rhs->flags & LEPT_FLAG_INT64)
+                return lhs->u.i == rhs->u.i;
+            if (!((lhs->flags | rhs->flags) & LEPT_FLAG_INT64))
+                return lhs->u.n == rhs->u.n;
+            else {
+                /* exact comparison: (double)i alone would equate distinct values beyond 2^53 */
+                double d = (lhs->flags & LEPT_FLAG_INT64) ? rhs->u.n : lhs->u.n;
+                int64_t i = (lhs->flags & LEPT_FLAG_INT64) ? lhs->u.i : rhs->u.i;
+                return d >= -9223372036854775808.0 && d < 9223372036854775808.0 && (int64_t)d == i && (double)i == d;
+            }
+        case LEPT_ARRAY:
+            LEPT_LOAD(lhs);
+            LEPT_LOAD(rhs);
+            if (lhs->size != rhs->size)
+                return 0;
+            for (i = 0; i < lhs->size; i++)
+                if (!lept_is_equal(&lhs->u.e[i], &rhs->u.e[i]))
+                    return 0;
+            return 1;
+        case LEPT_OBJECT:
+            /* \todo */
+            LEPT_LOAD(lhs);
+            LEPT_LOAD(rhs);
+            if (lhs->size != rhs->size)
+                return 0;
+            for (i = 0; i < lhs->size; ++i) {
+                size_t res;
+                char* key = lhs->u.m[i].k;
+                res = lept_find_object_index(rhs, key, lhs->u.m[i].klen);
+                if (res == LEPT_KEY_NOT_EXIST)
+                    return 0;
+                if (lept_is_equal(&lhs->u.m[i].v, &rhs->u.m[res].v) == 0) {
+                    return 0;
+                }
+            }
+            return 1;
+        default:
+            return 1;
+    }
+}
+
+int lept_get_boolean(const lept_value* v) {
+    assert(v != NULL && (v->type == LEPT_TRUE || v->type == LEPT_FALSE));
+    return v->type == LEPT_TRUE;
+}
+
+void lept_set_boolean(lept_value* v, int b) {
+    lept_free(v);
+    v->type = b ? LEPT_TRUE : LEPT_FALSE;
+}
+
+double lept_get_number(const lept_value* v) {
+    assert(v != NULL && v->type == LEPT_NUMBER);
+    return (v->flags & LEPT_FLAG_INT64) ? (double)v->u.i : v->u.n;
+}
+
+void lept_set_number(lept_value* v, double n) {
+    lept_free(v);
+    v->u.n = n;
+    v->type = LEPT_NUMBER;
+    v->flags = 0;
+}
+
+int lept_is_int64(const lept_value* v) {
+    assert(v != NULL);
+    return v->type == LEPT_NUMBER && (v->flags & LEPT_FLAG_INT64);
+}
+
+int64_t lept_get_int64(const lept_value* v) {
+    assert(lept_is_int64(v));
+    return v->u.i;
+}
+
+void lept_set_int64(lept_value* v, int64_t i) {
+    lept_free(v);
+    v->u.i = i;
+    v->type = LEPT_NUMBER;
+    v->flags = LEPT_FLAG_INT64;
+}
+
+const char* lept_get_string(const lept_value* v) {
+    assert(v != NULL && v->type == LEPT_STRING);
+    return LEPT_STRING_DATA(v);
+}
+
+size_t lept_get_string_length(const lept_value* v) {
+    assert(v != NULL && v->type == LEPT_STRING);
+    return LEPT_STRING_LEN(v);
+}
+
+void lept_set_string_a(const lept_allocator* a, lept_value* v, const char* s, size_t len) {
+    assert(v != NULL && (s != NULL || len == 0));
+    lept_free_a(a, v);
+    v->type = LEPT_STRING;
+    if (len <= LEPT_SSO_MAX) {
+        memcpy(v, s, len);
+        ((char*)v)[len] = '\0';
+        ((char*)v)[LEPT_SSO_MAX] = (char)(LEPT_SSO_MAX - len);
+        v->flags = LEPT_FLAG_INLINE;
+        return;
+    }
+    assert(len <= UINT32_MAX);
+    v->u.s = (char*)lept_alloc(a, len + 1);
+    memcpy(v->u.s, s, len);
+    v->u.s[len] = '\0';
+    v->size = (uint32_t)len;
+    v->flags = LEPT_STORAGE_FLAGS(a);
+}
+
+void lept_set_string(lept_value* v, const char* s, size_t len) {
+    lept_set_string_a(NULL, v, s, len);
+}
+
+void lept_set_array_a(const lept_allocator* a, lept_value* v, size_t capacity) {
+    assert(v != NULL);
+    lept_free_a(a, v);
+    v->type = LEPT_ARRAY;
+    v->flags = LEPT_STORAGE_FLAGS(a);
+    assert(capacity <= UINT32_MAX);
+    v->size = 0;
+    v->u.e = capacity > 0 ? (lept_value*)lept_block_resize(a, NULL, 0, lept_elements_size(capacity), capacity) : NULL;
+}
+
+void lept_set_array(lept_value* v, size_t capacity) {
+    lept_set_array_a(NULL, v, capacity);
+}
+
+size_t lept_get_array_size(const lept_value* v) {
+    assert(v != NULL && v->type == LEPT_ARRAY);
+    LEPT_LOAD(v);
+    return v->size;
+}
+
+size_t lept_get_array_capacity(const lept_value* v) {
+    assert(v != NULL && v->type == LEPT_ARRAY);
+    LEPT_LOAD(v);
+    return LEPT_CAPACITY(v->u.e);
+}
+
+void lept_reserve_array_a(const lept_allocator* a, lept_value* v, size_t capacity) {
+    assert(v != NULL && v->type == LEPT_ARRAY);
+    LEPT_LOAD(v);
+    assert((v->flags & LEPT_FLAG_ARENA) == LEPT_STORAGE_FLAGS(a));
+    assert(capacity <= UINT32_MAX);
+    if (LEPT_CAPACITY(v->u.e) < capacity)
+        v->u.e = (lept_value*)lept_block_resize(a, v->u.e, lept_elements_size(LEPT_CAPACITY(v->u.e)), lept_elements_size(capacity), capacity);
+}
+
+void lept_reserve_array(lept_value* v, size_t capacity) {
+    lept_reserve_array_a(NULL, v, capacity);
+}
+
+void lept_shrink_array_a(const lept_allocator* a, lept_value* v) {
+    size_t capacity;
+    assert(v != NULL && v->type == LEPT_ARRAY);
+    LEPT_LOAD(v);
+    capacity = LEPT_CAPACITY(v->u.e);
+    if (capacity > v->size) {
+        if (v->flags & LEPT_FLAG_ARENA)  /* region memory only returns with the region */
+            LEPT_BLOCK(v->u.e)->capacity = v->size;
+        else if (v->size == 0) {
+            lept_block_release(a, v->u.e, lept_elements_size(capacity));
+            v->u.e = NULL;
+        }
+        else
+            v->u.e = (lept_value*)lept_block_resize(a, v->u.e, lept_elements_size(capacity), lept_elements_size(v->size), v->size);
+    }
+}
+
+void lept_shrink_array(lept_value* v) {
+    lept_shrink_array_a(NULL, v);
+}
+
+void lept_clear_array_a(const lept_allocator* a, lept_value* v) {
+    assert(v != NULL && v->type == LEPT_ARRAY);
+    LEPT_LOAD(v);
+    lept_erase_array_element_a(a, v, 0, v->size);
+}
+
+void lept_clear_array(lept_value* v) {
+    lept_clear_array_a(NULL, v);
+}
+
+lept_value* lept_get_array_element(lept_value* v, size_t index) {
+    assert(v != NULL && v->type == LEPT_ARRAY);
+    LEPT_LOAD(v);
+    assert(index < v->size);
+    return &v->u.e[index];
+}
+
+lept_value* lept_pushback_array_element_a(const lept_allocator* a, lept_value* v) {
+    assert(v != NULL && v->type == LEPT_ARRAY);
+    LEPT_LOAD(v);
+    assert(v->size < UINT32_MAX);
+    if (v->size == LEPT_CAPACITY(v->u.e))
+        lept_reserve_array_a(a, v, LEPT_GROW(v->size));
+    lept_init(&v->u.e[v->size]);
+    return &v->u.e[v->size++];
+}
+
+lept_value* lept_pushback_array_element(lept_value* v) {
+    return lept_pushback_array_element_a(NULL, v);
+}
+
+void lept_popback_array_element_a(const lept_allocator* a, lept_value* v) {
+    assert(v != NULL && v->type == LEPT_ARRAY);
+    LEPT_LOAD(v);
+    assert(v->size > 0);
+    lept_free_a(a, &v->u.e[--v->size]);
+}
+
+void lept_popback_array_element(lept_value* v) {
+    lept_popback_array_element_a(NULL, v);
+}
+
+lept_value* lept_insert_array_element_a(const lept_allocator* a, lept_value* v, size_t index) {
+    assert(v != NULL && v->type == LEPT_ARRAY);
+    LEPT_LOAD(v);
+    assert(index <= v->size && v->size < UINT32_MAX);
+    if (LEPT_CAPACITY(v->u.e) == v->size)
+        lept_reserve_array_a(a, v, LEPT_GROW(v->size));
+    memmove(&v->u.e[index + 1], &v->u.e[index], (v->size - index) * sizeof(lept_value));
+    v->size++;
+    lept_init(&v->u.e[index]);
+    return &v->u.e[index];
+}
+
+lept_value* lept_insert_array_element(lept_value* v, size_t index) {
+    return lept_insert_array_element_a(NULL, v, index);
+}
+
+void lept_erase_array_element_a(const lept_allocator* a, lept_value* v, size_t index, size_t count) {
+    size_t i;
+    assert(v != NULL && v->type == LEPT_ARRAY);
+    LEPT_LOAD(v);
+    assert(index + count <= v->size);
+    if (count == 0)
+        return;
+    for (i = index; i < index + count; i++)
+        lept_free_a(a, &v->u.e[i]);
+    memmove(&v->u.e[index], &v->u.e[index + count], (v->size - index - count) * sizeof(lept_value));
+    v->size -= count;
+}
+
+void lept_erase_array_element(lept_value* v, size_t index, size_t count) {
+    lept_erase_array_element_a(NULL, v, index, count);
+}
+
+void lept_set_object_a(const lept_allocator* a, lept_value* v, size_t capacity) {
+    assert(v != NULL);
+    lept_free_a(a, v);
+    v->type = LEPT_OBJECT;
+    v->flags = LEPT_STORAGE_FLAGS(a);
+    assert(capacity <= UINT32_MAX);
+    v->size = 0;
+    v->u.m = capacity > 0 ? (lept_member*)lept_block_resize(a, NULL, 0, lept_members_size(capacity), capacity) : NULL;
+}
+
+void lept_set_object(lept_value* v, size_t capacity) {
+    lept_set_object_a(NULL, v, capacity);
+}
+
+size_t lept_get_object_size(const lept_value* v) {
+    assert(v != NULL && v->type == LEPT_OBJECT);
+    LEPT_LOAD(v);
+    return v->size;
+}
+
+size_t lept_get_object_capacity(const lept_value* v) {
+    assert(v != NULL && v->type == LEPT_OBJECT);
+    LEPT_LOAD(v);
+    /* \todo */
+    /*ֱӷcapacity*/ 
+    return LEPT_CAPACITY(v->u.m);
+}
+
+void lept_reserve_object_a(const lept_allocator* a, lept_value* v, size_t capacity) {
+    assert(v != NULL && v->type == LEPT_OBJECT);
+    LEPT_LOAD(v);
+    assert((v->flags & LEPT_FLAG_ARENA) == LEPT_STORAGE_FLAGS(a));
+    /* \todo */
+    /* ·JSONĿռ */ 
+    /* ȱȽϵǰĿռ¿ռĴСϵ */ 
+    assert(capacity <= UINT32_MAX);
+    if (LEPT_CAPACITY(v->u.m) < capacity) {
+        v->u.m = (lept_member*)lept_block_resize(a, v->u.m, lept_members_size(LEPT_CAPACITY(v->u.m)), lept_members_size(capacity), capacity);
+        v->flags &= ~LEPT_FLAG_INDEXED;
+    }
+}
+
+void lept_reserve_object(lept_value* v, size_t capacity) {
+    lept_reserve_object_a(NULL, v, capacity);
+}
+
+void lept_shrink_object_a(const lept_allocator* a, lept_value* v) {
+    assert(v != NULL && v->type == LEPT_OBJECT);
+    LEPT_LOAD(v);
+    /* \todo */
+    /*ʱռ*/ 
+    /*Ƚ϶ЧԪĴСϵ*/ 
+    if (LEPT_CAPACITY(v->u.m) > v->size) {
+        if (v->flags & LEPT_FLAG_ARENA)  /* region memory only returns with the region */
+            LEPT_BLOCK(v->u.m)->capacity = v->size;
+        else if (v->size == 0) {
+            lept_block_release(a, v->u.m, lept_members_size(LEPT_BLOCK(v->u.m)->capacity));
+            v->u.m = NULL;
+        }
+        else
+            v->u.m = (lept_member*)lept_block_resize(a, v->u.m, lept_members_size(LEPT_BLOCK(v->u.m)->capacity), lept_members_size(v->size), v->size);
+        v->flags &= ~LEPT_FLAG_INDEXED;
+    }
+}
+
+void lept_shrink_object(lept_value* v) {
+    lept_shrink_object_a(NULL, v);
+}
+
+/*ݹն*/ 
+void lept_clear_object_a(const lept_allocator* a, lept_value* v) {
+    assert(v != NULL && v->type == LEPT_OBJECT);
+    /* \todo */
+    size_t i = 0;
+    LEPT_LOAD(v);
+    for (; i < v->size; i++) {
+        if (!(v->flags & (LEPT_FLAG_BORROWED | LEPT_FLAG_ARENA)))
+            lept_release(a, v->u.m[i].k, v->u.m[i].klen + 1);
+        lept_free_a(a, &v->u.m[i].v);
+    }
+    v->size = 0;
+    v->flags &= ~(LEPT_FLAG_BORROWED | LEPT_FLAG_INDEXED);
+}
+
+void lept_clear_object(lept_value* v) {
+    lept_clear_object_a(NULL, v);
+}
+
+const char* lept_get_object_key(const lept_value* v, size_t index) {
+    assert(v != NULL && v->type == LEPT_OBJECT);
+    LEPT_LOAD(v);
+    assert(index < v->size);
+    return v->u.m[index].k;
+}
+
+size_t lept_get_object_key_length(const lept_value* v, size_t index) {
+    assert(v != NULL && v->type == LEPT_OBJECT);
+    LEPT_LOAD(v);
+    assert(index < v->size);
+    return v->u.m[index].klen;
+}
+
+lept_value* lept_get_object_value(lept_value* v, size_t index) {
+    assert(v != NULL && v->type == LEPT_OBJECT);
+    LEPT_LOAD(v);
+    assert(index < v->size);
+    return &v->u.m[index].v;
+}
+
+/* hash is lept_hash(key, klen), or 0 if the caller has not computed it */
+static size_t lept_find_member(const lept_value* v, const char* key, size_t klen, uint32_t hash) {
+    size_t i, buckets;
+    LEPT_LOAD(v);
+    if (v->size >= LEPT_OBJECT_INDEX_MIN && (buckets = lept_index_buckets(LEPT_CAPACITY(v->u.m))) != 0) {
+        if (!(v->flags & LEPT_FLAG_INDEXED))
+            lept_index_build((lept_value*)v, buckets);
+        i = LEPT_INDEX(v)[lept_index_probe(v, buckets, key, klen, hash != 0 ? hash : lept_hash(key, klen))];
+        return i != 0 ? i - 1 : LEPT_KEY_NOT_EXIST;
+    }
+    for (i = 0; i < v->size; i++)
+        if (v->u.m[i].klen == klen && (v->u.m[i].k == key || memcmp(v->u.m[i].k, key, klen) == 0))
+            return i;
+    return LEPT_KEY_NOT_EXIST;
+}
+
+/*
+ * An interned key matches its member without a memcmp, but it is hashed like any other:
+ * nothing tells it apart from a caller's pointer, whose bytes before it cannot be read.
+ * Stored hashes serve building the index, and compiled pointers and paths bring their own.
+ */
+size_t lept_find_object_index(const lept_value* v, const char* key, size_t klen) {
+    assert(v != NULL && v->type == LEPT_OBJECT && key != NULL);
+    return lept_find_member(v, key, klen, 0);
+}
+
+lept_value* lept_find_object_value(lept_value* v, const char* key, size_t klen) {
+    size_t index = lept_find_object_index(v, key, klen);
+    return index != LEPT_KEY_NOT_EXIST ? &v->u.m[index].v : NULL;
+}
+
+/*Ҫһvalue*/ 
+/*ͬ  Լ ֵһ*/ 
+/* Copies in-situ keys before the object gets keys of its own, so ownership is uniform again. */
+static void lept_own_object_keys(const lept_allocator* a, lept_value* v) {
+    size_t i;
+    if (v->flags & LEPT_FLAG_BORROWED) {
+        for (i = 0; i < v->size; i++) {
+            lept_member* m = &v->u.m[i];
+            char* k = (char*)lept_alloc(a, m->klen + 1);
+            memcpy(k, m->k, m->klen + 1);
+            m->k = k;
+        }
+        v->flags &= ~LEPT_FLAG_BORROWED;
+    }
+}
+
+/* Appends a member that takes k, which the object must be able to own. */
+static lept_value* lept_append_object_member(const lept_allocator* a, lept_value* v, char* k, size_t klen) {
+    size_t index = 0;
+    assert(v->size < UINT32_MAX);
+    if (LEPT_CAPACITY(v->u.m) == v->size) {
+        lept_reserve_object_a(a, v, LEPT_GROW(v->size));
+    }
+    index += v->size;
+    v->u.m[index].k = k;
+    v->u.m[index].klen = klen;
+    lept_init(&v->u.m[index].v);
+    v->size++;
+    if (v->flags & LEPT_FLAG_INDEXED)
+        lept_index_insert(v, lept_index_buckets(LEPT_CAPACITY(v->u.m)), index);
+    return &v->u.m[index].v;
+}
+
+lept_value* lept_set_object_value_a(const lept_allocator* a, lept_value* v, const char* key, size_t klen) {
+    char* k;
+    assert(v != NULL && v->type == LEPT_OBJECT && key != NULL);
+    LEPT_LOAD(v);
+    /* \todo */
+    lept_own_object_keys(a, v);
+    k = (char*)lept_alloc(a, klen + 1);
+    memcpy(k, key, klen);
+    k[klen] = '\0';
+    v->flags &= ~LEPT_FLAG_INTERNED;
+    return lept_append_object_member(a, v, k, klen);
+}
+
+lept_value* lept_set_object_value(lept_value* v, const char* key, size_t klen) {
+    return lept_set_object_value_a(NULL, v, key, klen);
+}
+
+void lept_remove_object_value_a(const lept_allocator* a, lept_value* v, size_t index) {
+    assert(v != NULL && v->type == LEPT_OBJECT);
+    LEPT_LOAD(v);
+    assert(index < v->size);
+    if (!(v->flags & (LEPT_FLAG_BORROWED | LEPT_FLAG_ARENA)))
+        lept_release(a, v->u.m[index].k, v->u.m[index].klen + 1);
+    lept_free_a(a, &v->u.m[index].v);
+    memmove(&v->u.m[index], &v->u.m[index + 1], (v->size - index - 1) * sizeof(lept_member));
+    v->size--;
+    /* every later member moved down, which costs as much as indexing them again */
+    if (v->flags & LEPT_FLAG_INDEXED)
+        lept_index_build(v, lept_index_buckets(LEPT_CAPACITY(v->u.m)));
+}
+
+void lept_remove_object_value(lept_value* v, size_t index) {
+    lept_remove_object_value_a(NULL, v, index);
+}
+
+typedef struct {
+    const char* key;        /* unescaped, null-terminated */
+    size_t klen;
+    size_t index;           /* the array index the token names, or LEPT_KEY_NOT_EXIST */
+    uint32_t hash;
+}lept_pointer_token;
+
+/* One block: the pointer, its tokens, then their keys. */
+struct lept_pointer {
+    lept_pointer_token* tokens;
+    size_t count, size;
+    const lept_allocator* a;
+};
+
+lept_pointer* lept_pointer_compile_a(const lept_allocator* a, const char* pointer) {
+    lept_pointer* p;
+    const char* q;
+    char* k;
+    size_t i, count = 0, len, size;
+    assert(pointer != NULL);
+    if (!lept_pointer_valid(pointer))
+        return NULL;
+    for (q = pointer; *q != '\0'; q++)
+        count += *q == '/';
+    len = q - pointer;
+    size = sizeof(lept_pointer) + count * sizeof(lept_pointer_token) + len;
+    p = (lept_pointer*)lept_alloc(a, size);
+    p->tokens = (lept_pointer_token*)(p + 1);
+    p->count = count;
+    p->size = size;
+    p->a = a;
+    k = (char*)(p->tokens + count);
+    for (q = pointer, i = 0; i < count; i++) {
+        lept_pointer_token* t = &p->tokens[i];
+        t->key = k;
+        t->index = lept_pointer_index(q);
+        for (q++; *q != '/' && *q != '\0'; q++)
+            *k++ = *q != '~' ? *q : *++q == '0' ? '~' : '/';
+        t->klen = k - t->key;
+        t->hash = lept_hash(t->key, t->klen);
+        *k++ = '\0';
+    }
+    return p;
+}
+
+lept_pointer* lept_pointer_compile(const char* pointer) {
+    return lept_pointer_compile_a(NULL, pointer);
+}
+
+void lept_pointer_free(lept_pointer* p) {
+    assert(p != NULL);
+    lept_release(p->a, p, p->size);
+}
+
+lept_value* lept_pointer_get(lept_value* v, const lept_pointer* p) {
+    size_t i, index;
+    assert(v != NULL && p != NULL);
+    for (i = 0; i < p->count; i++) {
+        const lept_pointer_token* t = &p->tokens[i];
+        if (v->type == LEPT_OBJECT) {
+            if ((index = lept_find_member(v, t->key, t->klen, t->hash)) == LEPT_KEY_NOT_EXIST)
+                return NULL;
+            v = &v->u.m[index].v;
+        }
+        else if (v->type == LEPT_ARRAY && t->index < lept_get_array_size(v))
+            v = &v->u.e[t->index];
+        else
+            return NULL;
+    }
+    return v;
+}
+
+lept_value* lept_pointer_set_a(const lept_allocator* a, lept_value* v, const lept_pointer* p) {
+    size_t i, index;
+    assert(v != NULL && p != NULL);
+    for (i = 0; i < p->count; i++) {
+        const lept_pointer_token* t = &p->tokens[i];
+        int append = t->klen == 1 && *t->key == '-';
+        if (v->type == LEPT_NULL) {
+            if (t->index != LEPT_KEY_NOT_EXIST || append)
+                lept_set_array_a(a, v, 0);
+            else
+                lept_set_object_a(a, v, 0);
+        }
+        if (v->type == LEPT_OBJECT) {
+            if ((index = lept_find_member(v, t->key, t->klen, t->hash)) != LEPT_KEY_NOT_EXIST)
+                v = &v->u.m[index].v;
+            else
+                v = lept_set_object_value_a(a, v, t->key, t->klen);
+        }
+        else if (v->type == LEPT_ARRAY && (t->index != LEPT_KEY_NOT_EXIST || append)) {
+            index = append ? lept_get_array_size(v) : t->index;
+            while (lept_get_array_size(v) <= index)
+                lept_pushback_array_element_a(a, v);
+            v = &v->u.e[index];
+        }
+        else
+            return NULL;
+    }
+    return v;
+}
+
+lept_value* lept_pointer_set(lept_value* v, const lept_pointer* p) {
+    return lept_pointer_set_a(NULL, v, p);
+}
+
+/*
+ * A compiled JSONPath query (RFC 9535) is a list of segments. Each applies its selectors
+ * to the current values, or to them and all their descendants, and hands what they
+ * select to the next segment.
+ */
+typedef struct lept_path_segment lept_path_segment;
+typedef struct lept_path_selector lept_path_selector;
+typedef struct lept_path_expr lept_path_expr;
+
+enum { LEPT_SELECT_NAME, LEPT_SELECT_WILDCARD, LEPT_SELECT_INDEX, LEPT_SELECT_SLICE, LEPT_SELECT_FILTER };
+
+/* slice bounds that are left out; indices are within +-(2^53 - 1) */
+#define LEPT_PATH_DEFAULT   INT64_MIN
+
+struct lept_path_selector {
+    int type;
+    const char* key;        /* name */
+    size_t klen;
+    uint32_t hash;
+    int64_t start, end, step;   /* start is the index of an index selector */
+    lept_path_expr* filter;
+    lept_path_selector* next;
+};
+
+struct lept_path_segment {
+    lept_path_selector* selectors;
+    int descendants;
+    lept_path_segment* next;
+};
+
+enum {
+    LEPT_EXPR_OR, LEPT_EXPR_AND, LEPT_EXPR_NOT, LEPT_EXPR_EXISTS,
+    LEPT_EXPR_EQ, LEPT_EXPR_NE, LEPT_EXPR_LT, LEPT_EXPR_LE, LEPT_EXPR_GT, LEPT_EXPR_GE,
+    LEPT_EXPR_LITERAL, LEPT_EXPR_QUERY
+};
+
+struct lept_path_expr {
+    lept_value literal;     /* strings point into the plan */
+    int op;
+    int absolute;           /* the query starts at $ rather than @ */
+    lept_path_segment* query;
+    lept_path_expr* left, * right;
+};
+
+/* One block: the path, then the expressions, selectors, segments and strings of the plan. */
+struct lept_path {
+    lept_path_segment* query;
+    size_t size;
+    const lept_allocator* a;
+};
+
+typedef struct {
+    const char* q, * end;
+    lept_path_expr* exprs;
+    lept_path_selector* selectors;
+    lept_path_segment* segments;
+    char* strings;
+    size_t depth;
+}lept_path_compiler;
+
+#define LEPT_PATH_ALIGN(n)      (((n) + 7) & ~(size_t)7)
+#define LEPT_PATH_CHILD(v, i)   ((v)->type == LEPT_ARRAY ? &(v)->u.e[i] : &(v)->u.m[i].v)
+
+static void lept_path_whitespace(lept_path_compiler* k) {
+    while (ISWHITESPACE(*k->q))
+        k->q++;
+}
+
+/* A string literal in either quotes, with the escapes of JSON plus \' in single quotes */
+static int lept_path_parse_string(lept_path_compiler* k, const char** str, size_t* len) {
+    char quote = *k->q, * w = k->strings;
+    const char* p = k->q + 1;
+    unsigned u, u2;
+    *str = w;
+    for (;;) {
+        char ch = *p++;
+        if (ch == quote)
+            break;
+        if ((unsigned char)ch < 0x20)
+            return 0;
+        if (ch != '\\') {
+            *w++ = ch;
+            continue;
+        }
+        switch (*p++) {
+            case '\\': *w++ = '\\'; break;
+            case '/':  *w++ = '/';  break;
+            case 'b':  *w++ = '\b'; break;
+            case 'f':  *w++ = '\f'; break;
+            case 'n':  *w++ = '\n'; break;
+            case 'r':  *w++ = '\r'; break;
+            case 't':  *w++ = '\t'; break;
+            case '\'':
+            case '\"':
+                if (p[-1] != quote)
+                    return 0;
+                *w++ = quote;
+                break;
+            case 'u':
+                if (!(p = lept_parse_hex4(p, k->end, &u)))
+                    return 0;
+                if (u >= 0xD800 && u <= 0xDBFF) {
+                    if (p[0] != '\\' || p[1] != 'u' || !(p = lept_parse_hex4(p + 2, k->end, &u2)) || u2 < 0xDC00 || u2 > 0xDFFF)
+                        return 0;
+                    u = (((u - 0xD800) << 10) | (u2 - 0xDC00)) + 0x10000;
+                }
+                else if (u >= 0xDC00 && u <= 0xDFFF)
+                    return 0;
+                w += lept_encode_utf8(w, u);
+                break;
+            default:
+                return 0;
+        }
+    }
+    *len = w - *str;
+    *w++ = '\0';
+    k->strings = w;
+    k->q = p;
+    return 1;
+}
+
+#define ISNAMECHAR(ch)  (((ch) >= 'a' && (ch) <= 'z') || ((ch) >= 'A' && (ch) <= 'Z') || (ch) == '_' || ((ch) & 0x80))
+
+/* The name of a dot selector */
+static int lept_path_parse_name(lept_path_compiler* k, lept_path_selector* s) {
+    const char* p = k->q;
+    if (!ISNAMECHAR(*p))
+        return 0;
+    while (ISNAMECHAR(*p) || ISDIGIT(*p))
+        p++;
+    s->type = LEPT_SELECT_NAME;
+    s->key = k->strings;
+    s->klen = p - k->q;
+    memcpy(k->strings, k->q, s->klen);
+    k->strings[s->klen] = '\0';
+    k->strings += s->klen + 1;
+    k->q = p;
+    return 1;
+}
+
+static int lept_path_parse_int(lept_path_compiler* k, int64_t* i) {
+    const char* p = k->q;
+    int64_t n = 0;
+    if (*p == '-')
+        p++;
+    if (*p == '0')
+        p++;
+    else if (ISDIGIT1TO9(*p))
+        for (; ISDIGIT(*p); p++) {
+            if (n > (INT64_C(9007199254740991) - (*p - '0')) / 10)
+                return 0;
+            n = n * 10 + (*p - '0');
+        }
+    else
+        return 0;
+    /* "-0" is not an index */
+    if (*k->q == '-' && n == 0)
+        return 0;
+    *i = *k->q == '-' ? -n : n;
+    k->q = p;
+    return 1;
+}
+
+static int lept_path_parse_query(lept_path_compiler* k, lept_path_segment** query);
+static lept_path_expr* lept_path_parse_or(lept_path_compiler* k);
+
+static lept_path_expr* lept_path_expr_new(lept_path_compiler* k, int op, lept_path_expr* left, lept_path_expr* right) {
+    lept_path_expr* e = k->exprs++;
+    lept_init(&e->literal);
+    e->op = op;
+    e->absolute = 0;
+    e->query = NULL;
+    e->left = left;
+    e->right = right;
+    return e;
+}
+
+/* A query whose segments each select by one name or index selects at most one value. */
+static int lept_path_singular(const lept_path_segment* g) {
+    for (; g != NULL; g = g->next)
+        if (g->descendants || g->selectors->next != NULL ||
+            (g->selectors->type != LEPT_SELECT_NAME && g->selectors->type != LEPT_SELECT_INDEX))
+            return 0;
+    return 1;
+}
+
+/* A relative or absolute query, or a literal; numbers, true, false and null are read as in JSON. */
+static lept_path_expr* lept_path_parse_operand(lept_path_compiler* k) {
+    lept_path_expr* e = lept_path_expr_new(k, LEPT_EXPR_LITERAL, NULL, NULL);
+    lept_context c;
+    const char* str;
+    size_t len;
+    if (*k->q == '@' || *k->q == '$') {
+        e->op = LEPT_EXPR_QUERY;
+        e->absolute = *k->q++ == '$';
+        return lept_path_parse_query(k, &e->query) ? e : NULL;
+    }
+    if (*k->q == '\'' || *k->q == '"') {
+        if (!lept_path_parse_string(k, &str, &len))
+            return NULL;
+        e->literal.type = LEPT_STRING;
+        e->literal.flags = LEPT_FLAG_BORROWED;
+        e->literal.u.s = (char*)str;
+        e->literal.size = (uint32_t)len;
+        return e;
+    }
+    lept_parse_begin(&c, k->q, k->end - k->q, 0, NULL, NULL);
+    if (lept_parse_scalar(&c, &e->literal) != LEPT_PARSE_OK)
+        return NULL;
+    k->q = c.json;
+    return e;
+}
+
+static lept_path_expr* lept_path_parse_paren(lept_path_compiler* k) {
+    lept_path_expr* e;
+    k->q++;
+    if ((e = lept_path_parse_or(k)) == NULL)
+        return NULL;
+    lept_path_whitespace(k);
+    if (*k->q != ')')
+        return NULL;
+    k->q++;
+    return e;
+}
+
+/* A comparison, an existence test, or either of the latter two in parentheses, maybe negated */
+static lept_path_expr* lept_path_parse_basic(lept_path_compiler* k) {
+    static const char ops[][3] = { "==", "!=", "<=", "<", ">=", ">" };
+    static const int codes[] = { LEPT_EXPR_EQ, LEPT_EXPR_NE, LEPT_EXPR_LE, LEPT_EXPR_LT, LEPT_EXPR_GE, LEPT_EXPR_GT };
+    lept_path_expr* e, * r;
+    size_t i;
+    lept_path_whitespace(k);
+    if (*k->q == '!') {
+        k->q++;
+        lept_path_whitespace(k);
+        if (*k->q == '(')
+            e = lept_path_parse_paren(k);
+        else if (*k->q == '@' || *k->q == '$')
+            e = (e = lept_path_parse_operand(k)) != NULL ? lept_path_expr_new(k, LEPT_EXPR_EXISTS, e, NULL) : NULL;
+        else
+            return NULL;
+        return e != NULL ? lept_path_expr_new(k, LEPT_EXPR_NOT, e, NULL) : NULL;
+    }
+    if (*k->q == '(')
+        return lept_path_parse_paren(k);
+    if ((e = lept_path_parse_operand(k)) == NULL)
+        return NULL;
+    lept_path_whitespace(k);
+    for (i = 0; i < sizeof(ops) / sizeof(ops[0]); i++)
+        if (strncmp(k->q, ops[i], strlen(ops[i])) == 0)
+            break;
+    if (i == sizeof(ops) / sizeof(ops[0]))
+        return e->op == LEPT_EXPR_QUERY ? lept_path_expr_new(k, LEPT_EXPR_EXISTS, e, NULL) : NULL;
+    k->q += strlen(ops[i]);
+    lept_path_whitespace(k);
+    if ((r = lept_path_parse_operand(k)) == NULL ||
+        (e->op == LEPT_EXPR_QUERY && !lept_path_singular(e->query)) ||
+        (r->op == LEPT_EXPR_QUERY && !lept_path_singular(r->query)))
+        return NULL;
+    return lept_path_expr_new(k, codes[i], e, r);
+}
+
+static lept_path_expr* lept_path_parse_and(lept_path_compiler* k) {
+    lept_path_expr* e, * r;
+    if ((e = lept_path_parse_basic(k)) == NULL)
+        return NULL;
+    for (lept_path_whitespace(k); k->q[0] == '&' && k->q[1] == '&'; lept_path_whitespace(k)) {
+        k->q += 2;
+        if ((r = lept_path_parse_basic(k)) == NULL)
+            return NULL;
+        e = lept_path_expr_new(k, LEPT_EXPR_AND, e, r);
+    }
+    return e;
+}
+
+static lept_path_expr* lept_path_parse_or(lept_path_compiler* k) {
+    lept_path_expr* e, * r;
+    if (k->depth++ == LEPT_PARSE_MAX_DEPTH || (e = lept_path_parse_and(k)) == NULL)
+        return NULL;
+    for (lept_path_whitespace(k); k->q[0] == '|' && k->q[1] == '|'; lept_path_whitespace(k)) {
+        k->q += 2;
+        if ((r = lept_path_parse_and(k)) == NULL)
+            return NULL;
+        e = lept_path_expr_new(k, LEPT_EXPR_OR, e, r);
+    }
+    k->depth--;
+    return e;
+}
+
+static int lept_path_parse_selector(lept_path_compiler* k, lept_path_selector* s) {
+    s->start = s->end = s->step = LEPT_PATH_DEFAULT;
+    switch (*k->q) {
+        case '\'':
+        case '"':
+            s->type = LEPT_SELECT_NAME;
+            return lept_path_parse_string(k, &s->key, &s->klen);
+        case '*':
+            s->type = LEPT_SELECT_WILDCARD;
+            k->q++;
+            return 1;
+        case '?':
+            s->type = LEPT_SELECT_FILTER;
+            k->q++;
+            return (s->filter = lept_path_parse_or(k)) != NULL;
+    }
+    if (*k->q != ':') {
+        if (!lept_path_parse_int(k, &s->start))
+            return 0;
+        lept_path_whitespace(k);
+        if (*k->q != ':') {
+            s->type = LEPT_SELECT_INDEX;
+            return 1;
+        }
+    }
+    s->type = LEPT_SELECT_SLICE;
+    k->q++;
+    lept_path_whitespace(k);
+    if ((*k->q == '-' || ISDIGIT(*k->q)) && !lept_path_parse_int(k, &s->end))
+        return 0;
+    lept_path_whitespace(k);
+    if (*k->q == ':') {
+        k->q++;
+        lept_path_whitespace(k);
+        if ((*k->q == '-' || ISDIGIT(*k->q)) && !lept_path_parse_int(k, &s->step))
+            return 0;
+    }
+    return 1;
+}
+
+static int lept_path_parse_query(lept_path_compiler* k, lept_path_segment** query) {
+    lept_path_segment** link = query;
+    lept_path_selector** next;
+    int bracket;
+    for (;;) {
+        lept_path_segment* g;
+        const char* q = k->q;
+        lept_path_whitespace(k);
+        if (*k->q != '.' && *k->q != '[') {
+            k->q = q;
+            break;
+        }
+        g = k->segments++;
+        g->descendants = k->q[0] == '.' && k->q[1] == '.';
+        *link = g;
+        link = &g->next;
+        next = &g->selectors;
+        /* "..[" and "[" open a list of selectors, ".[" does not */
+        bracket = *k->q == '[' || (g->descendants && k->q[2] == '[');
+        if (*k->q == '.')
+            k->q += g->descendants ? 2 : 1;
+        if (bracket) {
+            /* a bracketed list of selectors */
+            for (k->q++; ; k->q++) {
+                lept_path_selector* s = k->selectors++;
+                *next = s;
+                next = &s->next;
+                lept_path_whitespace(k);
+                if (!lept_path_parse_selector(k, s))
+                    return 0;
+                lept_path_whitespace(k);
+                if (*k->q != ',')
+                    break;
+            }
+            if (*k->q != ']')
+                return 0;
+            k->q++;
+        }
+        else {
+            lept_path_selector* s = k->selectors++;
+            *next = s;
+            next = &s->next;
+            s->start = s->end = s->step = LEPT_PATH_DEFAULT;
+            if (*k->q == '*') {
+                s->type = LEPT_SELECT_WILDCARD;
+                k->q++;
+            }
+            else if (!lept_path_parse_name(k, s))
+                return 0;
+        }
+        *next = NULL;
+    }
+    *link = NULL;
+    return 1;
+}
+
+lept_path* lept_path_compile_a(const lept_allocator* a, const char* query) {
+    lept_path_compiler k;
+    lept_path* p;
+    const char* q;
+    size_t segments = 0, selectors = 0, exprs = 0, size;
+    assert(query != NULL);
+    if (*query != '$')
+        return NULL;
+    /* bounds: each segment starts at '.' or '[', each later selector at ',', each expression node needs a character */
+    for (q = query; *q != '\0'; q++) {
+        segments += *q == '.' || *q == '[';
+        selectors += *q == ',';
+        exprs += *q == '?';
+    }
+    exprs = exprs > 0 ? 2 * (q - query) : 0;
+    selectors += segments;
+    size = LEPT_PATH_ALIGN(sizeof(lept_path)) + exprs * sizeof(lept_path_expr) +
+        selectors * sizeof(lept_path_selector) + segments * sizeof(lept_path_segment) + 2 * (q - query);
+    p = (lept_path*)lept_alloc(a, size);
+    p->size = size;
+    p->a = a;
+    k.q = query + 1;
+    k.end = q;
+    k.exprs = (lept_path_expr*)((char*)p + LEPT_PATH_ALIGN(sizeof(lept_path)));
+    k.selectors = (lept_path_selector*)(k.exprs + exprs);
+    k.segments = (lept_path_segment*)(k.selectors + selectors);
+    k.strings = (char*)(k.segments + segments);
+    k.depth = 0;
+    if (!lept_path_parse_query(&k, &p->query) || *k.q != '\0') {
+        lept_release(a, p, size);
+        return NULL;
+    }
+    return p;
+}
+
+lept_path* lept_path_compile(const char* query) {
+    return lept_path_compile_a(NULL, query);
+}
+
+void lept_path_free(lept_path* p) {
+    assert(p != NULL);
+    lept_release(p->a, p, p->size);
+}
+
+typedef struct {
+    lept_value** out;
+    size_t max, count;
+    size_t limit;           /* the walk stops once count reaches it */
+    lept_value* root;
+}lept_path_sink;
+
+static void lept_path_walk(const lept_path_segment* g, lept_value* v, lept_path_sink* s);
+
+/* The first value a query selects, or NULL if it selects none */
+static lept_value* lept_path_first(const lept_path_expr* e, lept_value* at, lept_value* root) {
+    lept_path_sink s;
+    lept_value* v = NULL;
+    s.out = &v;
+    s.max = s.limit = 1;
+    s.count = 0;
+    s.root = root;
+    lept_path_walk(e->query, e->absolute ? root : at, &s);
+    return v;
+}
+
+/* == and < of RFC 9535 2.3.5.2.2, where NULL stands for a query that selects nothing */
+static int lept_path_equal(const lept_value* l, const lept_value* r) {
+    return l == NULL || r == NULL ? l == r : lept_is_equal(l, r);
+}
+
+static int lept_path_less(const lept_value* l, const lept_value* r) {
+    size_t llen, rlen;
+    int c;
+    if (l == NULL || r == NULL || l->type != r->type)
+        return 0;
+    if (l->type == LEPT_NUMBER)
+        return l->flags & r->flags & LEPT_FLAG_INT64 ? l->u.i < r->u.i : lept_get_number(l) < lept_get_number(r);
+    if (l->type != LEPT_STRING)
+        return 0;
+    llen = LEPT_STRING_LEN(l);
+    rlen = LEPT_STRING_LEN(r);
+    c = memcmp(LEPT_STRING_DATA(l), LEPT_STRING_DATA(r), llen < rlen ? llen : rlen);
+    return c < 0 || (c == 0 && llen < rlen);
+}
+
+static int lept_path_test(const lept_path_expr* e, lept_value* at, lept_value* root) {
+    const lept_value* l, * r;
+    switch (e->op) {
+        case LEPT_EXPR_OR:     return lept_path_test(e->left, at, root) || lept_path_test(e->right, at, root);
+        case LEPT_EXPR_AND:    return lept_path_test(e->left, at, root) && lept_path_test(e->right, at, root);
+        case LEPT_EXPR_NOT:    return !lept_path_test(e->left, at, root);
+        case LEPT_EXPR_EXISTS: return lept_path_first(e->left, at, root) != NULL;
+    }
+    l = e->left->op == LEPT_EXPR_LITERAL ? &e->left->literal : lept_path_first(e->left, at, root);
+    r = e->right->op == LEPT_EXPR_LITERAL ? &e->right->literal : lept_path_first(e->right, at, root);
+    switch (e->op) {
+        case LEPT_EXPR_EQ: return lept_path_equal(l, r);
+        case LEPT_EXPR_NE: return !lept_path_equal(l, r);
+        case LEPT_EXPR_LT: return lept_path_less(l, r);
+        case LEPT_EXPR_LE: return lept_path_less(l, r) || lept_path_equal(l, r);
+        case LEPT_EXPR_GT: return lept_path_less(r, l);
+        default:           return lept_path_less(r, l) || lept_path_equal(l, r);
     }
 }
 
-char* lept_stringify(const lept_value* v, size_t* length) {
-    lept_context c;
-    assert(v != NULL);
-    c.stack = (char*)malloc(c.size = LEPT_PARSE_STRINGIFY_INIT_SIZE);
-    c.top = 0;
-    lept_stringify_value(&c, v);
-    if (length)
-        *length = c.top;
-    PUTC(&c, '\0');
-    return c.stack;
+/* Clamps a slice bound, counted from the end if negative */
+static int64_t lept_path_bound(int64_t i, int64_t n, int64_t lower, int64_t upper) {
+    if (i < 0)
+        i += n;
+    return i < lower ? lower : i > upper ? upper : i;
 }
 
-void lept_copy(lept_value* dst, const lept_value* src) {
-    assert(src != NULL && dst != NULL && src != dst);
-    size_t i = 0;
-    switch (src->type) {
-        case LEPT_STRING:
-            lept_set_string(dst, src->u.s.s, src->u.s.len);
+static void lept_path_select(const lept_path_selector* sel, const lept_path_segment* g, lept_value* v, size_t size, lept_path_sink* s) {
+    int64_t i, n = (int64_t)size, end, step;
+    size_t index;
+    switch (sel->type) {
+        case LEPT_SELECT_NAME:
+            if (v->type == LEPT_OBJECT && (index = lept_find_member(v, sel->key, sel->klen, sel->hash)) != LEPT_KEY_NOT_EXIST)
+                lept_path_walk(g->next, &v->u.m[index].v, s);
             break;
-        case LEPT_ARRAY:
-            /* \todo */
-            /* Եݹĵlept_copyɿ */
-            lept_set_array(dst, src->u.a.size);
-            for (; i < src->u.a.size; ++i) {
-                lept_copy(lept_pushback_array_element(dst), &src->u.a.e[i]);
-            }
+        case LEPT_SELECT_WILDCARD:
+            for (index = 0; index < size; index++)
+                lept_path_walk(g->next, LEPT_PATH_CHILD(v, index), s);
             break;
-        case LEPT_OBJECT:
-            /* \todo */
-            /*ͬ Եݹʹlept_copyɿ*/ 
-            lept_set_object(dst, src->u.o.capacity);
-            for (; i < src->u.o.size; ++i) {
-                /* ʹsize_tʱ עַҲܽ */ 
-                lept_copy(lept_set_object_value(dst, src->u.o.m[i].k, src->u.o.m[i].klen), &src->u.o.m[i].v);
+        case LEPT_SELECT_INDEX:
+            i = sel->start < 0 ? sel->start + n : sel->start;
+            if (v->type == LEPT_ARRAY && i >= 0 && i < n)
+                lept_path_walk(g->next, &v->u.e[i], s);
+            break;
+        case LEPT_SELECT_SLICE:
+            step = sel->step == LEPT_PATH_DEFAULT ? 1 : sel->step;
+            if (v->type != LEPT_ARRAY || step == 0)
+                break;
+            if (step > 0) {
+                i = sel->start == LEPT_PATH_DEFAULT ? 0 : lept_path_bound(sel->start, n, 0, n);
+                end = sel->end == LEPT_PATH_DEFAULT ? n : lept_path_bound(sel->end, n, 0, n);
+                for (; i < end; i += step)
+                    lept_path_walk(g->next, &v->u.e[i], s);
+            }
+            else {
+                i = sel->start == LEPT_PATH_DEFAULT ? n - 1 : lept_path_bound(sel->start, n, -1, n - 1);
+                end = sel->end == LEPT_PATH_DEFAULT ? -1 : lept_path_bound(sel->end, n, -1, n - 1);
+                for (; i > end; i += step)
+                    lept_path_walk(g->next, &v->u.e[i], s);
             }
             break;
-        default:
-            lept_free(dst);
-            memcpy(dst, src, sizeof(lept_value));
+        case LEPT_SELECT_FILTER:
+            for (index = 0; index < size; index++)
+                if (lept_path_test(sel->filter, LEPT_PATH_CHILD(v, index), s->root))
+                    lept_path_walk(g->next, LEPT_PATH_CHILD(v, index), s);
             break;
     }
 }
 
-void lept_move(lept_value* dst, lept_value* src) {
-    assert(dst != NULL && src != NULL && src != dst);
-    lept_free(dst);
-    memcpy(dst, src, sizeof(lept_value));
-    lept_init(src);
+/* Applies the segments from g on to v, and stores the values that come out of the last one. */
+static void lept_path_walk(const lept_path_segment* g, lept_value* v, lept_path_sink* s) {
+    const lept_path_selector* sel;
+    size_t i, size;
+    if (s->count >= s->limit)
+        return;
+    if (g == NULL) {
+        if (s->count < s->max)
+            s->out[s->count] = v;
+        s->count++;
+        return;
+    }
+    if (v->type != LEPT_ARRAY && v->type != LEPT_OBJECT)
+        return;
+    size = v->type == LEPT_ARRAY ? lept_get_array_size(v) : lept_get_object_size(v);
+    for (sel = g->selectors; sel != NULL; sel = sel->next)
+        lept_path_select(sel, g, v, size, s);
+    if (g->descendants)
+        for (i = 0; i < size; i++)
+            lept_path_walk(g, LEPT_PATH_CHILD(v, i), s);
 }
 
-void lept_swap(lept_value* lhs, lept_value* rhs) {
-    assert(lhs != NULL && rhs != NULL);
-    if (lhs != rhs) {
-        lept_value temp;
-        memcpy(&temp, lhs, sizeof(lept_value));
-        memcpy(lhs,   rhs, sizeof(lept_value));
-        memcpy(rhs, &temp, sizeof(lept_value));
-    }
+size_t lept_path_query(const lept_path* p, lept_value* v, lept_value** out, size_t max) {
+    lept_path_sink s;
+    assert(p != NULL && v != NULL && (out != NULL || max == 0));
+    s.out = out;
+    s.max = max;
+    s.count = 0;
+    s.limit = (size_t)-1;
+    s.root = v;
+    lept_path_walk(p->query, v, &s);
+    return s.count;
 }
 
-void lept_free(lept_value* v) {
-    size_t i;
-    assert(v != NULL);
-    switch (v->type) {
-        case LEPT_STRING:
-            free(v->u.s.s);
-            break;
-        case LEPT_ARRAY:
-            for (i = 0; i < v->u.a.size; i++)
-                lept_free(&v->u.a.e[i]);
-            free(v->u.a.e);
-            break;
-        case LEPT_OBJECT:
-            for (i = 0; i < v->u.o.size; i++) {
-                free(v->u.o.m[i].k);
-                lept_free(&v->u.o.m[i].v);
-            }
-            free(v->u.o.m);
-            break;
-        default: break;
-    }
-    v->type = LEPT_NULL;
+void lept_document_init_a(lept_document* d, const lept_allocator* upstream) {
+    assert(d != NULL);
+    lept_init(&d->root);
+    d->allocator.alloc = lept_arena_alloc;
+    d->allocator.resize = lept_arena_resize;
+    d->allocator.release = NULL;
+    d->allocator.ctx = d;
+    d->upstream = upstream;
+    d->chunks = NULL;
+    d->keys = NULL;
+    d->key_count = d->key_buckets = 0;
 }
 
-lept_type lept_get_type(const lept_value* v) {
-    assert(v != NULL);
-    return v->type;
+void lept_document_init(lept_document* d) {
+    lept_document_init_a(d, NULL);
 }
 
-int lept_is_equal(const lept_value* lhs, const lept_value* rhs) {
-    size_t i;
-    assert(lhs != NULL && rhs != NULL);
-    if (lhs->type != rhs->type)
-        return 0;
-    switch (lhs->type) {
-        case LEPT_STRING:
-            return lhs->u.s.len == rhs->u.s.len && 
-                memcmp(lhs->u.s.s, rhs->u.s.s, lhs->u.s.len) == 0;
-        case LEPT_NUMBER:
-            return lhs->u.n == rhs->u.n;
-        case LEPT_ARRAY:
-            if (lhs->u.a.size != rhs->u.a.size)
-                return 0;
-            for (i = 0; i < lhs->u.a.size; i++)
-                if (!lept_is_equal(&lhs->u.a.e[i], &rhs->u.a.e[i]))
-                    return 0;
-            return 1;
-        case LEPT_OBJECT:
-            /* \todo */
-            if (lhs->u.o.size != rhs->u.o.size)
-                return 0;
-            for (i = 0; i < lhs->u.o.size; ++i) {
-                size_t res;
-                char* key = lhs->u.o.m[i].k;
-                res = lept_find_object_index(rhs, key, lhs->u.o.m[i].klen);
-                if (res == LEPT_KEY_NOT_EXIST)
-                    return 0;
-                if (lept_is_equal(&lhs->u.o.m[i].v, &rhs->u.o.m[res].v) == 0) {
-                    return 0;
-                }
-            }
-            return 1;
-        default:
-            return 1;
+static void lept_document_release_chunks(lept_document* d, lept_chunk* k) {
+    while (k != NULL) {
+        lept_chunk* next = k->next;
+        lept_release(d->upstream, k, LEPT_ARENA_ROUND(sizeof(lept_chunk)) + k->size);
+        k = next;
     }
 }
 
-int lept_get_boolean(const lept_value* v) {
-    assert(v != NULL && (v->type == LEPT_TRUE || v->type == LEPT_FALSE));
-    return v->type == LEPT_TRUE;
+void lept_document_free(lept_document* d) {
+    assert(d != NULL);
+    lept_document_release_chunks(d, d->chunks);
+    d->chunks = NULL;
+    if (d->keys != NULL)
+        lept_release(d->upstream, d->keys, d->key_buckets * sizeof(char*));
+    d->keys = NULL;
+    d->key_count = d->key_buckets = 0;
+    lept_init(&d->root);
 }
 
-void lept_set_boolean(lept_value* v, int b) {
-    lept_free(v);
-    v->type = b ? LEPT_TRUE : LEPT_FALSE;
+/* Replaces the previous tree; the newest (largest) chunk is kept for reuse. */
+static void lept_document_reset(lept_document* d) {
+    if (d->chunks != NULL) {
+        lept_document_release_chunks(d, d->chunks->next);
+        d->chunks->next = NULL;
+        d->chunks->used = 0;
+    }
+    /* the keys lived in the chunks */
+    if (d->key_count > 0) {
+        memset(d->keys, 0, d->key_buckets * sizeof(char*));
+        d->key_count = 0;
+    }
 }
 
-double lept_get_number(const lept_value* v) {
-    assert(v != NULL && v->type == LEPT_NUMBER);
-    return v->u.n;
+int lept_document_parse(lept_document* d, const char* json, size_t len) {
+    assert(d != NULL);
+    lept_document_reset(d);
+    return lept_parse_root(&d->root, json, len, 0, &d->allocator, d->upstream);
 }
 
-void lept_set_number(lept_value* v, double n) {
-    lept_free(v);
-    v->u.n = n;
-    v->type = LEPT_NUMBER;
+int lept_document_parse_indexed(lept_document* d, const char* json, size_t len) {
+    assert(d != NULL);
+    lept_document_reset(d);
+    return lept_parse_indexed_root(&d->root, json, len, 0, &d->allocator, d->upstream);
 }
 
-const char* lept_get_string(const lept_value* v) {
-    assert(v != NULL && v->type == LEPT_STRING);
-    return v->u.s.s;
+void lept_document_copy(lept_document* d, lept_value* dst, const lept_value* src) {
+    lept_copy_a(&d->allocator, dst, src);
 }
 
-size_t lept_get_string_length(const lept_value* v) {
-    assert(v != NULL && v->type == LEPT_STRING);
-    return v->u.s.len;
+void lept_document_set_string(lept_document* d, lept_value* v, const char* s, size_t len) {
+    lept_set_string_a(&d->allocator, v, s, len);
 }
 
-void lept_set_string(lept_value* v, const char* s, size_t len) {
-    assert(v != NULL && (s != NULL || len == 0));
-    lept_free(v);
-    v->u.s.s = (char*)malloc(len + 1);
-    memcpy(v->u.s.s, s, len);
-    v->u.s.s[len] = '\0';
-    v->u.s.len = len;
-    v->type = LEPT_STRING;
+void lept_document_set_array(lept_document* d, lept_value* v, size_t capacity) {
+    lept_set_array_a(&d->allocator, v, capacity);
 }
 
-void lept_set_array(lept_value* v, size_t capacity) {
-    assert(v != NULL);
-    lept_free(v);
-    v->type = LEPT_ARRAY;
-    v->u.a.size = 0;
-    v->u.a.capacity = capacity;
-    v->u.a.e = capacity > 0 ? (lept_value*)malloc(capacity * sizeof(lept_value)) : NULL;
+void lept_document_reserve_array(lept_document* d, lept_value* v, size_t capacity) {
+    lept_reserve_array_a(&d->allocator, v, capacity);
 }
 
-size_t lept_get_array_size(const lept_value* v) {
-    assert(v != NULL && v->type == LEPT_ARRAY);
-    return v->u.a.size;
+lept_value* lept_document_pushback_array_element(lept_document* d, lept_value* v) {
+    return lept_pushback_array_element_a(&d->allocator, v);
 }
 
-size_t lept_get_array_capacity(const lept_value* v) {
-    assert(v != NULL && v->type == LEPT_ARRAY);
-    return v->u.a.capacity;
+lept_value* lept_document_insert_array_element(lept_document* d, lept_value* v, size_t index) {
+    return lept_insert_array_element_a(&d->allocator, v, index);
 }
 
-void lept_reserve_array(lept_value* v, size_t capacity) {
-    assert(v != NULL && v->type == LEPT_ARRAY);
-    if (v->u.a.capacity < capacity) {
-        v->u.a.capacity = capacity;
-        v->u.a.e = (lept_value*)realloc(v->u.a.e, capacity * sizeof(lept_value));
-    }
+void lept_document_set_object(lept_document* d, lept_value* v, size_t capacity) {
+    lept_set_object_a(&d->allocator, v, capacity);
+    v->flags |= LEPT_FLAG_INTERNED;
 }
 
-void lept_shrink_array(lept_value* v) {
-    assert(v != NULL && v->type == LEPT_ARRAY);
-    if (v->u.a.capacity > v->u.a.size) {
-        v->u.a.capacity = v->u.a.size;
-        v->u.a.e = (lept_value*)realloc(v->u.a.e, v->u.a.capacity * sizeof(lept_value));
-    }
+void lept_document_reserve_object(lept_document* d, lept_value* v, size_t capacity) {
+    lept_reserve_object_a(&d->allocator, v, capacity);
 }
 
-void lept_clear_array(lept_value* v) {
-    assert(v != NULL && v->type == LEPT_ARRAY);
-    lept_erase_array_element(v, 0, v->u.a.size);
+lept_value* lept_document_set_object_value(lept_document* d, lept_value* v, const char* key, size_t klen) {
+    assert(d != NULL && v != NULL && v->type == LEPT_OBJECT && key != NULL);
+    assert(v->flags & LEPT_FLAG_ARENA);
+    return lept_append_object_member(&d->allocator, v, lept_intern(d, key, klen), klen);
 }
 
-lept_value* lept_get_array_element(lept_value* v, size_t index) {
-    assert(v != NULL && v->type == LEPT_ARRAY);
-    assert(index < v->u.a.size);
-    return &v->u.a.e[index];
+const char* lept_document_intern(lept_document* d, const char* key, size_t klen) {
+    assert(d != NULL && key != NULL);
+    return lept_intern(d, key, klen);
 }
 
-lept_value* lept_pushback_array_element(lept_value* v) {
-    assert(v != NULL && v->type == LEPT_ARRAY);
-    if (v->u.a.size == v->u.a.capacity)
-        lept_reserve_array(v, v->u.a.capacity == 0 ? 1 : v->u.a.capacity * 2);
-    lept_init(&v->u.a.e[v->u.a.size]);
-    return &v->u.a.e[v->u.a.size++];
+#if defined(LEPT_NO_THREADS)
+typedef int lept_thread;
+#define LEPT_LOCK(l)            ((void)0)
+#define LEPT_UNLOCK(l)          ((void)0)
+#define LEPT_WAIT(l)            assert(0)
+#define LEPT_BROADCAST(l)       ((void)0)
+#elif defined(_WIN32)
+typedef HANDLE lept_thread;
+#define LEPT_LOCK(l)            AcquireSRWLockExclusive(&(l)->lock)
+#define LEPT_UNLOCK(l)          ReleaseSRWLockExclusive(&(l)->lock)
+#define LEPT_WAIT(l)            SleepConditionVariableSRW(&(l)->cond, &(l)->lock, INFINITE, 0)
+#define LEPT_BROADCAST(l)       WakeAllConditionVariable(&(l)->cond)
+#else
+typedef pthread_t lept_thread;
+#define LEPT_LOCK(l)            pthread_mutex_lock(&(l)->lock)
+#define LEPT_UNLOCK(l)          pthread_mutex_unlock(&(l)->lock)
+#define LEPT_WAIT(l)            pthread_cond_wait(&(l)->cond, &(l)->lock)
+#define LEPT_BROADCAST(l)       pthread_cond_broadcast(&(l)->cond)
+#endif
+
+typedef struct {
+    size_t offset;
+    int ret;
+    lept_value v;
+}lept_line;
+
+/* One chunk's records, with their values in the chunk's own region */
+typedef struct {
+    lept_document d;
+    lept_line* lines;
+    size_t count, capacity;
+    char* stack;
+    size_t stack_size;
+    int done;
+}lept_lines_slot;
+
+/*
+ * Chunk i goes to slot i % window, and is taken once chunk i - window has been delivered,
+ * so at most window chunks are held at a time.
+ */
+typedef struct {
+    const lept_allocator* a;    /* upstream of the slots' regions, and for their lines */
+    const char* json;
+    size_t len, chunks;
+    size_t next;                /* the first chunk nobody has taken */
+    size_t delivered;           /* the chunks handed to the callback */
+    size_t window;
+    int stop;
+    lept_lines_slot* slots;
+#if defined(LEPT_NO_THREADS)
+#elif defined(_WIN32)
+    SRWLOCK lock;
+    CONDITION_VARIABLE cond;
+#else
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+#endif
+}lept_lines;
+
+/* Chunk i starts at the line after the one around byte i * LEPT_PARSE_LINES_CHUNK - 1. */
+static size_t lept_lines_start(const lept_lines* l, size_t i) {
+    size_t at = i * LEPT_PARSE_LINES_CHUNK;
+    const char* p;
+    if (i == 0)
+        return 0;
+    if (i >= l->chunks)
+        return l->len;
+    p = (const char*)memchr(l->json + at - 1, '\n', l->len - at + 1);
+    return p != NULL ? (size_t)(p + 1 - l->json) : l->len;
 }
 
-void lept_popback_array_element(lept_value* v) {
-    assert(v != NULL && v->type == LEPT_ARRAY && v->u.a.size > 0);
-    lept_free(&v->u.a.e[--v->u.a.size]);
+static void lept_lines_parse(lept_lines* l, size_t i) {
+    lept_lines_slot* s = &l->slots[i % l->window];
+    size_t start = lept_lines_start(l, i), end = lept_lines_start(l, i + 1);
+    lept_many it;
+    lept_document_reset(&s->d);
+    it = lept_parse_many_a(&s->d.allocator, l->json + start, end > start ? end - start : 0);
+    it.stack = s->stack;
+    it.stack_size = s->stack_size;
+    for (s->count = 0; ; s->count++) {
+        lept_line* r;
+        if (s->count == s->capacity) {
+            size_t old = s->capacity;
+            s->capacity = old == 0 ? 64 : old + (old >> 1);
+            s->lines = (lept_line*)lept_resize(l->a, s->lines, old * sizeof(lept_line), s->capacity * sizeof(lept_line));
+        }
+        r = &s->lines[s->count];
+        if ((r->ret = lept_next(&it, &r->v)) == LEPT_PARSE_END)
+            break;
+        r->offset = start + it.offset;
+    }
+    s->stack = it.stack;
+    s->stack_size = it.stack_size;
 }
 
-lept_value* lept_insert_array_element(lept_value* v, size_t index) {
-    assert(v != NULL && v->type == LEPT_ARRAY && index <= v->u.a.size);
-    /* \todo */
-    /*鵱ǰǲѾ ǵĻΪԭ2*/ 
-    if (v->u.a.capacity == v->u.a.size)
-        lept_reserve_array(v, v->u.a.capacity == 0 ? 1 : v->u.a.capacity * 2);
-    v->u.a.size++;
-    size_t i = v->u.a.size;
-    for (; i > index; --i) {
-        lept_move(&v->u.a.e[i], &v->u.a.e[i - 1]);
+/* Takes and parses chunks until there are none left, or the window is full and wait is 0. */
+static void lept_lines_work(lept_lines* l, int wait) {
+    size_t i;
+    for (;;) {
+        while (!l->stop && l->next < l->chunks && l->next >= l->delivered + l->window) {
+            if (!wait)
+                return;
+            LEPT_WAIT(l);
+        }
+        if (l->stop || l->next == l->chunks)
+            return;
+        i = l->next++;
+        LEPT_UNLOCK(l);
+        lept_lines_parse(l, i);
+        LEPT_LOCK(l);
+        l->slots[i % l->window].done = 1;
+        LEPT_BROADCAST(l);
+        if (!wait)
+            return;
     }
-    return &v->u.a.e[index];
 }
 
-void lept_erase_array_element(lept_value* v, size_t index, size_t count) {
-    assert(v != NULL && v->type == LEPT_ARRAY && index + count <= v->u.a.size);
-    /* \todo */
-    size_t i = 0;
-    size_t corr_item_loc = index + count;
-    /**/ 
-    for (; i < count; ++i) {
-        lept_free(&v->u.a.e[index]);
-        index++;
+#if defined(LEPT_NO_THREADS)
+#elif defined(_WIN32)
+static DWORD WINAPI lept_lines_worker(LPVOID arg) {
+    lept_lines* l = (lept_lines*)arg;
+    LEPT_LOCK(l);
+    lept_lines_work(l, 1);
+    LEPT_UNLOCK(l);
+    return 0;
+}
+#else
+static void* lept_lines_worker(void* arg) {
+    lept_lines* l = (lept_lines*)arg;
+    LEPT_LOCK(l);
+    lept_lines_work(l, 1);
+    LEPT_UNLOCK(l);
+    return NULL;
+}
+#endif
+
+int lept_parse_lines_a(const lept_allocator* a, const char* json, size_t len, unsigned threads, int (*record)(void* ctx, size_t offset, int ret, lept_value* v), void* ctx) {
+    lept_lines l;
+    lept_thread* workers;
+    unsigned t, started = 0;
+    size_t i, j;
+    int ret = LEPT_PARSE_OK;
+    assert(json != NULL && threads > 0 && record != NULL);
+#if defined(LEPT_NO_THREADS)
+    threads = 1;
+#elif defined(_WIN32)
+    InitializeSRWLock(&l.lock);
+    InitializeConditionVariable(&l.cond);
+#else
+    pthread_mutex_init(&l.lock, NULL);
+    pthread_cond_init(&l.cond, NULL);
+#endif
+    l.a = LEPT_STACK_ALLOCATOR(a);
+    l.json = json;
+    l.len = len;
+    l.chunks = (len + LEPT_PARSE_LINES_CHUNK - 1) / LEPT_PARSE_LINES_CHUNK;
+    l.next = l.delivered = 0;
+    l.window = 2 * (size_t)threads;
+    l.stop = 0;
+    l.slots = (lept_lines_slot*)lept_alloc(l.a, l.window * sizeof(lept_lines_slot));
+    for (i = 0; i < l.window; i++) {
+        lept_document_init_a(&l.slots[i].d, l.a);
+        l.slots[i].lines = NULL;
+        l.slots[i].count = l.slots[i].capacity = 0;
+        l.slots[i].stack = NULL;
+        l.slots[i].stack_size = 0;
+        l.slots[i].done = 0;
+    }
+    workers = (lept_thread*)lept_alloc(l.a, threads * sizeof(lept_thread));
+    /* the calling thread takes chunks as well, so it goes on with fewer workers if some fail to start */
+    for (t = 1; t < threads && l.chunks > 1; t++) {
+#if defined(LEPT_NO_THREADS)
+#elif defined(_WIN32)
+        if ((workers[started] = CreateThread(NULL, 0, lept_lines_worker, &l, 0, NULL)) != NULL)
+            started++;
+#else
+        if (pthread_create(&workers[started], NULL, lept_lines_worker, &l) == 0)
+            started++;
+#endif
+    }
+
+    LEPT_LOCK(&l);
+    for (i = 0; i < l.chunks && ret == LEPT_PARSE_OK; i++) {
+        lept_lines_slot* s = &l.slots[i % l.window];
+        /* the chunk that is due may be waiting for a thread, so help rather than wait */
+        while (!s->done) {
+            if (l.next < l.chunks && l.next < l.delivered + l.window)
+                lept_lines_work(&l, 0);
+            else
+                LEPT_WAIT(&l);
+        }
+        LEPT_UNLOCK(&l);
+        for (j = 0; j < s->count; j++)
+            if (!record(ctx, s->lines[j].offset, s->lines[j].ret, &s->lines[j].v)) {
+                ret = LEPT_PARSE_STOPPED;
+                break;
+            }
+        LEPT_LOCK(&l);
+        s->done = 0;
+        l.delivered++;
+        LEPT_BROADCAST(&l);
+    }
+    l.stop = 1;
+    LEPT_BROADCAST(&l);
+    LEPT_UNLOCK(&l);
+
+    for (t = 0; t < started; t++) {
+#if defined(LEPT_NO_THREADS)
+#elif defined(_WIN32)
+        WaitForSingleObject(workers[t], INFINITE);
+        CloseHandle(workers[t]);
+#else
+        pthread_join(workers[t], NULL);
+#endif
     }
-    /*֮ҪѺǰ*/ 
-    while(count != 0 && corr_item_loc < v->u.a.size){
-        lept_type type = v->u.a.e[corr_item_loc].type;
-        lept_move(&v->u.a.e[corr_item_loc - count], &v->u.a.e[corr_item_loc]);
-        corr_item_loc++;
+#if !defined(LEPT_NO_THREADS) && !defined(_WIN32)
+    pthread_cond_destroy(&l.cond);
+    pthread_mutex_destroy(&l.lock);
+#endif
+    for (i = 0; i < l.window; i++) {
+        lept_document_free(&l.slots[i].d);
+        lept_release(l.a, l.slots[i].lines, l.slots[i].capacity * sizeof(lept_line));
+        lept_release(l.a, l.slots[i].stack, l.slots[i].stack_size);
     }
-    v->u.a.size -= count;
+    lept_release(l.a, l.slots, l.window * sizeof(lept_lines_slot));
+    lept_release(l.a, workers, threads * sizeof(lept_thread));
+    return ret;
 }
 
-void lept_set_object(lept_value* v, size_t capacity) {
-    assert(v != NULL);
-    lept_free(v);
-    v->type = LEPT_OBJECT;
-    v->u.o.size = 0;
-    v->u.o.capacity = capacity;
-    v->u.o.m = capacity > 0 ? (lept_member*)malloc(capacity * sizeof(lept_member)) : NULL;
+int lept_parse_lines(const char* json, size_t len, unsigned threads, int (*record)(void* ctx, size_t offset, int ret, lept_value* v), void* ctx) {
+    return lept_parse_lines_a(NULL, json, len, threads, record, ctx);
 }
 
-size_t lept_get_object_size(const lept_value* v) {
-    assert(v != NULL && v->type == LEPT_OBJECT);
-    return v->u.o.size;
+void lept_tape_init_a(lept_tape* t, const lept_allocator* a) {
+    assert(t != NULL);
+    t->entries = NULL;
+    t->size = t->capacity = 0;
+    t->strings = NULL;
+    t->strings_size = t->strings_capacity = 0;
+    t->allocator = a;
 }
 
-size_t lept_get_object_capacity(const lept_value* v) {
-    assert(v != NULL && v->type == LEPT_OBJECT);
-    /* \todo */
-    /*ֱӷcapacity*/ 
-    return v->u.o.capacity;
+void lept_tape_init(lept_tape* t) {
+    lept_tape_init_a(t, NULL);
 }
 
-void lept_reserve_object(lept_value* v, size_t capacity) {
-    assert(v != NULL && v->type == LEPT_OBJECT);
-    /* \todo */
-    /* ·JSONĿռ */ 
-    /* ȱȽϵǰĿռ¿ռĴСϵ */ 
-    if (v->u.o.capacity < capacity) {
-        v->u.o.capacity = capacity;
-        v->u.o.m = (lept_member*)realloc(v->u.o.m, v->u.o.capacity * sizeof(lept_member));
-    }
+void lept_tape_free(lept_tape* t) {
+    assert(t != NULL);
+    if (t->entries != NULL)
+        lept_release(t->allocator, t->entries, t->capacity * sizeof(uint64_t));
+    if (t->strings != NULL)
+        lept_release(t->allocator, t->strings, t->strings_capacity);
+    lept_tape_init_a(t, t->allocator);
 }
 
-void lept_shrink_object(lept_value* v) {
-    assert(v != NULL && v->type == LEPT_OBJECT);
-    /* \todo */
-    /*ʱռ*/ 
-    /*Ƚ϶ЧԪĴСϵ*/ 
-    if (v->u.o.capacity > v->u.o.size) {
-        v->u.o.capacity = v->u.o.size;
-        v->u.o.m = (lept_member*)realloc(v->u.o.m, v->u.o.capacity * sizeof(lept_member));
-    }
+#define LEPT_TAPE_AT(c)         ((c).tape->entries[(c).index])
+
+static lept_cursor lept_cursor_at(const lept_tape* t, size_t index) {
+    lept_cursor c;
+    c.tape = t;
+    c.index = index;
+    return c;
 }
 
-/*ݹն*/ 
-void lept_clear_object(lept_value* v) {
-    assert(v != NULL && v->type == LEPT_OBJECT);
-    /* \todo */
-    size_t i = 0;
-    for (; i < v->u.o.size; i++) {
-        free(v->u.o.m[i].k);
-        lept_free(&v->u.o.m[i].v);
+/* The entry after the value at i */
+static size_t lept_tape_skip(const lept_tape* t, size_t i) {
+    uint64_t e = t->entries[i];
+    switch (LEPT_TAPE_TYPE(e)) {
+        case LEPT_ARRAY:
+        case LEPT_OBJECT:  return LEPT_TAPE_PAYLOAD(e) + 1;
+        case LEPT_NUMBER:  return i + 2;
+        default:           return i + 1;
     }
-    v->u.o.size = 0;
 }
 
-const char* lept_get_object_key(const lept_value* v, size_t index) {
-    assert(v != NULL && v->type == LEPT_OBJECT);
-    assert(index < v->u.o.size);
-    return v->u.o.m[index].k;
+/* The entry of the index-th element, or the key of the index-th member */
+static size_t lept_tape_child(lept_cursor c, lept_type type, size_t index) {
+    size_t i = c.index + 1;
+    assert(lept_tape_get_type(c) == type);
+    assert(index < LEPT_TAPE_PAYLOAD(c.tape->entries[LEPT_TAPE_PAYLOAD(LEPT_TAPE_AT(c))]));
+    for (; index > 0; index--)
+        i = lept_tape_skip(c.tape, type == LEPT_OBJECT ? i + 1 : i);
+    return i;
 }
 
-size_t lept_get_object_key_length(const lept_value* v, size_t index) {
-    assert(v != NULL && v->type == LEPT_OBJECT);
-    assert(index < v->u.o.size);
-    return v->u.o.m[index].klen;
+static const char* lept_tape_string_at(const lept_tape* t, size_t i, size_t* len) {
+    const char* p = t->strings + LEPT_TAPE_PAYLOAD(t->entries[i]);
+    uint32_t n;
+    memcpy(&n, p, sizeof(n));
+    *len = n;
+    return p + sizeof(n);
 }
 
-lept_value* lept_get_object_value(lept_value* v, size_t index) {
-    assert(v != NULL && v->type == LEPT_OBJECT);
-    assert(index < v->u.o.size);
-    return &v->u.o.m[index].v;
+lept_cursor lept_tape_root(const lept_tape* t) {
+    assert(t != NULL && t->size > 0);
+    return lept_cursor_at(t, 0);
 }
 
-size_t lept_find_object_index(const lept_value* v, const char* key, size_t klen) {
+lept_cursor lept_tape_next(lept_cursor c) {
     size_t i;
-    assert(v != NULL && v->type == LEPT_OBJECT && key != NULL);
-    for (i = 0; i < v->u.o.size; i++)
-        if (v->u.o.m[i].klen == klen && memcmp(v->u.o.m[i].k, key, klen) == 0)
-            return i;
-    return LEPT_KEY_NOT_EXIST;
+    assert(c.tape != NULL && c.index < c.tape->size);
+    i = lept_tape_skip(c.tape, c.index);
+    if (i == c.tape->size || (LEPT_TAPE_TAG(c.tape->entries[i]) & LEPT_TAPE_CLOSE))
+        return lept_cursor_at(NULL, 0);
+    return lept_cursor_at(c.tape, LEPT_TAPE_TAG(c.tape->entries[i]) & LEPT_TAPE_KEY ? i + 1 : i);
 }
 
-lept_value* lept_find_object_value(lept_value* v, const char* key, size_t klen) {
-    size_t index = lept_find_object_index(v, key, klen);
-    return index != LEPT_KEY_NOT_EXIST ? &v->u.o.m[index].v : NULL;
+lept_type lept_tape_get_type(lept_cursor c) {
+    assert(c.tape != NULL && c.index < c.tape->size);
+    return LEPT_TAPE_TYPE(LEPT_TAPE_AT(c));
 }
 
-/*Ҫһvalue*/ 
-/*ͬ  Լ ֵһ*/ 
-lept_value* lept_set_object_value(lept_value* v, const char* key, size_t klen) {
-    assert(v != NULL && v->type == LEPT_OBJECT && key != NULL);
-    /* \todo */
-    size_t index = 0;
-    if (v->u.o.capacity == v->u.o.size) {
-        lept_reserve_object(v, v->u.o.capacity == 0 ? 1 : v->u.o.capacity * 2);
+int lept_tape_get_boolean(lept_cursor c) {
+    lept_type type = lept_tape_get_type(c);
+    assert(type == LEPT_TRUE || type == LEPT_FALSE);
+    return type == LEPT_TRUE;
+}
+
+double lept_tape_get_number(lept_cursor c) {
+    const uint64_t* e = &LEPT_TAPE_AT(c);
+    double n;
+    int64_t i;
+    assert(lept_tape_get_type(c) == LEPT_NUMBER);
+    if (LEPT_TAPE_TAG(e[0]) & LEPT_TAPE_INT64) {
+        memcpy(&i, e + 1, sizeof(i));
+        return (double)i;
     }
-    index += v->u.o.size;
-    v->u.o.m[index].k = (char*)malloc(klen + 1);
-    memcpy(v->u.o.m[index].k, key, klen);
-    v->u.o.m[index].klen = klen;
-    v->u.o.m[index].k[klen] = '\0';
-    v->u.o.size++;
-    return &v->u.o.m[index].v;
+    memcpy(&n, e + 1, sizeof(n));
+    return n;
 }
 
-void lept_remove_object_value(lept_value* v, size_t index) {
-    assert(v != NULL && v->type == LEPT_OBJECT && index < v->u.o.size);
-    /* \todo */
-    lept_free(&v->u.o.m[index].v);
-    if (index < v->u.o.size - 1) {
-        size_t next = index + 1;
-        while (next < v->u.o.size) {
-            memcpy(v->u.o.m[index].k, v->u.o.m[next].k, v->u.o.m[next].klen);
-            lept_move(&v->u.o.m[index].v, &v->u.o.m[next].v);
-            ++next;
-            ++index;
-        }
-    }
-    /*ͷindexλõԪеļָĿռ*/ 
-    free(v->u.o.m[index].k);
-    v->u.o.m[index].k = NULL;
-    v->u.o.size--;
+int lept_tape_is_int64(lept_cursor c) {
+    return lept_tape_get_type(c) == LEPT_NUMBER && (LEPT_TAPE_TAG(LEPT_TAPE_AT(c)) & LEPT_TAPE_INT64);
+}
+
+int64_t lept_tape_get_int64(lept_cursor c) {
+    int64_t i;
+    assert(lept_tape_is_int64(c));
+    memcpy(&i, &LEPT_TAPE_AT(c) + 1, sizeof(i));
+    return i;
+}
+
+const char* lept_tape_get_string(lept_cursor c) {
+    size_t len;
+    assert(lept_tape_get_type(c) == LEPT_STRING);
+    return lept_tape_string_at(c.tape, c.index, &len);
+}
+
+size_t lept_tape_get_string_length(lept_cursor c) {
+    size_t len;
+    assert(lept_tape_get_type(c) == LEPT_STRING);
+    lept_tape_string_at(c.tape, c.index, &len);
+    return len;
+}
+
+size_t lept_tape_get_array_size(lept_cursor c) {
+    assert(lept_tape_get_type(c) == LEPT_ARRAY);
+    return LEPT_TAPE_PAYLOAD(c.tape->entries[LEPT_TAPE_PAYLOAD(LEPT_TAPE_AT(c))]);
+}
+
+/* Skips the elements before index, so walks in order are better off with lept_tape_next(). */
+lept_cursor lept_tape_get_array_element(lept_cursor c, size_t index) {
+    return lept_cursor_at(c.tape, lept_tape_child(c, LEPT_ARRAY, index));
+}
+
+size_t lept_tape_get_object_size(lept_cursor c) {
+    assert(lept_tape_get_type(c) == LEPT_OBJECT);
+    return LEPT_TAPE_PAYLOAD(c.tape->entries[LEPT_TAPE_PAYLOAD(LEPT_TAPE_AT(c))]);
+}
+
+const char* lept_tape_get_object_key(lept_cursor c, size_t index) {
+    size_t len;
+    return lept_tape_string_at(c.tape, lept_tape_child(c, LEPT_OBJECT, index), &len);
+}
+
+size_t lept_tape_get_object_key_length(lept_cursor c, size_t index) {
+    size_t len;
+    lept_tape_string_at(c.tape, lept_tape_child(c, LEPT_OBJECT, index), &len);
+    return len;
+}
+
+lept_cursor lept_tape_get_object_value(lept_cursor c, size_t index) {
+    return lept_cursor_at(c.tape, lept_tape_child(c, LEPT_OBJECT, index) + 1);
+}
+
+/* The entry of the first member's key that matches, or 0, which is never a key */
+static size_t lept_tape_find(lept_cursor c, const char* key, size_t klen, size_t* index) {
+    size_t n, i, len;
+    assert(lept_tape_get_type(c) == LEPT_OBJECT && key != NULL);
+    n = lept_tape_get_object_size(c);
+    for (*index = 0, i = c.index + 1; *index < n; ++*index, i = lept_tape_skip(c.tape, i + 1)) {
+        const char* k = lept_tape_string_at(c.tape, i, &len);
+        if (len == klen && memcmp(k, key, klen) == 0)
+            return i;
+    }
+    return 0;
+}
+
+size_t lept_tape_find_object_index(lept_cursor c, const char* key, size_t klen) {
+    size_t index;
+    return lept_tape_find(c, key, klen, &index) != 0 ? index : LEPT_KEY_NOT_EXIST;
+}
+
+lept_cursor lept_tape_find_object_value(lept_cursor c, const char* key, size_t klen) {
+    size_t index, i = lept_tape_find(c, key, klen, &index);
+    return i != 0 ? lept_cursor_at(c.tape, i + 1) : lept_cursor_at(NULL, 0);
 }
@@ -2,6 +2,7 @@
 #define LEPTJSON_H__
 
 #include <stddef.h> /* size_t */
+#include <stdint.h> /* int64_t */
 
 typedef enum { LEPT_NULL, LEPT_FALSE, LEPT_TRUE, LEPT_NUMBER, LEPT_STRING, LEPT_ARRAY, LEPT_OBJECT } lept_type;
 
@@ -12,12 +13,16 @@ typedef struct lept_member lept_member;
 
 struct lept_value {
     union {
-        struct { lept_member* m; size_t size, capacity; }o; /* object: members, member count, capacity */
-        struct { lept_value*  e; size_t size, capacity; }a; /* array:  elements, element count, capacity */
-        struct { char* s; size_t len; }s;                   /* string: null-terminated string, string length */
-        double n;                                           /* number */
+        lept_member* m;     /* object: members, capacity kept in front of them */
+        lept_value*  e;     /* array:  elements, capacity kept in front of them */
+        char* s;            /* string: null-terminated string */
+        double n;           /* number */
+        int64_t i;          /* number stored as integer */
     }u;
-    lept_type type;
+    uint32_t size;          /* member count, element count or string length */
+    char spare[2];          /* short strings use u, size and spare in place, internal */
+    unsigned char type;     /* lept_type */
+    unsigned char flags;    /* storage flags, internal */
 };
 
 struct lept_member {
@@ -25,6 +30,79 @@ struct lept_member {
     lept_value v;           /* member value */
 };
 
+/*
+ * Memory hooks for the *_a functions; passing NULL means malloc(), realloc() and free().
+ * Every call hands back the size the block was requested with. A value built with an
+ * allocator must be changed and freed through *_a functions given the same allocator.
+ * An allocator whose release is NULL is treated as a region: its values are never
+ * released one by one, so lept_free() and the plain setters are safe on them.
+ */
+typedef struct {
+    void* (*alloc)(void* ctx, size_t size);
+    void* (*resize)(void* ctx, void* ptr, size_t old_size, size_t new_size);
+    void  (*release)(void* ctx, void* ptr, size_t size);
+    void* ctx;
+}lept_allocator;
+
+/*
+ * A document owns a tree whose strings, arrays, members and keys are carved out of
+ * a chunked region allocator, so lept_document_free() releases it all in a few calls.
+ * Values in the tree can be read and changed with the lept_* functions that do not
+ * allocate; whatever needs memory goes through the lept_document_* variants below,
+ * or through the *_a functions given &d->allocator.
+ * Object keys that are parsed or set through lept_document_set_object_value() are
+ * interned: equal keys share one buffer, so lept_document_intern() gives a pointer
+ * that lookups match without comparing bytes; objects large enough to be hashed still
+ * hash it.
+ */
+typedef struct lept_chunk lept_chunk;
+
+typedef struct {
+    lept_value root;
+    lept_allocator allocator;       /* the region, must not outlive the document */
+    const lept_allocator* upstream; /* where chunks come from */
+    lept_chunk* chunks;             /* internal */
+    char** keys;                    /* internal, interned keys */
+    size_t key_count, key_buckets;
+}lept_document;
+
+/*
+ * A tape is a read-only, flat form of a parsed value: one array of 64-bit entries in
+ * document order, and one buffer holding the bytes of every string and key. Arrays and
+ * objects record where they end, so a lookup skips over a value without entering it.
+ * A new parse reuses both buffers; lept_tape_free() releases them.
+ * A lept_cursor names a value on a tape. Lookups that find nothing return a cursor
+ * whose tape is NULL. Cursors and strings are valid until the tape is parsed again.
+ */
+typedef struct {
+    uint64_t* entries;              /* internal */
+    size_t size, capacity;
+    char* strings;                  /* internal, string and key bytes */
+    size_t strings_size, strings_capacity;
+    const lept_allocator* allocator;
+}lept_tape;
+
+typedef struct {
+    const lept_tape* tape;
+    size_t index;
+}lept_cursor;
+
+/*
+ * Reads JSON Lines, or JSON texts that are simply concatenated, one value per lept_next()
+ * call until it returns LEPT_PARSE_END. All records share one parse
+ * stack, which lept_many_free() releases. offset is where the last record starts. After
+ * a bad record, reading goes on from the line after the one it starts on.
+ */
+typedef struct {
+    const char* json;
+    size_t len;
+    size_t offset;
+    size_t next;                    /* internal, where the next record is looked for */
+    char* stack;                    /* internal */
+    size_t stack_size;
+    const lept_allocator* allocator;
+}lept_many;
+
 enum {
     LEPT_PARSE_OK = 0,
     LEPT_PARSE_EXPECT_VALUE,
@@ -39,13 +117,126 @@ enum {
     LEPT_PARSE_MISS_COMMA_OR_SQUARE_BRACKET,
     LEPT_PARSE_MISS_KEY,
     LEPT_PARSE_MISS_COLON,
-    LEPT_PARSE_MISS_COMMA_OR_CURLY_BRACKET
+    LEPT_PARSE_MISS_COMMA_OR_CURLY_BRACKET,
+    LEPT_PARSE_TOO_DEEP,
+    LEPT_PARSE_STOPPED,
+    LEPT_PARSE_INVALID_UTF8,
+    LEPT_PARSE_END,
+    LEPT_PARSE_TOO_BIG,
+    LEPT_PARSE_INVALID_POINTER
 };
 
-#define lept_init(v) do { (v)->type = LEPT_NULL; } while(0)
+/*
+ * Callbacks for lept_parse_sax(), each may be NULL to skip the event. Returning 0 stops
+ * the parse with LEPT_PARSE_STOPPED. Strings and keys are decoded but not null-terminated,
+ * and only valid during the call. Integers go to int64 when it is set, otherwise to number.
+ * Events are delivered as the input is read, so a syntax error can follow some of them.
+ */
+typedef struct {
+    int (*null)(void* ctx);
+    int (*boolean)(void* ctx, int b);
+    int (*number)(void* ctx, double n);
+    int (*int64)(void* ctx, int64_t i);
+    int (*string)(void* ctx, const char* s, size_t len);
+    int (*key)(void* ctx, const char* s, size_t len);
+    int (*start_object)(void* ctx);
+    int (*end_object)(void* ctx, size_t count);
+    int (*start_array)(void* ctx);
+    int (*end_array)(void* ctx, size_t count);
+}lept_handler;
+
+/*
+ * A push parser for input that arrives in chunks, which may split any token. Each
+ * lept_stream_feed() returns LEPT_PARSE_OK until an error, which every later call
+ * repeats. lept_stream_finish() parses what remains, stores the value on success,
+ * and frees the stream.
+ */
+typedef struct lept_stream lept_stream;
+
+/*
+ * Writes JSON text piece by piece, without building a lept_value, through a fixed-size
+ * buffer that is handed to write(ctx, s, len) whenever it fills up; write returns 0 on
+ * failure, after which output is dropped and lept_writer_finish() returns 0. Values at
+ * the top level go on separate lines. lept_write_file() writes to the FILE* in ctx.
+ */
+typedef struct lept_writer lept_writer;
+
+/*
+ * A JSON Pointer (RFC 6901) that lept_pointer_compile() has split and unescaped once, to
+ * be looked up in any number of values; lept_pointer_free() releases it.
+ */
+typedef struct lept_pointer lept_pointer;
+
+/*
+ * A JSONPath query (RFC 9535) that lept_path_compile() has turned into a plan once, to be
+ * run on any number of values; lept_path_free() releases it. Filters compare and test
+ * queries and literals, but there are no function extensions such as length().
+ */
+typedef struct lept_path lept_path;
+
+#define lept_init(v) do { (v)->type = LEPT_NULL; (v)->flags = 0; } while(0)
 
 int lept_parse(lept_value* v, const char* json);
+int lept_parse_n(lept_value* v, const char* json, size_t len);
+int lept_parse_insitu(lept_value* v, char* json, size_t len);
+int lept_parse_sax(const char* json, size_t len, const lept_handler* h, void* ctx);
+/*
+ * Parses in two stages: SIMD classification finds every token and checks that the input is
+ * UTF-8, then the tree is built from the token positions. Accepts and builds the same as
+ * lept_parse_n(), with the same errors, except that input which is not valid UTF-8 fails
+ * with LEPT_PARSE_INVALID_UTF8, whatever else is wrong with it.
+ */
+int lept_parse_indexed(lept_value* v, const char* json, size_t len);
+/*
+ * Checks all of json like lept_parse_indexed(), with the same errors, but builds only the
+ * top level: arrays and objects below it keep pointing into json, which must outlive v.
+ * Each is parsed the same way, one level, when an accessor first reaches into it; until
+ * then it is stringified from its input bytes, less whitespace, and copied as a pointer.
+ * lept_parse_lazy_a() keeps a pointer to its allocator to build them with, so that must
+ * outlive v as well.
+ */
+int lept_parse_lazy(lept_value* v, const char* json, size_t len);
+/*
+ * Checks all of json like lept_parse_indexed(), with the same errors, but builds only what
+ * the JSON Pointers (RFC 6901) select, "" being the whole document. Objects keep just the
+ * members on the way to a selected value, arrays keep their elements up to the last one on
+ * the way with null for the rest before it; paths that lead nowhere are left out.
+ * Pointers that lept_pointer_compile() would reject give LEPT_PARSE_INVALID_POINTER.
+ */
+int lept_parse_select(lept_value* v, const char* json, size_t len, const char* const* pointers, size_t n);
+lept_many lept_parse_many(const char* json, size_t len);
+int lept_next(lept_many* it, lept_value* v);
+void lept_many_free(lept_many* it);
+/*
+ * Parses JSON Lines on the calling thread and threads - 1 more. The input is cut at newlines
+ * into chunks of about LEPT_PARSE_LINES_CHUNK bytes; each chunk is read like lept_next()
+ * would, into a region of its own, so records must not span lines. record() is called on
+ * the calling thread, for each record in order, with its offset and what lept_next() gave
+ * for it; v lives only until record() returns. Returning 0 stops with LEPT_PARSE_STOPPED.
+ * The allocator of lept_parse_lines_a() backs the regions and the bookkeeping, and is
+ * called from all the threads at once, so it has to be thread-safe unless threads is 1.
+ */
+int lept_parse_lines(const char* json, size_t len, unsigned threads, int (*record)(void* ctx, size_t offset, int ret, lept_value* v), void* ctx);
+
+lept_stream* lept_stream_create(void);
+int lept_stream_feed(lept_stream* s, const char* chunk, size_t len);
+int lept_stream_finish(lept_stream* s, lept_value* v);
+
 char* lept_stringify(const lept_value* v, size_t* length);
+lept_writer* lept_writer_create(int (*write)(void* ctx, const char* s, size_t len), void* ctx);
+int lept_write_file(void* ctx, const char* s, size_t len);
+void lept_writer_start_array(lept_writer* w);
+void lept_writer_end_array(lept_writer* w);
+void lept_writer_start_object(lept_writer* w);
+void lept_writer_end_object(lept_writer* w);
+void lept_writer_key(lept_writer* w, const char* s, size_t len);
+void lept_writer_null(lept_writer* w);
+void lept_writer_boolean(lept_writer* w, int b);
+void lept_writer_number(lept_writer* w, double n);
+void lept_writer_int64(lept_writer* w, int64_t i);
+void lept_writer_string(lept_writer* w, const char* s, size_t len);
+void lept_writer_value(lept_writer* w, const lept_value* v);
+int lept_writer_finish(lept_writer* w);
 
 void lept_copy(lept_value* dst, const lept_value* src);
 void lept_move(lept_value* dst, lept_value* src);
@@ -63,7 +254,16 @@ void lept_set_boolean(lept_value* v, int b);
 
 double lept_get_number(const lept_value* v);
 void lept_set_number(lept_value* v, double n);
+int lept_is_int64(const lept_value* v);
+int64_t lept_get_int64(const lept_value* v);
+void lept_set_int64(lept_value* v, int64_t i);
 
+/*
+ * Short strings are stored inside the value, so the pointer moves along with it.
+ * Strings hold at most UINT32_MAX bytes, and arrays and objects at most UINT32_MAX
+ * elements or members. The parsers return LEPT_PARSE_TOO_BIG for anything longer;
+ * the functions below require it of their arguments.
+ */
 const char* lept_get_string(const lept_value* v);
 size_t lept_get_string_length(const lept_value* v);
 void lept_set_string(lept_value* v, const char* s, size_t len);
@@ -89,9 +289,106 @@ void lept_clear_object(lept_value* v);
 const char* lept_get_object_key(const lept_value* v, size_t index);
 size_t lept_get_object_key_length(const lept_value* v, size_t index);
 lept_value* lept_get_object_value(lept_value* v, size_t index);
+/* Objects of LEPT_OBJECT_INDEX_MIN members or more are hashed on the first lookup, which writes to v. */
 size_t lept_find_object_index(const lept_value* v, const char* key, size_t klen);
 lept_value* lept_find_object_value(lept_value* v, const char* key, size_t klen);
 lept_value* lept_set_object_value(lept_value* v, const char* key, size_t klen);
 void lept_remove_object_value(lept_value* v, size_t index);
 
+/* Returns NULL unless pointer is "" or starts with '/', and '~' is only used in "~0" and "~1". */
+lept_pointer* lept_pointer_compile(const char* pointer);
+void lept_pointer_free(lept_pointer* p);
+/* The value p names in v, or NULL */
+lept_value* lept_pointer_get(lept_value* v, const lept_pointer* p);
+/*
+ * The value p names in v, created as null if it is missing. Nulls on the way become arrays
+ * if the next token is an index or "-", which appends, and objects otherwise; arrays grow
+ * with nulls up to the index. Returns NULL, and changes nothing, if the path has to go
+ * into a scalar, or into an array by a token that is not an index.
+ */
+lept_value* lept_pointer_set(lept_value* v, const lept_pointer* p);
+
+/* Returns NULL if query is not a well-formed JSONPath query. */
+lept_path* lept_path_compile(const char* query);
+void lept_path_free(lept_path* p);
+/*
+ * Stores the first max values that p selects in v into out, in the order RFC 9535 gives,
+ * and returns how many it selects, which may be more than max. The values are v's own.
+ * It does not allocate, apart from hashing large objects and parsing lazy containers.
+ */
+size_t lept_path_query(const lept_path* p, lept_value* v, lept_value** out, size_t max);
+
+int lept_parse_a(const lept_allocator* a, lept_value* v, const char* json, size_t len);
+int lept_parse_insitu_a(const lept_allocator* a, lept_value* v, char* json, size_t len);
+int lept_parse_indexed_a(const lept_allocator* a, lept_value* v, const char* json, size_t len);
+int lept_parse_lazy_a(const lept_allocator* a, lept_value* v, const char* json, size_t len);
+int lept_parse_select_a(const lept_allocator* a, lept_value* v, const char* json, size_t len, const char* const* pointers, size_t n);
+int lept_parse_sax_a(const lept_allocator* a, const char* json, size_t len, const lept_handler* h, void* ctx);
+lept_many lept_parse_many_a(const lept_allocator* a, const char* json, size_t len);
+int lept_parse_lines_a(const lept_allocator* a, const char* json, size_t len, unsigned threads, int (*record)(void* ctx, size_t offset, int ret, lept_value* v), void* ctx);
+lept_stream* lept_stream_create_a(const lept_allocator* a);
+lept_writer* lept_writer_create_a(const lept_allocator* a, int (*write)(void* ctx, const char* s, size_t len), void* ctx);
+char* lept_stringify_a(const lept_allocator* a, const lept_value* v, size_t* length);
+void lept_copy_a(const lept_allocator* a, lept_value* dst, const lept_value* src);
+void lept_move_a(const lept_allocator* a, lept_value* dst, lept_value* src);
+void lept_free_a(const lept_allocator* a, lept_value* v);
+void lept_set_string_a(const lept_allocator* a, lept_value* v, const char* s, size_t len);
+void lept_set_array_a(const lept_allocator* a, lept_value* v, size_t capacity);
+void lept_reserve_array_a(const lept_allocator* a, lept_value* v, size_t capacity);
+void lept_shrink_array_a(const lept_allocator* a, lept_value* v);
+void lept_clear_array_a(const lept_allocator* a, lept_value* v);
+lept_value* lept_pushback_array_element_a(const lept_allocator* a, lept_value* v);
+void lept_popback_array_element_a(const lept_allocator* a, lept_value* v);
+lept_value* lept_insert_array_element_a(const lept_allocator* a, lept_value* v, size_t index);
+void lept_erase_array_element_a(const lept_allocator* a, lept_value* v, size_t index, size_t count);
+void lept_set_object_a(const lept_allocator* a, lept_value* v, size_t capacity);
+void lept_reserve_object_a(const lept_allocator* a, lept_value* v, size_t capacity);
+void lept_shrink_object_a(const lept_allocator* a, lept_value* v);
+void lept_clear_object_a(const lept_allocator* a, lept_value* v);
+lept_value* lept_set_object_value_a(const lept_allocator* a, lept_value* v, const char* key, size_t klen);
+void lept_remove_object_value_a(const lept_allocator* a, lept_value* v, size_t index);
+lept_pointer* lept_pointer_compile_a(const lept_allocator* a, const char* pointer);
+lept_value* lept_pointer_set_a(const lept_allocator* a, lept_value* v, const lept_pointer* p);
+lept_path* lept_path_compile_a(const lept_allocator* a, const char* query);
+
+void lept_document_init(lept_document* d);
+void lept_document_init_a(lept_document* d, const lept_allocator* upstream);
+void lept_document_free(lept_document* d);
+int lept_document_parse(lept_document* d, const char* json, size_t len);
+int lept_document_parse_indexed(lept_document* d, const char* json, size_t len);
+void lept_document_copy(lept_document* d, lept_value* dst, const lept_value* src);
+void lept_document_set_string(lept_document* d, lept_value* v, const char* s, size_t len);
+void lept_document_set_array(lept_document* d, lept_value* v, size_t capacity);
+void lept_document_reserve_array(lept_document* d, lept_value* v, size_t capacity);
+lept_value* lept_document_pushback_array_element(lept_document* d, lept_value* v);
+lept_value* lept_document_insert_array_element(lept_document* d, lept_value* v, size_t index);
+void lept_document_set_object(lept_document* d, lept_value* v, size_t capacity);
+void lept_document_reserve_object(lept_document* d, lept_value* v, size_t capacity);
+lept_value* lept_document_set_object_value(lept_document* d, lept_value* v, const char* key, size_t klen);
+const char* lept_document_intern(lept_document* d, const char* key, size_t klen);
+
+void lept_tape_init(lept_tape* t);
+void lept_tape_init_a(lept_tape* t, const lept_allocator* a);
+void lept_tape_free(lept_tape* t);
+/* Accepts the same input as lept_parse_indexed(), with the same errors. */
+int lept_tape_parse(lept_tape* t, const char* json, size_t len);
+lept_cursor lept_tape_root(const lept_tape* t);
+/* Steps from an element, or a member's value, to the next one in its container in O(1). */
+lept_cursor lept_tape_next(lept_cursor c);
+lept_type lept_tape_get_type(lept_cursor c);
+int lept_tape_get_boolean(lept_cursor c);
+double lept_tape_get_number(lept_cursor c);
+int lept_tape_is_int64(lept_cursor c);
+int64_t lept_tape_get_int64(lept_cursor c);
+const char* lept_tape_get_string(lept_cursor c);
+size_t lept_tape_get_string_length(lept_cursor c);
+size_t lept_tape_get_array_size(lept_cursor c);
+lept_cursor lept_tape_get_array_element(lept_cursor c, size_t index);
+size_t lept_tape_get_object_size(lept_cursor c);
+const char* lept_tape_get_object_key(lept_cursor c, size_t index);
+size_t lept_tape_get_object_key_length(lept_cursor c, size_t index);
+lept_cursor lept_tape_get_object_value(lept_cursor c, size_t index);
+size_t lept_tape_find_object_index(lept_cursor c, const char* key, size_t klen);
+lept_cursor lept_tape_find_object_value(lept_cursor c, const char* key, size_t klen);
+
 #endif /* LEPTJSON_H__ */
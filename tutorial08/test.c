@@ -2,6 +2,7 @@
 #define _CRTDBG_MAP_ALLOC
 #include <crtdbg.h>
 #endif
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -24,6 +25,7 @@ static int test_pass = 0;
 
 #define EXPECT_EQ_INT(expect, actual) EXPECT_EQ_BASE((expect) == (actual), expect, actual, "%d")
 #define EXPECT_EQ_DOUBLE(expect, actual) EXPECT_EQ_BASE((expect) == (actual), expect, actual, "%.17g")
+#define EXPECT_EQ_INT64(expect, actual) EXPECT_EQ_BASE((expect) == (actual), (int64_t)expect, (int64_t)actual, "%" PRId64)
 #define EXPECT_EQ_STRING(expect, actual, alength) \
     EXPECT_EQ_BASE(sizeof(expect) - 1 == alength && memcmp(expect, actual, alength + 1) == 0, expect, actual, "%s")
 #define EXPECT_TRUE(actual) EXPECT_EQ_BASE((actual) != 0, "true", "false", "%s")
@@ -102,6 +104,61 @@ static void test_parse_number() {
     TEST_NUMBER(-2.2250738585072014e-308, "-2.2250738585072014e-308");
     TEST_NUMBER( 1.7976931348623157e+308, "1.7976931348623157e+308");  /* Max double */
     TEST_NUMBER(-1.7976931348623157e+308, "-1.7976931348623157e+308");
+
+    /* correct rounding on the fast paths and the fallback */
+    TEST_NUMBER(0.1, "0.1");
+    TEST_NUMBER(1e23, "1e23");                                      /* halfway case */
+    TEST_NUMBER(9007199254740992.0, "9007199254740993");            /* 2^53 + 1, ties to even */
+    TEST_NUMBER(7.2057594037927933e+16, "7.2057594037927933e+16");  /* mantissa rounds up to 2^53 */
+    TEST_NUMBER(2.2250738585072011e-308, "2.2250738585072011e-308");
+    TEST_NUMBER(123456789.12345678, "123456789.12345678");
+    TEST_NUMBER(3.1415926535897932, "3.14159265358979323846264338327950288419716939937510");
+    TEST_NUMBER(1.2345678901234567e+29, "123456789012345678901234567890");
+    TEST_NUMBER(1e-45, "0.000000000000000000000000000000000000000000001");
+    TEST_NUMBER(1.0, "1.00000000000000011102230246251565404236316680908203125");  /* halfway, ties to even */
+    TEST_NUMBER(1.0000000000000002, "1.00000000000000011102230246251565404236316680908203126");
+    TEST_NUMBER(0.0, "1e-400");
+    TEST_NUMBER(0.0, "0e400");
+}
+
+#define TEST_INT64(expect, json)\
+    do {\
+        lept_value v;\
+        lept_init(&v);\
+        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, json));\
+        EXPECT_EQ_INT(LEPT_NUMBER, lept_get_type(&v));\
+        EXPECT_TRUE(lept_is_int64(&v));\
+        EXPECT_EQ_INT64(expect, lept_get_int64(&v));\
+        lept_free(&v);\
+    } while(0)
+
+#define TEST_NOT_INT64(json)\
+    do {\
+        lept_value v;\
+        lept_init(&v);\
+        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, json));\
+        EXPECT_EQ_INT(LEPT_NUMBER, lept_get_type(&v));\
+        EXPECT_FALSE(lept_is_int64(&v));\
+        lept_free(&v);\
+    } while(0)
+
+static void test_parse_int64() {
+    TEST_INT64(0, "0");
+    TEST_INT64(1, "1");
+    TEST_INT64(-1, "-1");
+    TEST_INT64(1234567890, "1234567890");
+    TEST_INT64(INT64_C(9007199254740993), "9007199254740993");  /* 2^53 + 1, not representable as double */
+    TEST_INT64(INT64_MAX, "9223372036854775807");
+    TEST_INT64(INT64_MIN, "-9223372036854775808");
+
+    TEST_NOT_INT64("-0");
+    TEST_NOT_INT64("1.0");
+    TEST_NOT_INT64("1e2");
+    TEST_NOT_INT64("9223372036854775808");
+    TEST_NOT_INT64("-9223372036854775809");
+    TEST_NOT_INT64("12345678901234567890");
+    TEST_NUMBER(9223372036854775808.0, "9223372036854775808");
+    TEST_NUMBER(1234567890.0, "1234567890");
 }
 
 #define TEST_STRING(expect, json)\
@@ -125,6 +182,14 @@ static void test_parse_string() {
     TEST_STRING("\xE2\x82\xAC", "\"\\u20AC\""); /* Euro sign U+20AC */
     TEST_STRING("\xF0\x9D\x84\x9E", "\"\\uD834\\uDD1E\"");  /* G clef sign U+1D11E */
     TEST_STRING("\xF0\x9D\x84\x9E", "\"\\ud834\\udd1e\"");  /* G clef sign U+1D11E */
+
+    /* plain runs longer than one SIMD block, with escapes in between */
+    TEST_STRING("0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ",
+        "\"0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ\"");
+    TEST_STRING("0123456789abcdefghijklmnopqrstuvwxyz\nABCDEFGHIJKLMNOPQRSTUVWXYZ\t",
+        "\"0123456789abcdefghijklmnopqrstuvwxyz\\nABCDEFGHIJKLMNOPQRSTUVWXYZ\\t\"");
+    TEST_STRING("\"0123456789abcdefghijklmnopqrstuvwxyz\\\xE2\x82\xAC""0123456789abcdefghijklmnopqrstuvwxyz",
+        "\"\\\"0123456789abcdefghijklmnopqrstuvwxyz\\\\\\u20AC0123456789abcdefghijklmnopqrstuvwxyz\"");
 }
 
 static void test_parse_array() {
@@ -226,6 +291,39 @@ static void test_parse_object() {
     lept_free(&v);
 }
 
+static void test_parse_whitespace() {
+    static const char ws[] = " \t\n\r";
+    char json[256];
+    lept_value v;
+    size_t i, n;
+
+    /* runs of every length around the 16 and 32 byte SIMD widths, before and after the value */
+    for (n = 0; n < 80; n++) {
+        for (i = 0; i < n; i++)
+            json[i] = ws[i % 4];
+        memcpy(json + n, "[1,", 3);
+        for (i = 0; i < n; i++)
+            json[n + 3 + i] = ws[(i + 1) % 4];
+        memcpy(json + n + 3 + n, "2]", 3);
+        lept_init(&v);
+        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, json));
+        EXPECT_EQ_INT(LEPT_ARRAY, lept_get_type(&v));
+        EXPECT_EQ_SIZE_T(2, lept_get_array_size(&v));
+        lept_free(&v);
+    }
+
+    lept_init(&v);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v,
+        "{\n"
+        "                                        \"a\" : [\n"
+        "\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t1\r\n"
+        "                                        ]\n"
+        "}                                                                    "));
+    EXPECT_EQ_INT(LEPT_OBJECT, lept_get_type(&v));
+    EXPECT_EQ_SIZE_T(1, lept_get_object_size(&v));
+    lept_free(&v);
+}
+
 #define TEST_PARSE_ERROR(error, json)\
     do {\
         lept_value v;\
@@ -262,6 +360,7 @@ static void test_parse_invalid_value() {
 
 static void test_parse_root_not_singular() {
     TEST_PARSE_ERROR(LEPT_PARSE_ROOT_NOT_SINGULAR, "null x");
+    TEST_PARSE_ERROR(LEPT_PARSE_ROOT_NOT_SINGULAR, "null                                  \t\t\t\t\t\t x");
 
     /* invalid number */
     TEST_PARSE_ERROR(LEPT_PARSE_ROOT_NOT_SINGULAR, "0123"); /* after zero should be '.' or nothing */
@@ -277,6 +376,8 @@ static void test_parse_number_too_big() {
 static void test_parse_miss_quotation_mark() {
     TEST_PARSE_ERROR(LEPT_PARSE_MISS_QUOTATION_MARK, "\"");
     TEST_PARSE_ERROR(LEPT_PARSE_MISS_QUOTATION_MARK, "\"abc");
+    TEST_PARSE_ERROR(LEPT_PARSE_MISS_QUOTATION_MARK, "\"0123456789abcdefghijklmnopqrstuvwxyz");
+    TEST_PARSE_ERROR(LEPT_PARSE_MISS_QUOTATION_MARK, "\"0123456789abcdefghijklmnopqrstuvwxyz\\n0123456789abcdefghijklmnopqrstuvwxyz");
 }
 
 static void test_parse_invalid_string_escape() {
@@ -289,6 +390,8 @@ static void test_parse_invalid_string_escape() {
 static void test_parse_invalid_string_char() {
     TEST_PARSE_ERROR(LEPT_PARSE_INVALID_STRING_CHAR, "\"\x01\"");
     TEST_PARSE_ERROR(LEPT_PARSE_INVALID_STRING_CHAR, "\"\x1F\"");
+    TEST_PARSE_ERROR(LEPT_PARSE_INVALID_STRING_CHAR, "\"0123456789abcdefghijklmnopqrstuvwxyz\x01\"");
+    TEST_PARSE_ERROR(LEPT_PARSE_INVALID_STRING_CHAR, "\"0123456789abcdefghijklmnopqrstuvwxyz\\t0123456789abcdefghijklmnopqrstuvwxyz\x1F\"");
 }
 
 static void test_parse_invalid_unicode_hex() {
@@ -345,14 +448,201 @@ static void test_parse_miss_comma_or_curly_bracket() {
     TEST_PARSE_ERROR(LEPT_PARSE_MISS_COMMA_OR_CURLY_BRACKET, "{\"a\":{}");
 }
 
+#ifndef LEPT_PARSE_MAX_DEPTH
+#define LEPT_PARSE_MAX_DEPTH 1024
+#endif
+
+/* depth levels of open, then close; `open` and `close` may each consist of several bytes */
+static char* nest(size_t depth, const char* open, const char* inner, const char* close) {
+    size_t lo = strlen(open), li = strlen(inner), lc = strlen(close), i;
+    char* json = (char*)malloc(depth * (lo + lc) + li + 1), * p = json;
+    for (i = 0; i < depth; i++, p += lo)
+        memcpy(p, open, lo);
+    memcpy(p, inner, li);
+    p += li;
+    for (i = 0; i < depth; i++, p += lc)
+        memcpy(p, close, lc);
+    *p = '\0';
+    return json;
+}
+
+static void test_parse_too_deep() {
+    lept_value v;
+    char* json;
+    size_t i;
+
+    json = nest(LEPT_PARSE_MAX_DEPTH, "[", "\"x\"", "]");
+    lept_init(&v);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, json));
+    free(json);
+    {
+        lept_value* e = &v;
+        for (i = 1; i < LEPT_PARSE_MAX_DEPTH; i++) {
+            EXPECT_EQ_SIZE_T(1, lept_get_array_size(e));
+            e = lept_get_array_element(e, 0);
+        }
+        EXPECT_EQ_STRING("x", lept_get_string(lept_get_array_element(e, 0)), 1);
+    }
+    lept_free(&v);
+
+    json = nest(LEPT_PARSE_MAX_DEPTH / 2 - 1, "{\"a\":[1,", "[{}]", "]}");
+    lept_init(&v);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, json));
+    EXPECT_EQ_INT(LEPT_OBJECT, lept_get_type(&v));
+    lept_free(&v);
+    free(json);
+
+    json = nest(LEPT_PARSE_MAX_DEPTH + 1, "[", "", "]");
+    TEST_PARSE_ERROR(LEPT_PARSE_TOO_DEEP, json);
+    free(json);
+    json = nest(LEPT_PARSE_MAX_DEPTH / 2 + 1, "{\"a\":[\"s\",", "", "]}");
+    TEST_PARSE_ERROR(LEPT_PARSE_TOO_DEEP, json);
+    free(json);
+
+    /* far beyond any native stack */
+    json = nest(1000000, "[", "", "");
+    TEST_PARSE_ERROR(LEPT_PARSE_TOO_DEEP, json);
+    free(json);
+
+    /* errors deep inside unwind every level */
+    json = nest(LEPT_PARSE_MAX_DEPTH / 2, "{\"k\\n\":[\"s\",", "tru", "]}");
+    TEST_PARSE_ERROR(LEPT_PARSE_INVALID_VALUE, json);
+    free(json);
+    json = nest(LEPT_PARSE_MAX_DEPTH / 2, "[{\"k\":\"v\",\"a\":", "1", "} ]");
+    json[strlen(json) - 1] = '}';
+    TEST_PARSE_ERROR(LEPT_PARSE_MISS_COMMA_OR_SQUARE_BRACKET, json);
+    free(json);
+}
+
+/* Parses a copy in an exactly sized heap block, so reading past len is caught by sanitizers. */
+static int parse_n(lept_value* v, const char* json, size_t len) {
+    char* buf = (char*)malloc(len ? len : 1);
+    int ret;
+    memcpy(buf, json, len);
+    ret = lept_parse_n(v, buf, len);
+    free(buf);
+    return ret;
+}
+
+#define TEST_PARSE_N(error, type, json, len)\
+    do {\
+        lept_value v;\
+        lept_init(&v);\
+        EXPECT_EQ_INT(error, parse_n(&v, json, len));\
+        EXPECT_EQ_INT(type, lept_get_type(&v));\
+        lept_free(&v);\
+    } while(0)
+
+static void test_parse_length() {
+    lept_value v;
+
+    /* the buffer ends inside or right after the value, with no terminator */
+    TEST_PARSE_N(LEPT_PARSE_OK, LEPT_TRUE, "true", 4);
+    TEST_PARSE_N(LEPT_PARSE_OK, LEPT_NUMBER, "12345678901234567890", 20);
+    TEST_PARSE_N(LEPT_PARSE_OK, LEPT_NUMBER, "1.5e3", 5);
+    TEST_PARSE_N(LEPT_PARSE_OK, LEPT_NUMBER, "1234", 3);
+    TEST_PARSE_N(LEPT_PARSE_OK, LEPT_STRING, "\"abc\"", 5);
+    TEST_PARSE_N(LEPT_PARSE_OK, LEPT_ARRAY, "[1,2]garbage", 5);
+    TEST_PARSE_N(LEPT_PARSE_OK, LEPT_OBJECT, "{\"a\":[]} \t", 10);
+    TEST_PARSE_N(LEPT_PARSE_EXPECT_VALUE, LEPT_NULL, "", 0);
+    TEST_PARSE_N(LEPT_PARSE_EXPECT_VALUE, LEPT_NULL, "null", 0);
+    TEST_PARSE_N(LEPT_PARSE_EXPECT_VALUE, LEPT_NULL, "  ", 2);
+    TEST_PARSE_N(LEPT_PARSE_INVALID_VALUE, LEPT_NULL, "true", 3);
+    TEST_PARSE_N(LEPT_PARSE_INVALID_VALUE, LEPT_NULL, "1.5", 2);
+    TEST_PARSE_N(LEPT_PARSE_INVALID_VALUE, LEPT_NULL, "1e5", 2);
+    TEST_PARSE_N(LEPT_PARSE_INVALID_VALUE, LEPT_NULL, "-1", 1);
+    TEST_PARSE_N(LEPT_PARSE_MISS_QUOTATION_MARK, LEPT_NULL, "\"abc\"", 4);
+    TEST_PARSE_N(LEPT_PARSE_INVALID_STRING_ESCAPE, LEPT_NULL, "\"\\n\"", 2);
+    TEST_PARSE_N(LEPT_PARSE_INVALID_UNICODE_HEX, LEPT_NULL, "\"\\u1234\"", 6);
+    TEST_PARSE_N(LEPT_PARSE_INVALID_UNICODE_SURROGATE, LEPT_NULL, "\"\\uD834\\uDD1E\"", 7);
+    TEST_PARSE_N(LEPT_PARSE_INVALID_UNICODE_SURROGATE, LEPT_NULL, "\"\\uD834\\uDD1E\"", 8);
+    TEST_PARSE_N(LEPT_PARSE_MISS_COMMA_OR_SQUARE_BRACKET, LEPT_NULL, "[1,2]", 4);
+    TEST_PARSE_N(LEPT_PARSE_MISS_COMMA_OR_CURLY_BRACKET, LEPT_NULL, "{\"a\":1}", 6);
+    TEST_PARSE_N(LEPT_PARSE_MISS_COLON, LEPT_NULL, "{\"a\":1}", 4);
+    TEST_PARSE_N(LEPT_PARSE_MISS_KEY, LEPT_NULL, "{\"a\":1,\"b\":2}", 7);
+
+    /* embedded NULs are ordinary bytes */
+    TEST_PARSE_N(LEPT_PARSE_ROOT_NOT_SINGULAR, LEPT_NULL, "null\0", 5);
+    TEST_PARSE_N(LEPT_PARSE_INVALID_VALUE, LEPT_NULL, "\0", 1);
+    TEST_PARSE_N(LEPT_PARSE_INVALID_VALUE, LEPT_NULL, "[\0]", 3);
+    TEST_PARSE_N(LEPT_PARSE_INVALID_STRING_CHAR, LEPT_NULL, "\"a\0b\"", 5);
+
+    lept_init(&v);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, parse_n(&v, "\"Hello\\u0000World\"", 18));
+    EXPECT_EQ_STRING("Hello\0World", lept_get_string(&v), lept_get_string_length(&v));
+    lept_free(&v);
+}
+
+#define TEST_PARSE_INSITU(error, json)\
+    do {\
+        char buf[] = json;\
+        lept_value v;\
+        lept_init(&v);\
+        EXPECT_EQ_INT(error, lept_parse_insitu(&v, buf, sizeof(buf) - 1));\
+        EXPECT_EQ_INT(LEPT_NULL, lept_get_type(&v));\
+    } while(0)
+
+static void test_parse_insitu() {
+    char json[] = "{\"k\\u0065y\":[\"a\\tb\",\"plain\",\"\\uD834\\uDD1E\"],\"n\":1.5,\"\":\"\"} ";
+    lept_value v, c;
+    lept_value* a;
+    const char* s;
+    size_t i;
+
+    lept_init(&v);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_insitu(&v, json, sizeof(json) - 1));
+    EXPECT_EQ_INT(LEPT_OBJECT, lept_get_type(&v));
+    EXPECT_EQ_SIZE_T(3, lept_get_object_size(&v));
+    EXPECT_EQ_STRING("key", lept_get_object_key(&v, 0), lept_get_object_key_length(&v, 0));
+    EXPECT_TRUE(lept_get_object_key(&v, 0) >= json && lept_get_object_key(&v, 0) < json + sizeof(json));
+    a = lept_get_object_value(&v, 0);
+    EXPECT_EQ_SIZE_T(3, lept_get_array_size(a));
+    EXPECT_EQ_STRING("a\tb", lept_get_string(lept_get_array_element(a, 0)), lept_get_string_length(lept_get_array_element(a, 0)));
+    EXPECT_EQ_STRING("plain", lept_get_string(lept_get_array_element(a, 1)), lept_get_string_length(lept_get_array_element(a, 1)));
+    EXPECT_EQ_STRING("\xF0\x9D\x84\x9E", lept_get_string(lept_get_array_element(a, 2)), lept_get_string_length(lept_get_array_element(a, 2)));
+    for (i = 0; i < 3; i++) {
+        s = lept_get_string(lept_get_array_element(a, i));
+        EXPECT_TRUE(s >= json && s < json + sizeof(json));
+    }
+    EXPECT_EQ_STRING("", lept_get_object_key(&v, 2), lept_get_object_key_length(&v, 2));
+
+    /* copies own their strings and outlive the buffer */
+    lept_init(&c);
+    lept_copy(&c, &v);
+    EXPECT_TRUE(lept_is_equal(&c, &v));
+
+    /* mutating a borrowed object mixes in owned keys and values */
+    lept_set_string(lept_set_object_value(&v, "new", 3), "value", 5);
+    lept_remove_object_value(&v, 0);
+    EXPECT_EQ_SIZE_T(3, lept_get_object_size(&v));
+    EXPECT_EQ_STRING("n", lept_get_object_key(&v, 0), lept_get_object_key_length(&v, 0));
+    EXPECT_TRUE(lept_find_object_value(&v, "new", 3) != NULL);
+    memset(json, 'x', sizeof(json) - 1);
+    EXPECT_EQ_STRING("n", lept_get_object_key(&v, 0), lept_get_object_key_length(&v, 0));
+    lept_free(&v);
+
+    a = lept_find_object_value(&c, "key", 3);
+    EXPECT_TRUE(a != NULL);
+    EXPECT_EQ_STRING("a\tb", lept_get_string(lept_get_array_element(a, 0)), lept_get_string_length(lept_get_array_element(a, 0)));
+    lept_clear_object(&c);
+    lept_free(&c);
+
+    TEST_PARSE_INSITU(LEPT_PARSE_ROOT_NOT_SINGULAR, "\"a\\nb\" x");
+    TEST_PARSE_INSITU(LEPT_PARSE_MISS_COMMA_OR_CURLY_BRACKET, "{\"a\\n\":\"b\" \"c\":1}");
+    TEST_PARSE_INSITU(LEPT_PARSE_INVALID_STRING_ESCAPE, "[\"ok\",\"\\x\"]");
+    TEST_PARSE_INSITU(LEPT_PARSE_MISS_QUOTATION_MARK, "{\"a\":\"b");
+}
+
 static void test_parse() {
     test_parse_null();
     test_parse_true();
     test_parse_false();
     test_parse_number();
+    test_parse_int64();
     test_parse_string();
     test_parse_array();
     test_parse_object();
+    test_parse_whitespace();
 
     test_parse_expect_value();
     test_parse_invalid_value();
@@ -367,6 +657,9 @@ static void test_parse() {
     test_parse_miss_key();
     test_parse_miss_colon();
     test_parse_miss_comma_or_curly_bracket();
+    test_parse_too_deep();
+    test_parse_length();
+    test_parse_insitu();
 }
 
 #define TEST_ROUNDTRIP(json)\
@@ -393,16 +686,32 @@ static void test_stringify_number() {
     TEST_ROUNDTRIP("1e+20");
     TEST_ROUNDTRIP("1.234e+20");
     TEST_ROUNDTRIP("1.234e-20");
+    TEST_ROUNDTRIP("0.1"); /* shortest digits that parse back, not "%.17g" */
+    TEST_ROUNDTRIP("0.3");
+    TEST_ROUNDTRIP("0.0001");
+    TEST_ROUNDTRIP("1e-05");
+    TEST_ROUNDTRIP("123.456");
+    TEST_ROUNDTRIP("1e+23");
+    TEST_ROUNDTRIP("1.2345678901234566e+17");
+    TEST_ROUNDTRIP("0.30000000000000004"); /* 0.1 + 0.2 */
 
     TEST_ROUNDTRIP("1.0000000000000002"); /* the smallest number > 1 */
-    TEST_ROUNDTRIP("4.9406564584124654e-324"); /* minimum denormal */
-    TEST_ROUNDTRIP("-4.9406564584124654e-324");
-    TEST_ROUNDTRIP("2.2250738585072009e-308");  /* Max subnormal double */
-    TEST_ROUNDTRIP("-2.2250738585072009e-308");
+    TEST_ROUNDTRIP("5e-324"); /* minimum denormal */
+    TEST_ROUNDTRIP("-5e-324");
+    TEST_ROUNDTRIP("1e-323");
+    TEST_ROUNDTRIP("2.225073858507201e-308");  /* Max subnormal double */
+    TEST_ROUNDTRIP("-2.225073858507201e-308");
     TEST_ROUNDTRIP("2.2250738585072014e-308");  /* Min normal positive double */
     TEST_ROUNDTRIP("-2.2250738585072014e-308");
     TEST_ROUNDTRIP("1.7976931348623157e+308");  /* Max double */
     TEST_ROUNDTRIP("-1.7976931348623157e+308");
+
+    TEST_ROUNDTRIP("10");
+    TEST_ROUNDTRIP("-100");
+    TEST_ROUNDTRIP("1234567890123456789");
+    TEST_ROUNDTRIP("9007199254740993");
+    TEST_ROUNDTRIP("9223372036854775807");
+    TEST_ROUNDTRIP("-9223372036854775808");
 }
 
 static void test_stringify_string() {
@@ -453,6 +762,12 @@ static void test_equal() {
     TEST_EQUAL("null", "0", 0);
     TEST_EQUAL("123", "123", 1);
     TEST_EQUAL("123", "456", 0);
+    TEST_EQUAL("123", "123.0", 1);
+    TEST_EQUAL("123", "1.23e2", 1);
+    TEST_EQUAL("123", "123.5", 0);
+    TEST_EQUAL("9007199254740993", "9007199254740992", 0);
+    TEST_EQUAL("9007199254740993", "9007199254740993.0", 0);  /* the double rounds to 2^53 */
+    TEST_EQUAL("9223372036854775807", "9223372036854775808", 0);
     TEST_EQUAL("\"abc\"", "\"abc\"", 1);
     TEST_EQUAL("\"abc\"", "\"abcd\"", 0);
     TEST_EQUAL("[]", "[]", 1);
@@ -474,10 +789,11 @@ static void test_equal() {
 static void test_copy() {
     lept_value v1, v2;
     lept_init(&v1);
-    lept_parse(&v1, "{\"t\":true,\"f\":false,\"n\":null,\"d\":1.5,\"a\":[1,2,3]}");
+    lept_parse(&v1, "{\"t\":true,\"f\":false,\"n\":null,\"d\":1.5,\"i\":9007199254740993,\"a\":[1,2,3]}");
     lept_init(&v2);
     lept_copy(&v2, &v1);
     EXPECT_TRUE(lept_is_equal(&v2, &v1));
+    EXPECT_EQ_INT64(INT64_C(9007199254740993), lept_get_int64(lept_find_object_value(&v2, "i", 1)));
     lept_free(&v1);
     lept_free(&v2);
 }
@@ -536,6 +852,22 @@ static void test_access_number() {
     lept_set_string(&v, "a", 1);
     lept_set_number(&v, 1234.5);
     EXPECT_EQ_DOUBLE(1234.5, lept_get_number(&v));
+    EXPECT_FALSE(lept_is_int64(&v));
+    lept_free(&v);
+}
+
+static void test_access_int64() {
+    lept_value v;
+    lept_init(&v);
+    lept_set_string(&v, "a", 1);
+    lept_set_int64(&v, INT64_MIN);
+    EXPECT_EQ_INT(LEPT_NUMBER, lept_get_type(&v));
+    EXPECT_TRUE(lept_is_int64(&v));
+    EXPECT_EQ_INT64(INT64_MIN, lept_get_int64(&v));
+    lept_set_int64(&v, 42);
+    EXPECT_EQ_DOUBLE(42.0, lept_get_number(&v));
+    lept_set_number(&v, 42.0);
+    EXPECT_FALSE(lept_is_int64(&v));
     lept_free(&v);
 }
 
@@ -549,6 +881,52 @@ static void test_access_string() {
     lept_free(&v);
 }
 
+/* Short strings live inside the value, longer ones on the heap; both must behave the same. */
+static void test_access_string_inline() {
+    static const char text[] = "0123456789abcdefghijklmnopqrstuvwxyz\0ABC";
+    char json[64];
+    lept_value v, w, u;
+    size_t len;
+    lept_init(&v);
+    lept_init(&w);
+    lept_init(&u);
+    /* 8 payload bytes, a 32-bit size, two spare bytes, type and flags; the first 14 hold short strings */
+    EXPECT_EQ_SIZE_T(16, sizeof(lept_value));
+    for (len = 0; len < sizeof(text); len++) {
+        lept_set_string(&v, text, len);
+        EXPECT_EQ_SIZE_T(len, lept_get_string_length(&v));
+        EXPECT_TRUE(memcmp(text, lept_get_string(&v), len) == 0 && lept_get_string(&v)[len] == '\0');
+        lept_copy(&w, &v);
+        EXPECT_TRUE(lept_is_equal(&v, &w));
+        lept_move(&u, &w);
+        EXPECT_EQ_SIZE_T(len, lept_get_string_length(&u));
+        EXPECT_TRUE(memcmp(text, lept_get_string(&u), len) == 0 && lept_get_string(&u)[len] == '\0');
+        lept_set_string(&w, text, len + 1);
+        EXPECT_FALSE(lept_is_equal(&v, &w));
+        lept_swap(&u, &w);
+        EXPECT_EQ_SIZE_T(len + 1, lept_get_string_length(&u));
+        EXPECT_TRUE(lept_is_equal(&v, &w));
+
+        /* an in-situ string borrows its bytes and still equals the copy */
+        json[0] = '"';
+        memcpy(json + 1, text, len);
+        json[len + 1] = '"';
+        if (memchr(text, '\0', len) == NULL) {
+            lept_free(&w);
+            EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_insitu(&w, json, len + 2));
+            EXPECT_TRUE(lept_is_equal(&v, &w));
+        }
+    }
+    lept_set_string(&v, "abc", 3);
+    lept_set_string(&v, text, 30); /* an inline string is replaced by a heap one */
+    EXPECT_EQ_SIZE_T(30, lept_get_string_length(&v));
+    lept_set_string(&v, "xyz", 3);
+    EXPECT_EQ_STRING("xyz", lept_get_string(&v), lept_get_string_length(&v));
+    lept_free(&v);
+    lept_free(&w);
+    lept_free(&u);
+}
+
 static void test_access_array() {
     lept_value a, e;
     size_t i, j;
@@ -559,6 +937,8 @@ static void test_access_array() {
         lept_set_array(&a, j);
         EXPECT_EQ_SIZE_T(0, lept_get_array_size(&a));
         EXPECT_EQ_SIZE_T(j, lept_get_array_capacity(&a));
+        lept_erase_array_element(&a, 0, 0);
+        EXPECT_EQ_SIZE_T(0, lept_get_array_size(&a));
         for (i = 0; i < 10; i++) {
             lept_init(&e);
             lept_set_number(&e, i);
@@ -702,13 +1082,1368 @@ static void test_access_object() {
 
 }
 
+/* Large objects are looked up through a hash index; results must match a linear scan. */
+static void test_access_object_index() {
+    static const char json[] =
+        "{\"a\":0,\"b\":1,\"c\":2,\"d\":3,\"e\":4,\"f\":5,\"g\":6,\"h\":7,\"i\":8,"
+        "\"j\":9,\"k\":10,\"l\":11,\"m\":12,\"n\":13,\"o\":14,\"p\":15,\"q\":16,\"a\":17}";
+    lept_value o, o2, *pv;
+    lept_document d;
+    char key[16];
+    size_t i, n = 1000;
+
+    lept_init(&o);
+    lept_set_object(&o, 0);
+    for (i = 0; i < n; i++) {
+        sprintf(key, "k%d", (int)i);
+        lept_set_number(lept_set_object_value(&o, key, strlen(key)), (double)i);
+        if (i % 100 == 0) /* index built part way, then kept up to date */
+            EXPECT_EQ_SIZE_T(i, lept_find_object_index(&o, key, strlen(key)));
+    }
+    for (i = 0; i < n; i++) {
+        sprintf(key, "k%d", (int)i);
+        EXPECT_EQ_SIZE_T(i, lept_find_object_index(&o, key, strlen(key)));
+    }
+    EXPECT_EQ_SIZE_T(LEPT_KEY_NOT_EXIST, lept_find_object_index(&o, "k1000", 5));
+    EXPECT_EQ_SIZE_T(LEPT_KEY_NOT_EXIST, lept_find_object_index(&o, "", 0));
+
+    /* removal keeps insertion order and shifts later members down */
+    lept_remove_object_value(&o, lept_find_object_index(&o, "k10", 3));
+    EXPECT_EQ_SIZE_T(LEPT_KEY_NOT_EXIST, lept_find_object_index(&o, "k10", 3));
+    EXPECT_EQ_SIZE_T(10, lept_find_object_index(&o, "k11", 3));
+    EXPECT_EQ_STRING("k11", lept_get_object_key(&o, 10), lept_get_object_key_length(&o, 10));
+    EXPECT_EQ_SIZE_T(998, lept_find_object_index(&o, "k999", 4));
+
+    /* the first of duplicate keys is found */
+    lept_set_number(lept_set_object_value(&o, "k5", 2), -1.0);
+    EXPECT_EQ_SIZE_T(5, lept_find_object_index(&o, "k5", 2));
+    lept_remove_object_value(&o, 5);
+    EXPECT_EQ_SIZE_T(n - 2, lept_find_object_index(&o, "k5", 2));
+
+    /* equality does not depend on member order */
+    lept_init(&o2);
+    lept_set_object(&o2, 0);
+    for (i = lept_get_object_size(&o); i-- > 0; )
+        lept_copy(lept_set_object_value(&o2, lept_get_object_key(&o, i), lept_get_object_key_length(&o, i)), lept_get_object_value(&o, i));
+    EXPECT_TRUE(lept_is_equal(&o, &o2));
+    lept_set_number(lept_find_object_value(&o2, "k500", 4), -500.0);
+    EXPECT_FALSE(lept_is_equal(&o, &o2));
+    lept_free(&o2);
+
+    lept_shrink_object(&o);
+    EXPECT_EQ_SIZE_T(99, lept_find_object_index(&o, "k101", 4));
+    lept_clear_object(&o);
+    EXPECT_EQ_SIZE_T(LEPT_KEY_NOT_EXIST, lept_find_object_index(&o, "k101", 4));
+    for (i = 0; i < 20; i++) {
+        sprintf(key, "%d", (int)i);
+        lept_set_null(lept_set_object_value(&o, key, strlen(key)));
+    }
+    EXPECT_EQ_SIZE_T(19, lept_find_object_index(&o, "19", 2));
+    lept_free(&o);
+
+    /* parsed and region-allocated objects */
+    lept_document_init(&d);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_document_parse(&d, json, strlen(json)));
+    pv = lept_find_object_value(&d.root, "q", 1);
+    EXPECT_EQ_INT(16, (int)lept_get_int64(pv));
+    EXPECT_EQ_INT(0, (int)lept_get_int64(lept_find_object_value(&d.root, "a", 1)));
+    lept_set_null(lept_document_set_object_value(&d, &d.root, "r", 1));
+    EXPECT_EQ_SIZE_T(18, lept_find_object_index(&d.root, "r", 1));
+    lept_document_free(&d);
+}
+
 static void test_access() {
     test_access_null();
     test_access_boolean();
     test_access_number();
+    test_access_int64();
     test_access_string();
+    test_access_string_inline();
     test_access_array();
     test_access_object();
+    test_access_object_index();
+}
+
+static void test_document() {
+    const char* json = "{\"a\":[1,\"two\",{\"b\":null}],\"s\":\"\\u00e9t\\u00e9\",\"n\":-1.5}";
+    lept_document d;
+    lept_value h, *a, *pv;
+    char* out;
+    size_t i;
+
+    lept_document_init(&d);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_document_parse(&d, json, strlen(json)));
+    EXPECT_EQ_INT(LEPT_OBJECT, lept_get_type(&d.root));
+    out = lept_stringify(&d.root, NULL);
+    EXPECT_EQ_STRING("{\"a\":[1,\"two\",{\"b\":null}],\"s\":\"\xC3\xA9t\xC3\xA9\",\"n\":-1.5}", out, strlen(out));
+    free(out);
+
+    /* growing arena containers, mixed with non-allocating lept_* calls */
+    a = lept_find_object_value(&d.root, "a", 1);
+    for (i = 0; i < 100; i++)
+        lept_set_int64(lept_document_pushback_array_element(&d, a), (int64_t)i);
+    EXPECT_EQ_SIZE_T(103, lept_get_array_size(a));
+    lept_document_set_string(&d, lept_document_insert_array_element(&d, a, 0), "first", 5);
+    lept_erase_array_element(a, 1, 3);
+    lept_popback_array_element(a);
+    EXPECT_EQ_SIZE_T(100, lept_get_array_size(a));
+    EXPECT_EQ_STRING("first", lept_get_string(lept_get_array_element(a, 0)), lept_get_string_length(lept_get_array_element(a, 0)));
+    for (i = 1; i < 100; i++)
+        EXPECT_EQ_INT64((int64_t)i - 1, lept_get_int64(lept_get_array_element(a, i)));
+    lept_shrink_array(a);
+    EXPECT_EQ_SIZE_T(100, lept_get_array_capacity(a));
+    lept_erase_array_element(a, 50, 50);
+    lept_shrink_array(a);
+    EXPECT_EQ_SIZE_T(50, lept_get_array_capacity(a));
+    lept_document_reserve_array(&d, a, 200);
+    EXPECT_EQ_SIZE_T(200, lept_get_array_capacity(a));
+    EXPECT_EQ_SIZE_T(50, lept_get_array_size(a));
+    EXPECT_EQ_INT64(48, lept_get_int64(lept_get_array_element(a, 49)));
+
+    pv = lept_document_set_object_value(&d, &d.root, "o", 1);
+    lept_document_set_object(&d, pv, 0);
+    for (i = 0; i < 10; i++) {
+        char key[2] = "a";
+        key[0] += (char)i;
+        lept_set_number(lept_document_set_object_value(&d, pv, key, 1), (double)i);
+    }
+    lept_remove_object_value(pv, 0);
+    EXPECT_EQ_SIZE_T(9, lept_get_object_size(pv));
+    EXPECT_EQ_DOUBLE(9.0, lept_get_number(lept_find_object_value(pv, "j", 1)));
+    lept_set_null(lept_find_object_value(&d.root, "s", 1));
+
+    /* copies in and out of the document */
+    lept_init(&h);
+    lept_parse(&h, "[\"x\",{\"y\":[true]}]");
+    lept_document_copy(&d, lept_document_set_object_value(&d, &d.root, "h", 1), &h);
+    lept_free(&h);
+    lept_copy(&h, &d.root);
+    lept_document_free(&d);
+    pv = lept_find_object_value(&h, "h", 1);
+    EXPECT_TRUE(pv != NULL && lept_get_array_size(pv) == 2);
+    EXPECT_EQ_SIZE_T(9, lept_get_object_size(lept_find_object_value(&h, "o", 1)));
+    lept_free(&h);
+
+    /* reuse, and failed parses */
+    lept_document_init(&d);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_document_parse(&d, json, strlen(json)));
+    EXPECT_EQ_INT(LEPT_PARSE_MISS_COMMA_OR_CURLY_BRACKET, lept_document_parse(&d, "{\"a\":[\"b\"] \"c\"}", 16));
+    EXPECT_EQ_INT(LEPT_NULL, lept_get_type(&d.root));
+    EXPECT_EQ_INT(LEPT_PARSE_ROOT_NOT_SINGULAR, lept_document_parse(&d, "[\"b\"] x", 7));
+    EXPECT_EQ_INT(LEPT_NULL, lept_get_type(&d.root));
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_document_parse(&d, "\"abc\"", 5));
+    EXPECT_EQ_STRING("abc", lept_get_string(&d.root), lept_get_string_length(&d.root));
+    lept_document_free(&d);
+}
+
+/* Counts live bytes and checks that every size handed back matches the size requested. */
+typedef struct {
+    size_t live, calls, mismatches;
+}counting_heap;
+
+static void* counting_alloc(void* ctx, size_t size) {
+    counting_heap* h = (counting_heap*)ctx;
+    size_t* p = (size_t*)malloc(sizeof(size_t) * 2 + size);
+    p[0] = size;
+    h->live += size;
+    h->calls++;
+    return p + 2;
+}
+
+static void* counting_resize(void* ctx, void* ptr, size_t old_size, size_t new_size) {
+    counting_heap* h = (counting_heap*)ctx;
+    size_t* p = ptr != NULL ? (size_t*)ptr - 2 : NULL;
+    if ((p != NULL ? p[0] : 0) != old_size)
+        h->mismatches++;
+    p = (size_t*)realloc(p, sizeof(size_t) * 2 + new_size);
+    p[0] = new_size;
+    h->live += new_size - old_size;
+    h->calls++;
+    return p + 2;
+}
+
+static void counting_release(void* ctx, void* ptr, size_t size) {
+    counting_heap* h = (counting_heap*)ctx;
+    size_t* p = (size_t*)ptr - 2;
+    if (p[0] != size)
+        h->mismatches++;
+    h->live -= size;
+    free(p);
+}
+
+static void test_document_intern() {
+    const char* json = "[{\"id\":1,\"name\":\"a\"},{\"id\":2,\"name\":\"b\"},{\"name\":\"c\",\"id\":3}]";
+    lept_document d;
+    lept_value* r0, * r1, * r2, * o;
+    const char* id;
+    size_t i, j;
+
+    lept_document_init(&d);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_document_parse(&d, json, strlen(json)));
+    r0 = lept_get_array_element(&d.root, 0);
+    r1 = lept_get_array_element(&d.root, 1);
+    r2 = lept_get_array_element(&d.root, 2);
+    EXPECT_TRUE(lept_get_object_key(r0, 0) == lept_get_object_key(r1, 0));
+    EXPECT_TRUE(lept_get_object_key(r0, 0) == lept_get_object_key(r2, 1));
+    EXPECT_TRUE(lept_get_object_key(r0, 1) == lept_get_object_key(r2, 0));
+    id = lept_document_intern(&d, "id", 2);
+    EXPECT_TRUE(id == lept_get_object_key(r0, 0));
+    EXPECT_EQ_STRING("id", id, strlen(id));
+    EXPECT_EQ_SIZE_T(1, lept_find_object_index(r2, id, 2));
+
+    /* keys set through the document are interned too, including in large objects */
+    o = lept_document_pushback_array_element(&d, &d.root);
+    lept_document_set_object(&d, o, 0);
+    for (i = 0; i < 40; i++) {
+        char key[8];
+        sprintf(key, "k%d", (int)i);
+        lept_set_int64(lept_document_set_object_value(&d, o, key, strlen(key)), (int64_t)i);
+    }
+    lept_set_null(lept_document_set_object_value(&d, o, "id", 2));
+    EXPECT_TRUE(lept_get_object_key(o, 40) == id);
+    EXPECT_EQ_SIZE_T(40, lept_find_object_index(o, id, 2));
+    EXPECT_EQ_SIZE_T(39, lept_find_object_index(o, lept_document_intern(&d, "k39", 3), 3));
+    EXPECT_EQ_SIZE_T(LEPT_KEY_NOT_EXIST, lept_find_object_index(o, "k40", 3));
+    /*
+     * a shorter length through an interned key's pointer names a prefix, not the key;
+     * objects of 16 to 35 members put the key on various prefixes' probe paths
+     */
+    for (j = 12; j < 32; j++) {
+        o = lept_document_pushback_array_element(&d, &d.root);
+        lept_document_set_object(&d, o, 0);
+        for (i = 0; i < j; i++) {
+            char key[8];
+            sprintf(key, "f%d", (int)i);
+            lept_set_null(lept_document_set_object_value(&d, o, key, strlen(key)));
+        }
+        for (i = 4; i > 0; i--)
+            lept_set_int64(lept_document_set_object_value(&d, o, "aaaa", i), (int64_t)i);
+        for (i = 1; i <= 4; i++)
+            EXPECT_EQ_SIZE_T(j + 4 - i, lept_find_object_index(o, lept_get_object_key(o, j), i));
+    }
+
+    /* parsing again starts a new set of keys */
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_document_parse(&d, "{\"ab\":1,\"a\":2}", 14));
+    EXPECT_EQ_SIZE_T(1, lept_find_object_index(&d.root, lept_get_object_key(&d.root, 0), 1));
+    EXPECT_EQ_SIZE_T(0, lept_find_object_index(&d.root, lept_get_object_key(&d.root, 0), 2));
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_document_parse(&d, "{\"id\":0,\"x\":{\"id\":1}}", 21));
+    EXPECT_TRUE(lept_get_object_key(&d.root, 0) == lept_get_object_key(lept_get_object_value(&d.root, 1), 0));
+    EXPECT_EQ_INT(1, (int)lept_get_int64(lept_find_object_value(lept_get_object_value(&d.root, 1), "id", 2)));
+    lept_document_free(&d);
+}
+
+static void test_allocator() {
+    const char* json = "{\"a\":[1,\"two\",{\"b\":null}],\"s\":\"x\",\"n\":[]}";
+    counting_heap h = { 0, 0, 0 };
+    lept_allocator a;
+    lept_document d;
+    lept_value v, w, *pv;
+    char* out;
+    size_t i, length;
+
+    a.alloc = counting_alloc;
+    a.resize = counting_resize;
+    a.release = counting_release;
+    a.ctx = &h;
+
+    lept_init(&v);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_a(&a, &v, json, strlen(json)));
+    EXPECT_TRUE(h.calls > 0);
+    pv = lept_find_object_value(&v, "a", 1);
+    for (i = 0; i < 20; i++)
+        lept_set_string_a(&a, lept_pushback_array_element_a(&a, pv), "abc", 3);
+    lept_set_int64(lept_insert_array_element_a(&a, pv, 1), 5);
+    lept_erase_array_element_a(&a, pv, 2, 4);
+    lept_popback_array_element_a(&a, pv);
+    lept_shrink_array_a(&a, pv);
+    lept_set_array_a(&a, lept_set_object_value_a(&a, &v, "e", 1), 8);
+    lept_shrink_array_a(&a, lept_find_object_value(&v, "e", 1));
+    lept_remove_object_value_a(&a, &v, lept_find_object_index(&v, "s", 1));
+    lept_init(&w);
+    lept_copy_a(&a, &w, &v);
+    EXPECT_TRUE(lept_is_equal(&v, &w));
+    lept_clear_array_a(&a, lept_find_object_value(&w, "a", 1));
+    lept_move_a(&a, lept_find_object_value(&v, "n", 1), &w);
+    out = lept_stringify_a(&a, &v, &length);
+    EXPECT_EQ_SIZE_T(strlen(out), length);
+    counting_release(&h, out, length + 1);
+    lept_shrink_object_a(&a, &v);
+    lept_clear_object_a(&a, &v);
+    lept_free_a(&a, &v);
+    EXPECT_EQ_SIZE_T(0, h.live);
+    EXPECT_EQ_SIZE_T(0, h.mismatches);
+
+    EXPECT_EQ_INT(LEPT_PARSE_MISS_COMMA_OR_CURLY_BRACKET, lept_parse_a(&a, &v, "{\"a\":[\"b\"],\"c\":\"d\" 1}", 21));
+    EXPECT_EQ_INT(LEPT_PARSE_ROOT_NOT_SINGULAR, lept_parse_a(&a, &v, "{\"a\":\"b\"} x", 11));
+    EXPECT_EQ_SIZE_T(0, h.live);
+    EXPECT_EQ_SIZE_T(0, h.mismatches);
+
+    /* a document takes its chunks and parse stack from the upstream allocator */
+    h.calls = 0;
+    lept_document_init_a(&d, &a);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_document_parse(&d, json, strlen(json)));
+    EXPECT_TRUE(h.calls > 0);
+    lept_set_string_a(&d.allocator, lept_set_object_value_a(&d.allocator, &d.root, "t", 1), "y", 1);
+    lept_free(lept_find_object_value(&d.root, "a", 1));
+    lept_document_free(&d);
+    EXPECT_EQ_SIZE_T(0, h.live);
+    EXPECT_EQ_SIZE_T(0, h.mismatches);
+}
+
+/* Records SAX events as text, and stops at the event numbered stop_at. */
+typedef struct {
+    char buf[256];
+    size_t len;
+    int events, stop_at;
+}sax_log;
+
+static int sax_put(void* ctx, const char* s, size_t n) {
+    sax_log* l = (sax_log*)ctx;
+    memcpy(l->buf + l->len, s, n);
+    l->buf[l->len += n] = '\0';
+    return ++l->events != l->stop_at;
+}
+
+static int sax_null(void* ctx) { return sax_put(ctx, "n ", 2); }
+static int sax_boolean(void* ctx, int b) { return sax_put(ctx, b ? "t " : "f ", 2); }
+static int sax_start_object(void* ctx) { return sax_put(ctx, "{ ", 2); }
+static int sax_start_array(void* ctx) { return sax_put(ctx, "[ ", 2); }
+
+static int sax_number(void* ctx, double n) {
+    char s[32];
+    sprintf(s, "d%g ", n);
+    return sax_put(ctx, s, strlen(s));
+}
+
+static int sax_int64(void* ctx, int64_t i) {
+    char s[32];
+    sprintf(s, "i%" PRId64 " ", i);
+    return sax_put(ctx, s, strlen(s));
+}
+
+static int sax_string(void* ctx, const char* s, size_t len) {
+    sax_put(ctx, "\"", 1);
+    sax_put(ctx, s, len);
+    ((sax_log*)ctx)->events -= 2;
+    return sax_put(ctx, "\" ", 2);
+}
+
+static int sax_key(void* ctx, const char* s, size_t len) {
+    sax_put(ctx, s, len);
+    ((sax_log*)ctx)->events -= 1;
+    return sax_put(ctx, ": ", 2);
+}
+
+static int sax_end_object(void* ctx, size_t count) {
+    char s[32];
+    sprintf(s, "}%d ", (int)count);
+    return sax_put(ctx, s, strlen(s));
+}
+
+static int sax_end_array(void* ctx, size_t count) {
+    char s[32];
+    sprintf(s, "]%d ", (int)count);
+    return sax_put(ctx, s, strlen(s));
+}
+
+#define TEST_SAX(error, expect, json, stop)\
+    do {\
+        sax_log l;\
+        l.len = 0;\
+        l.buf[0] = '\0';\
+        l.events = 0;\
+        l.stop_at = stop;\
+        EXPECT_EQ_INT(error, lept_parse_sax(json, strlen(json), &h, &l));\
+        EXPECT_EQ_STRING(expect, l.buf, l.len);\
+    } while(0)
+
+static void test_parse_sax() {
+    lept_handler h;
+    memset(&h, 0, sizeof(h));
+    h.null = sax_null;
+    h.boolean = sax_boolean;
+    h.number = sax_number;
+    h.int64 = sax_int64;
+    h.string = sax_string;
+    h.key = sax_key;
+    h.start_object = sax_start_object;
+    h.end_object = sax_end_object;
+    h.start_array = sax_start_array;
+    h.end_array = sax_end_array;
+
+    TEST_SAX(LEPT_PARSE_OK, "n ", " null ", 0);
+    TEST_SAX(LEPT_PARSE_OK, "\"a\\b\" ", "\"a\\\\b\"", 0);
+    TEST_SAX(LEPT_PARSE_OK,
+        "{ a: [ n t f i-12 d1.5 \"x\" ]6 e\xC3\xA9: { }0 : [ ]0 }3 ",
+        "{\"a\":[null,true,false,-12,1.5,\"x\"],\"e\\u00e9\":{},\"\":[]}", 0);
+    TEST_SAX(LEPT_PARSE_OK, "[ [ [ ]0 ]1 [ ]0 ]2 ", "[[[]],[]]", 0);
+
+    /* stop on the third event, so no later events are delivered */
+    TEST_SAX(LEPT_PARSE_STOPPED, "[ i1 i2 ", "[1,2,3]", 3);
+    TEST_SAX(LEPT_PARSE_STOPPED, "{ a: ", "{\"a\":1}", 2);
+    TEST_SAX(LEPT_PARSE_STOPPED, "[ ]0 ", "[]", 2);
+
+    /* events before the error have been delivered */
+    TEST_SAX(LEPT_PARSE_MISS_COMMA_OR_SQUARE_BRACKET, "[ i1 ", "[1 2]", 0);
+    TEST_SAX(LEPT_PARSE_MISS_COLON, "{ a: i1 b: ", "{\"a\":1,\"b\" 2}", 0);
+    TEST_SAX(LEPT_PARSE_MISS_KEY, "{ ", "{1:2}", 0);
+    TEST_SAX(LEPT_PARSE_INVALID_STRING_ESCAPE, "[ ", "[\"\\x\"]", 0);
+    TEST_SAX(LEPT_PARSE_ROOT_NOT_SINGULAR, "t ", "true x", 0);
+    TEST_SAX(LEPT_PARSE_EXPECT_VALUE, "", "", 0);
+
+    /* without int64, integers come as numbers; missing callbacks are skipped */
+    h.int64 = NULL;
+    h.key = NULL;
+    h.start_array = NULL;
+    TEST_SAX(LEPT_PARSE_OK, "{ d42 ]1 }1 ", "{\"a\":[42]}", 0);
+}
+
+static void test_parse_sax_allocator() {
+    counting_heap heap = { 0, 0, 0 };
+    lept_allocator a;
+    lept_handler h;
+    char json[202];
+    int ctx = 0;
+
+    a.alloc = counting_alloc;
+    a.resize = counting_resize;
+    a.release = counting_release;
+    a.ctx = &heap;
+    memset(&h, 0, sizeof(h));
+    memset(json, '[', 100);
+    memset(json + 100, ']', 100);
+    json[200] = '\0';
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_sax_a(&a, json, 200, &h, &ctx));
+    EXPECT_TRUE(heap.calls > 0);
+    EXPECT_EQ_INT(LEPT_PARSE_MISS_COMMA_OR_SQUARE_BRACKET, lept_parse_sax_a(&a, json, 150, &h, &ctx));
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_sax_a(&a, "1", 1, &h, &ctx));
+    EXPECT_EQ_SIZE_T(0, heap.live);
+    EXPECT_EQ_SIZE_T(0, heap.mismatches);
+}
+
+typedef struct {
+    char buf[65536];
+    size_t len, calls, limit;   /* limit: fail the call after that many */
+}writer_sink;
+
+static int sink_write(void* ctx, const char* s, size_t len) {
+    writer_sink* k = (writer_sink*)ctx;
+    if (++k->calls > k->limit || k->len + len > sizeof(k->buf))
+        return 0;
+    memcpy(k->buf + k->len, s, len);
+    k->len += len;
+    return 1;
+}
+
+#define TEST_WRITER(expect, k)\
+    EXPECT_EQ_BASE(strlen(expect) == (k).len && memcmp(expect, (k).buf, (k).len) == 0, expect, (k).buf, "%s")
+
+static void test_writer() {
+    static const char json[] =
+        "{\"n\":null,\"f\":false,\"t\":true,\"i\":-123,\"d\":1.5,\"s\":\"a\\n\\u0001\\\"\","
+        "\"a\":[[],{},[1,[2]]],\"o\":{\"\":\"\"}}";
+    writer_sink k;
+    lept_writer* w;
+    lept_value v;
+    char* expect, * big;
+    size_t i, len;
+
+    memset(&k, 0, sizeof(k));
+    k.limit = (size_t)-1;
+    w = lept_writer_create(sink_write, &k);
+    lept_writer_start_object(w);
+    lept_writer_key(w, "n", 1);
+    lept_writer_null(w);
+    lept_writer_key(w, "f", 1);
+    lept_writer_boolean(w, 0);
+    lept_writer_key(w, "t", 1);
+    lept_writer_boolean(w, 1);
+    lept_writer_key(w, "i", 1);
+    lept_writer_int64(w, -123);
+    lept_writer_key(w, "d", 1);
+    lept_writer_number(w, 1.5);
+    lept_writer_key(w, "s", 1);
+    lept_writer_string(w, "a\n\001\"", 4);
+    lept_writer_key(w, "a", 1);
+    lept_writer_start_array(w);
+    lept_writer_start_array(w);
+    lept_writer_end_array(w);
+    lept_writer_start_object(w);
+    lept_writer_end_object(w);
+    lept_writer_start_array(w);
+    lept_writer_int64(w, 1);
+    lept_writer_start_array(w);
+    lept_writer_int64(w, 2);
+    lept_writer_end_array(w);
+    lept_writer_end_array(w);
+    lept_writer_end_array(w);
+    lept_writer_key(w, "o", 1);
+    lept_writer_start_object(w);
+    lept_writer_key(w, "", 0);
+    lept_writer_string(w, "", 0);
+    lept_writer_end_object(w);
+    lept_writer_end_object(w);
+    EXPECT_EQ_INT(0, (int)k.calls);
+    EXPECT_TRUE(lept_writer_finish(w));
+    EXPECT_EQ_SIZE_T(1, k.calls);
+    TEST_WRITER(json, k);
+
+    /* top-level values go on separate lines */
+    memset(&k, 0, sizeof(k));
+    k.limit = (size_t)-1;
+    w = lept_writer_create(sink_write, &k);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, json));
+    lept_writer_value(w, &v);
+    lept_writer_int64(w, 0);
+    EXPECT_TRUE(lept_writer_finish(w));
+    lept_free(&v);
+    EXPECT_EQ_SIZE_T(strlen(json) + 2, k.len);
+    EXPECT_TRUE(memcmp(json, k.buf, strlen(json)) == 0 && memcmp("\n0", k.buf + strlen(json), 2) == 0);
+
+    /* output much larger than the buffer, with a string that spans many flushes */
+    big = (char*)malloc(len = 20000);
+    for (i = 0; i < len; i++)
+        big[i] = "ab\"\\\n\001"[i % 6];
+    lept_init(&v);
+    lept_set_array(&v, 0);
+    lept_set_string(lept_pushback_array_element(&v), big, len);
+    for (i = 0; i < 1000; i++)
+        lept_set_number(lept_pushback_array_element(&v), i / 8.0);
+    expect = lept_stringify(&v, NULL);
+    memset(&k, 0, sizeof(k));
+    k.limit = (size_t)-1;
+    w = lept_writer_create(sink_write, &k);
+    lept_writer_value(w, &v);
+    EXPECT_TRUE(lept_writer_finish(w));
+    EXPECT_TRUE(k.calls > 1);
+    TEST_WRITER(expect, k);
+    free(expect);
+
+    /* a failed write drops the rest */
+    memset(&k, 0, sizeof(k));
+    k.limit = 1;
+    w = lept_writer_create(sink_write, &k);
+    lept_writer_value(w, &v);
+    EXPECT_FALSE(lept_writer_finish(w));
+    EXPECT_EQ_SIZE_T(2, k.calls);
+    lept_free(&v);
+    free(big);
+}
+
+/* Parses json in chunks of every size and compares with lept_parse_n(). */
+static void test_stream_chunks(int error, const char* json) {
+    size_t len = strlen(json), n, i;
+    lept_value expect, v;
+    EXPECT_EQ_INT(error, lept_parse_n(&expect, json, len));
+    for (n = 1; n <= len; n++) {
+        lept_stream* s = lept_stream_create();
+        int ret = LEPT_PARSE_OK;
+        for (i = 0; i < len && ret == LEPT_PARSE_OK; i += n)
+            ret = lept_stream_feed(s, json + i, i + n < len ? n : len - i);
+        EXPECT_EQ_INT(error, lept_stream_finish(s, &v));
+        if (error == LEPT_PARSE_OK)
+            EXPECT_TRUE(lept_is_equal(&expect, &v));
+        lept_free(&v);
+    }
+    lept_free(&expect);
+}
+
+static void test_parse_stream() {
+    lept_stream* s;
+    lept_value v;
+
+    test_stream_chunks(LEPT_PARSE_OK, " null ");
+    test_stream_chunks(LEPT_PARSE_OK, "-1.25e+10");
+    test_stream_chunks(LEPT_PARSE_OK, "\"\\uD834\\uDD1E \\\\\\\" \\u00e9\"");
+    test_stream_chunks(LEPT_PARSE_OK,
+        " { \"n\" : null , \"f\" : false , \"t\" : true , \"i\" : 123 , \"s\" : \"abc\\n\", "
+        "\"a\" : [ 1, 2.5e-3, [ ], { } ], \"o\" : { \"\\u0041\" : [ \"x\" ] } } ");
+
+    test_stream_chunks(LEPT_PARSE_EXPECT_VALUE, "");
+    test_stream_chunks(LEPT_PARSE_EXPECT_VALUE, "[1,");
+    test_stream_chunks(LEPT_PARSE_INVALID_VALUE, "tru");
+    test_stream_chunks(LEPT_PARSE_INVALID_VALUE, "[1.]");
+    test_stream_chunks(LEPT_PARSE_MISS_QUOTATION_MARK, "[\"abc\\\"");
+    test_stream_chunks(LEPT_PARSE_INVALID_UNICODE_SURROGATE, "\"\\uD834\"");
+    test_stream_chunks(LEPT_PARSE_MISS_KEY, "{\"a\":1,");
+    test_stream_chunks(LEPT_PARSE_MISS_COLON, "{\"a\"");
+    test_stream_chunks(LEPT_PARSE_MISS_COMMA_OR_SQUARE_BRACKET, "[1 2");
+    test_stream_chunks(LEPT_PARSE_MISS_COMMA_OR_CURLY_BRACKET, "{\"a\":{}");
+    test_stream_chunks(LEPT_PARSE_ROOT_NOT_SINGULAR, "[null] x");
+    test_stream_chunks(LEPT_PARSE_ROOT_NOT_SINGULAR, "0123");
+
+    /* the first error sticks */
+    s = lept_stream_create();
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_stream_feed(s, "[1", 2));
+    EXPECT_EQ_INT(LEPT_PARSE_MISS_COMMA_OR_SQUARE_BRACKET, lept_stream_feed(s, "2 3", 3));
+    EXPECT_EQ_INT(LEPT_PARSE_MISS_COMMA_OR_SQUARE_BRACKET, lept_stream_feed(s, "]", 1));
+    EXPECT_EQ_INT(LEPT_PARSE_MISS_COMMA_OR_SQUARE_BRACKET, lept_stream_finish(s, &v));
+    EXPECT_EQ_INT(LEPT_NULL, lept_get_type(&v));
+
+    /* a token may span many chunks */
+    s = lept_stream_create();
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_stream_feed(s, "[\"a", 3));
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_stream_feed(s, "bc", 2));
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_stream_feed(s, "", 0));
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_stream_feed(s, "d\\", 2));
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_stream_feed(s, "\"\"]", 3));
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_stream_finish(s, &v));
+    EXPECT_EQ_STRING("abcd\"", lept_get_string(lept_get_array_element(&v, 0)), lept_get_string_length(lept_get_array_element(&v, 0)));
+    lept_free(&v);
+}
+
+/* Shifts json by 0 to 64 spaces, so that its tokens meet every offset in the blocks of stage one. */
+static void test_indexed_shifts(int error, const char* json) {
+    char buf[256];
+    size_t len = strlen(json), n;
+    lept_value expect, v;
+    lept_init(&expect);
+    if (error == LEPT_PARSE_OK)
+        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_n(&expect, json, len));
+    for (n = 0; n <= 64; n++) {
+        memset(buf, ' ', n);
+        memcpy(buf + n, json, len);
+        EXPECT_EQ_INT(error, lept_parse_indexed(&v, buf, n + len));
+        if (error == LEPT_PARSE_OK)
+            EXPECT_TRUE(lept_is_equal(&expect, &v));
+        lept_free(&v);
+    }
+    lept_free(&expect);
+}
+
+static void test_parse_indexed() {
+    lept_document d;
+    lept_value expect, v;
+    char* json;
+    size_t i, len;
+
+    test_indexed_shifts(LEPT_PARSE_OK, "null");
+    test_indexed_shifts(LEPT_PARSE_OK, " -1.25e+10 ");
+    test_indexed_shifts(LEPT_PARSE_OK, "\"\\uD834\\uDD1E \\\\\\\" \\u00e9\"");
+    test_indexed_shifts(LEPT_PARSE_OK, "[\"\\\\\",\"\\\\\\\"\",\"\\\"\\\\\",\"\\\\\\\\\"]");
+    test_indexed_shifts(LEPT_PARSE_OK,
+        " { \"n\" : null , \"f\" : false , \"t\" : true , \"i\" : 123 , \"s\" : \"abc\\n\", "
+        "\"a\" : [ 1, 2.5e-3, [ ], { } ], \"o\" : { \"\\u0041\" : [ \"x\" ] } } ");
+    test_indexed_shifts(LEPT_PARSE_OK, "[\"\xC3\xA9\xE2\x82\xAC\xF0\x9F\x98\x80\",\"\xF4\x8F\xBF\xBF\"]");
+
+    test_indexed_shifts(LEPT_PARSE_EXPECT_VALUE, "");
+    test_indexed_shifts(LEPT_PARSE_EXPECT_VALUE, "[1,");
+    test_indexed_shifts(LEPT_PARSE_INVALID_VALUE, "tru");
+    test_indexed_shifts(LEPT_PARSE_INVALID_VALUE, "[1.]");
+    test_indexed_shifts(LEPT_PARSE_INVALID_VALUE, "[\\\"a\"]");
+    test_indexed_shifts(LEPT_PARSE_MISS_QUOTATION_MARK, "[\"abc\\\"");
+    test_indexed_shifts(LEPT_PARSE_INVALID_STRING_CHAR, "[\"a\tb\"]");
+    test_indexed_shifts(LEPT_PARSE_INVALID_UNICODE_SURROGATE, "\"\\uD834\"");
+    test_indexed_shifts(LEPT_PARSE_MISS_KEY, "{\"a\":1,");
+    test_indexed_shifts(LEPT_PARSE_MISS_KEY, "{1:1}");
+    test_indexed_shifts(LEPT_PARSE_MISS_COLON, "{\"a\"");
+    test_indexed_shifts(LEPT_PARSE_MISS_COLON, "{\"a\"x:1}");
+    test_indexed_shifts(LEPT_PARSE_MISS_COMMA_OR_SQUARE_BRACKET, "[1 2");
+    test_indexed_shifts(LEPT_PARSE_MISS_COMMA_OR_SQUARE_BRACKET, "[1\"a\"]");
+    test_indexed_shifts(LEPT_PARSE_MISS_COMMA_OR_SQUARE_BRACKET, "[truex]");
+    test_indexed_shifts(LEPT_PARSE_MISS_COMMA_OR_CURLY_BRACKET, "{\"a\":{}");
+    test_indexed_shifts(LEPT_PARSE_ROOT_NOT_SINGULAR, "[null] x");
+    test_indexed_shifts(LEPT_PARSE_ROOT_NOT_SINGULAR, "0123");
+    test_indexed_shifts(LEPT_PARSE_ROOT_NOT_SINGULAR, "\"a\"\"b\"");
+
+    /* only the indexed parser checks UTF-8, and before anything else */
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_n(&v, "\"\xC0\x80\"", 4));
+    lept_free(&v);
+    test_indexed_shifts(LEPT_PARSE_INVALID_UTF8, "\"\xC0\x80\"");                 /* overlong */
+    test_indexed_shifts(LEPT_PARSE_INVALID_UTF8, "\"\xE0\x9F\xBF\"");
+    test_indexed_shifts(LEPT_PARSE_INVALID_UTF8, "\"\xED\xA0\x80\"");             /* surrogate */
+    test_indexed_shifts(LEPT_PARSE_INVALID_UTF8, "\"\xF4\x90\x80\x80\"");         /* above U+10FFFF */
+    test_indexed_shifts(LEPT_PARSE_INVALID_UTF8, "\"\x80\"");
+    test_indexed_shifts(LEPT_PARSE_INVALID_UTF8, "\"\xE2\x82\"");
+    test_indexed_shifts(LEPT_PARSE_INVALID_UTF8, "{\"\xFF\":1}");
+    test_indexed_shifts(LEPT_PARSE_INVALID_UTF8, "[\"a\"] \xC3");
+    test_indexed_shifts(LEPT_PARSE_INVALID_UTF8, "[1 2] \xF0\x9F\x98");
+
+    /* many blocks and more tokens than stage one indexes at once */
+    json = (char*)malloc(3000 * 64);
+    len = 0;
+    json[len++] = '[';
+    for (i = 0; i < 3000; i++)
+        len += sprintf(json + len, "%s{\"k%u\" : [%u, \"\\\\\\\"%u\xC3\xA9\", true]}\n",
+            i ? ", " : "", (unsigned)(i % 7), (unsigned)i, (unsigned)i);
+    json[len++] = ']';
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_n(&expect, json, len));
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_indexed(&v, json, len));
+    EXPECT_TRUE(lept_is_equal(&expect, &v));
+    lept_free(&v);
+    lept_document_init(&d);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_document_parse_indexed(&d, json, len));
+    EXPECT_TRUE(lept_is_equal(&expect, &d.root));
+    json[len - 1] = '}';
+    EXPECT_EQ_INT(LEPT_PARSE_MISS_COMMA_OR_SQUARE_BRACKET, lept_document_parse_indexed(&d, json, len));
+    lept_document_free(&d);
+    lept_free(&expect);
+    free(json);
+}
+
+#define TEST_LAZY(error, json)\
+    do {\
+        lept_value expect, v;\
+        EXPECT_EQ_INT(error, lept_parse(&expect, json));\
+        EXPECT_EQ_INT(error, lept_parse_lazy(&v, json, strlen(json)));\
+        if (error == LEPT_PARSE_OK)\
+            EXPECT_TRUE(lept_is_equal(&expect, &v));\
+        lept_free(&expect);\
+        lept_free(&v);\
+    } while(0)
+
+static void test_parse_lazy() {
+    char json[] = "{ \"a\" : [ [ 1 ], \"x y\" ], \"b\" : { \"c\" : [ true ] }, \"d\" : 1.5 }";
+    lept_value v, w, * e;
+    writer_sink k;
+    lept_writer* wr;
+    char* s, * deep;
+    size_t len, i;
+
+    TEST_LAZY(LEPT_PARSE_OK, "null");
+    TEST_LAZY(LEPT_PARSE_OK, "\"abc\"");
+    TEST_LAZY(LEPT_PARSE_OK, "[]");
+    TEST_LAZY(LEPT_PARSE_OK, "[ [ ], { }, [ [ 1 ] ], { \"a\" : { \"b\" : [ \"\\u0041\\\"\" ] } } ]");
+    TEST_LAZY(LEPT_PARSE_OK, json);
+
+    /* errors below the top level are found before any of it is built */
+    TEST_LAZY(LEPT_PARSE_EXPECT_VALUE, "[[1,");
+    TEST_LAZY(LEPT_PARSE_INVALID_VALUE, "[[1.]]");
+    TEST_LAZY(LEPT_PARSE_INVALID_VALUE, "{\"a\":{\"b\":tru}}");
+    TEST_LAZY(LEPT_PARSE_NUMBER_TOO_BIG, "[[1e309]]");
+    TEST_LAZY(LEPT_PARSE_INVALID_STRING_ESCAPE, "[[\"\\v\"]]");
+    TEST_LAZY(LEPT_PARSE_MISS_KEY, "{\"a\":{1:1}}");
+    TEST_LAZY(LEPT_PARSE_MISS_COLON, "[{\"a\"}]");
+    TEST_LAZY(LEPT_PARSE_MISS_COMMA_OR_SQUARE_BRACKET, "[[1 2]]");
+    TEST_LAZY(LEPT_PARSE_MISS_COMMA_OR_CURLY_BRACKET, "[{\"a\":1]]");
+    TEST_LAZY(LEPT_PARSE_ROOT_NOT_SINGULAR, "[[]] x");
+    EXPECT_EQ_INT(LEPT_PARSE_INVALID_UTF8, lept_parse_lazy(&v, "[[\"\xC0\x80\"]]", 8));
+    len = 3000;
+    deep = (char*)malloc(len);
+    memset(deep, '[', len / 2);
+    memset(deep + len / 2, ']', len / 2);
+    EXPECT_EQ_INT(LEPT_PARSE_TOO_DEEP, lept_parse_lazy(&v, deep, len));
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_lazy(&v, deep + 500, len - 1000));
+    lept_free(&v);
+    free(deep);
+
+    /* nested containers are read from the input on first use */
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_lazy(&v, json, sizeof(json) - 1));
+    json[12] = '7';
+    EXPECT_EQ_DOUBLE(7.0, lept_get_number(lept_get_array_element(lept_get_array_element(lept_find_object_value(&v, "a", 1), 0), 0)));
+    s = lept_stringify(&v, &len);
+    EXPECT_EQ_STRING("{\"a\":[[7],\"x y\"],\"b\":{\"c\":[true]},\"d\":1.5}", s, len);
+    free(s);
+    memset(&k, 0, sizeof(k));
+    k.limit = (size_t)-1;
+    wr = lept_writer_create(sink_write, &k);
+    lept_writer_value(wr, &v);
+    EXPECT_TRUE(lept_writer_finish(wr));
+    TEST_WRITER("{\"a\":[[7],\"x y\"],\"b\":{\"c\":[true]},\"d\":1.5}", k);
+
+    lept_init(&w);
+    lept_copy(&w, lept_find_object_value(&v, "b", 1));
+    e = lept_pushback_array_element(lept_find_object_value(&w, "c", 1));
+    lept_set_string(e, "z", 1);
+    EXPECT_EQ_SIZE_T(1, lept_get_array_size(lept_find_object_value(lept_find_object_value(&v, "b", 1), "c", 1)));
+    EXPECT_EQ_SIZE_T(2, lept_get_array_size(lept_find_object_value(&w, "c", 1)));
+    lept_free(&w);
+    lept_free(&v);
+
+    /* a lazy container reaches the writer in buffer-sized slices */
+    len = 0;
+    deep = (char*)malloc(20000);
+    deep[len++] = '[';
+    deep[len++] = '[';
+    for (i = 0; i < 2000; i++)
+        len += sprintf(deep + len, "%s \"\\\" \"", i ? "," : "");
+    deep[len++] = ']';
+    deep[len++] = ']';
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_lazy(&v, deep, len));
+    memset(&k, 0, sizeof(k));
+    k.limit = (size_t)-1;
+    wr = lept_writer_create(sink_write, &k);
+    lept_writer_value(wr, &v);
+    EXPECT_TRUE(lept_writer_finish(wr));
+    s = lept_stringify(&v, &len);
+    EXPECT_EQ_SIZE_T(2 + 2000 * 5 + 1999 + 2, len);
+    EXPECT_TRUE(k.len == len && memcmp(k.buf, s, len) == 0);
+    free(s);
+    lept_free(&v);
+    free(deep);
+}
+
+static void test_parse_lazy_allocator() {
+    const char* json = "{ \"a\" : [ [ 1 ], \"x y\" ], \"b\" : { \"c\" : [ true ] }, \"d\" : [ ] }";
+    counting_heap h = { 0, 0, 0 };
+    lept_allocator a;
+    lept_document d;
+    lept_value v, w;
+    char* s;
+    size_t len;
+
+    a.alloc = counting_alloc;
+    a.resize = counting_resize;
+    a.release = counting_release;
+    a.ctx = &h;
+
+    /* containers loaded later, and the lazy ones never loaded, go through the allocator too */
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_lazy_a(&a, &v, json, strlen(json)));
+    EXPECT_EQ_DOUBLE(1.0, lept_get_number(lept_get_array_element(lept_get_array_element(lept_find_object_value(&v, "a", 1), 0), 0)));
+    lept_init(&w);
+    lept_copy(&w, lept_find_object_value(&v, "b", 1));
+    EXPECT_EQ_SIZE_T(1, lept_get_array_size(lept_find_object_value(&w, "c", 1)));
+    lept_free(&w);
+    s = lept_stringify(&v, &len);
+    EXPECT_EQ_STRING("{\"a\":[[1],\"x y\"],\"b\":{\"c\":[true]},\"d\":[]}", s, len);
+    free(s);
+    lept_free_a(&a, &v);
+    EXPECT_EQ_INT(LEPT_PARSE_MISS_COMMA_OR_SQUARE_BRACKET, lept_parse_lazy_a(&a, &v, "[[1],[2 3]]", 11));
+    EXPECT_EQ_SIZE_T(0, h.live);
+    EXPECT_EQ_SIZE_T(0, h.mismatches);
+
+    /* with a document, lept_free() is safe whether or not they were loaded */
+    lept_document_init(&d);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_lazy_a(&d.allocator, &v, json, strlen(json)));
+    EXPECT_EQ_SIZE_T(2, lept_get_array_size(lept_find_object_value(&v, "a", 1)));
+    lept_free(&v);
+    lept_document_free(&d);
+}
+
+/* paths are the pointers to select, separated by '|' */
+#define TEST_SELECT(error, expect, json, paths)\
+    do {\
+        const char* pointers[8];\
+        char buf[256], * t;\
+        size_t n = 1, len;\
+        lept_value v;\
+        char* s;\
+        strcpy(buf, paths);\
+        for (pointers[0] = t = buf; (t = strchr(t, '|')) != NULL; *t++ = '\0')\
+            pointers[n++] = t + 1;\
+        EXPECT_EQ_INT(error, lept_parse_select(&v, json, strlen(json), pointers, n));\
+        if (error == LEPT_PARSE_OK) {\
+            s = lept_stringify(&v, &len);\
+            EXPECT_EQ_STRING(expect, s, len);\
+            free(s);\
+        }\
+        lept_free(&v);\
+    } while(0)
+
+static void test_parse_select() {
+    const char* json = "{ \"id\" : 7, \"user\" : { \"name\" : \"x\", \"tags\" : [ 1, [ 2, 3 ], { \"k\" : 4 } ] }, \"a/b\" : 1, \"m~n\" : [ ] }";
+    char* wide;
+    size_t len, i;
+
+    TEST_SELECT(LEPT_PARSE_OK, "{\"id\":7}", json, "/id");
+    TEST_SELECT(LEPT_PARSE_OK, "{\"id\":7,\"user\":{\"name\":\"x\"}}", json, "/user/name|/id");
+    TEST_SELECT(LEPT_PARSE_OK, "{\"user\":{\"tags\":[null,[null,3],{\"k\":4}]}}", json, "/user/tags/1/1|/user/tags/2");
+    TEST_SELECT(LEPT_PARSE_OK, "{\"a/b\":1,\"m~n\":[]}", json, "/a~1b|/m~0n");
+    TEST_SELECT(LEPT_PARSE_OK, "{\"user\":{\"tags\":[1,[2,3],{\"k\":4}]}}", json, "/user/tags|/user/tags/0");
+    TEST_SELECT(LEPT_PARSE_OK, "{}", json, "/nope|/id/0|/user/tags/01|/user/tags/9|/user/tags/-");
+    TEST_SELECT(LEPT_PARSE_OK, "[1,[2,3],{\"k\":4}]", "[1,[2,3],{\"k\":4}]", "|/1");
+    TEST_SELECT(LEPT_PARSE_OK, "null", " 1 ", "/0");
+    TEST_SELECT(LEPT_PARSE_OK, "\"a\"", " \"a\" ", "");
+    TEST_SELECT(LEPT_PARSE_OK, "[]", "[ 1, 2 ]", "/x");
+    TEST_SELECT(LEPT_PARSE_OK, "{\"\":{\"\":1}}", "{ \"\" : { \"\" : 1 } }", "//");
+    TEST_SELECT(LEPT_PARSE_OK, "{\"\xC3\xA9\":1}", "{ \"\\u00e9\" : 1, \"e\" : 2 }", "/\xC3\xA9");
+
+    /* the parts that are not built are still checked, with the errors lept_parse() gives */
+    TEST_SELECT(LEPT_PARSE_EXPECT_VALUE, "", "", "/a");
+    TEST_SELECT(LEPT_PARSE_INVALID_VALUE, "", "{\"a\":1,\"b\":[tru]}", "/a");
+    TEST_SELECT(LEPT_PARSE_INVALID_VALUE, "", "{\"a\":1,\"b\":-}", "/a");
+    TEST_SELECT(LEPT_PARSE_NUMBER_TOO_BIG, "", "{\"a\":1,\"b\":1e309}", "/a");
+    TEST_SELECT(LEPT_PARSE_INVALID_STRING_ESCAPE, "", "{\"a\":1,\"\\v\":1}", "/a");
+    TEST_SELECT(LEPT_PARSE_MISS_KEY, "", "{\"a\":1,}", "/a");
+    TEST_SELECT(LEPT_PARSE_MISS_COLON, "", "{\"a\":{\"b\"}}", "/a/b");
+    TEST_SELECT(LEPT_PARSE_MISS_COMMA_OR_SQUARE_BRACKET, "", "[1 2]", "/0");
+    TEST_SELECT(LEPT_PARSE_MISS_COMMA_OR_CURLY_BRACKET, "", "{\"a\":1", "/a");
+    TEST_SELECT(LEPT_PARSE_ROOT_NOT_SINGULAR, "", "{\"a\":1} 2", "/a");
+    TEST_SELECT(LEPT_PARSE_INVALID_UTF8, "", "{\"a\":1,\"b\":\"\xC0\x80\"}", "/a");
+    TEST_SELECT(LEPT_PARSE_INVALID_POINTER, "", "{\"x\":1}", "x");
+    TEST_SELECT(LEPT_PARSE_INVALID_POINTER, "", "{\"x\":1}", "/x|/x/~2");
+    TEST_SELECT(LEPT_PARSE_INVALID_POINTER, "", "{\"x\":1}", "/x~");
+
+    /* a few fields out of a wide record */
+    wide = (char*)malloc(200 * 32);
+    len = sprintf(wide, "{");
+    for (i = 0; i < 200; i++)
+        len += sprintf(wide + len, "%s\"f%u\":[%u,\"v\"]", i ? "," : "", (unsigned)i, (unsigned)i);
+    sprintf(wide + len, "}");
+    TEST_SELECT(LEPT_PARSE_OK, "{\"f3\":[3],\"f150\":[150,\"v\"],\"f199\":[null,\"v\"]}", wide, "/f3/0|/f150|/f199/1");
+    free(wide);
+}
+
+static void test_parse_select_allocator() {
+    const char* json = "{\"a\":[0,{\"b\":\"xyz\"},[1,2]],\"c\":{\"d\":null,\"e\":[true]}}";
+    const char* pointers[] = { "/a/1/b", "/a/2", "/c/e", "/c/f/0" };
+    counting_heap h = { 0, 0, 0 };
+    lept_allocator a;
+    lept_value v;
+    char* s;
+    size_t len;
+
+    a.alloc = counting_alloc;
+    a.resize = counting_resize;
+    a.release = counting_release;
+    a.ctx = &h;
+
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_select_a(&a, &v, json, strlen(json), pointers, 4));
+    s = lept_stringify(&v, &len);
+    EXPECT_EQ_STRING("{\"a\":[null,{\"b\":\"xyz\"},[1,2]],\"c\":{\"e\":[true]}}", s, len);
+    free(s);
+    lept_free_a(&a, &v);
+    EXPECT_EQ_INT(LEPT_PARSE_MISS_COMMA_OR_SQUARE_BRACKET, lept_parse_select_a(&a, &v, "{\"a\":[0 1]}", 12, pointers, 4));
+    EXPECT_EQ_SIZE_T(0, h.live);
+    EXPECT_EQ_SIZE_T(0, h.mismatches);
+}
+
+static void test_pointer() {
+    /* the example of RFC 6901 */
+    const char* json = "{ \"foo\": [\"bar\", \"baz\"], \"\": 0, \"a/b\": 1, \"c%d\": 2, \"e^f\": 3, \"g|h\": 4, \"i\\\\j\": 5, \"k\\\"l\": 6, \" \": 7, \"m~n\": 8 }";
+    const char* paths[] = { "/foo/0", "/", "/a~1b", "/c%d", "/e^f", "/g|h", "/i\\j", "/k\"l", "/ ", "/m~0n" };
+    lept_pointer* p;
+    lept_value v, * e;
+    char key[8], * s;
+    size_t i, len;
+
+    EXPECT_TRUE(lept_pointer_compile("a") == NULL);
+    EXPECT_TRUE(lept_pointer_compile("/a~") == NULL);
+    EXPECT_TRUE(lept_pointer_compile("/a~2") == NULL);
+
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, json));
+    p = lept_pointer_compile("");
+    EXPECT_TRUE(lept_pointer_get(&v, p) == &v);
+    lept_pointer_free(p);
+    p = lept_pointer_compile("/foo");
+    EXPECT_EQ_SIZE_T(2, lept_get_array_size(lept_pointer_get(&v, p)));
+    lept_pointer_free(p);
+    for (i = 0; i < sizeof(paths) / sizeof(*paths); i++) {
+        p = lept_pointer_compile(paths[i]);
+        e = lept_pointer_get(&v, p);
+        EXPECT_TRUE(e != NULL);
+        if (e != NULL && i > 0)
+            EXPECT_EQ_DOUBLE((double)i - 1, lept_get_number(e));
+        lept_pointer_free(p);
+    }
+    p = lept_pointer_compile("/foo/1");
+    EXPECT_EQ_STRING("baz", lept_get_string(lept_pointer_get(&v, p)), 3);
+    lept_pointer_free(p);
+    for (i = 0; i < 6; i++) {
+        const char* missing[] = { "/foo/2", "/foo/01", "/foo/-", "/foo/x", "/bar", "/a~1b/0" };
+        p = lept_pointer_compile(missing[i]);
+        EXPECT_TRUE(lept_pointer_get(&v, p) == NULL);
+        lept_pointer_free(p);
+    }
+    lept_free(&v);
+
+    /* set makes the path */
+    lept_init(&v);
+    p = lept_pointer_compile("/a/0/b~1c/2");
+    lept_set_number(lept_pointer_set(&v, p), 1.0);
+    EXPECT_EQ_DOUBLE(1.0, lept_get_number(lept_pointer_get(&v, p)));
+    lept_set_number(lept_pointer_set(&v, p), 2.0);
+    lept_pointer_free(p);
+    p = lept_pointer_compile("/a/-");
+    lept_set_boolean(lept_pointer_set(&v, p), 1);
+    lept_set_boolean(lept_pointer_set(&v, p), 0);
+    lept_pointer_free(p);
+    p = lept_pointer_compile("/a/0/x");
+    lept_set_string(lept_pointer_set(&v, p), "y", 1);
+    lept_pointer_free(p);
+    s = lept_stringify(&v, &len);
+    EXPECT_EQ_STRING("{\"a\":[{\"b/c\":[null,null,2],\"x\":\"y\"},true,false]}", s, len);
+    free(s);
+
+    /* but does not go through a scalar, or into an array by a name */
+    p = lept_pointer_compile("/a/1/z");
+    EXPECT_TRUE(lept_pointer_set(&v, p) == NULL);
+    lept_pointer_free(p);
+    p = lept_pointer_compile("/a/z");
+    EXPECT_TRUE(lept_pointer_set(&v, p) == NULL);
+    lept_pointer_free(p);
+    s = lept_stringify(&v, &len);
+    EXPECT_EQ_STRING("{\"a\":[{\"b/c\":[null,null,2],\"x\":\"y\"},true,false]}", s, len);
+    free(s);
+    lept_free(&v);
+
+    /* lookups in hashed objects and lazy containers */
+    lept_set_object(&v, 0);
+    for (i = 0; i < 100; i++) {
+        sprintf(key, "/k%u", (unsigned)i);
+        p = lept_pointer_compile(key);
+        lept_set_number(lept_pointer_set(&v, p), (double)i);
+        lept_pointer_free(p);
+    }
+    EXPECT_EQ_SIZE_T(100, lept_get_object_size(&v));
+    p = lept_pointer_compile("/k57");
+    EXPECT_EQ_DOUBLE(57.0, lept_get_number(lept_pointer_get(&v, p)));
+    lept_pointer_free(p);
+    lept_free(&v);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_lazy(&v, "[ { \"a\" : [ 1, { \"b\" : 2 } ] } ]", 32));
+    p = lept_pointer_compile("/0/a/1/b");
+    EXPECT_EQ_DOUBLE(2.0, lept_get_number(lept_pointer_get(&v, p)));
+    lept_pointer_free(p);
+    lept_free(&v);
+}
+
+#define TEST_PATH(expect, json, query)\
+    do {\
+        lept_value v, r, * out[16];\
+        lept_path* p;\
+        size_t i, n, len;\
+        char* s;\
+        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, json));\
+        p = lept_path_compile(query);\
+        EXPECT_TRUE(p != NULL);\
+        if (p != NULL) {\
+            n = lept_path_query(p, &v, out, 16);\
+            lept_init(&r);\
+            lept_set_array(&r, 0);\
+            for (i = 0; i < n; i++)\
+                lept_copy(lept_pushback_array_element(&r), out[i]);\
+            s = lept_stringify(&r, &len);\
+            EXPECT_EQ_STRING(expect, s, len);\
+            free(s);\
+            lept_free(&r);\
+            lept_path_free(p);\
+        }\
+        lept_free(&v);\
+    } while(0)
+
+static void test_path() {
+    /* the examples of RFC 9535 */
+    const char* store = "{ \"store\": { \"book\": ["
+        "{ \"author\": \"Nigel Rees\", \"title\": \"Sayings of the Century\", \"price\": 8.95 },"
+        "{ \"author\": \"Evelyn Waugh\", \"title\": \"Sword of Honour\", \"price\": 12.99 },"
+        "{ \"author\": \"Herman Melville\", \"title\": \"Moby Dick\", \"isbn\": \"0-553-21311-3\", \"price\": 8.99 },"
+        "{ \"author\": \"J. R. R. Tolkien\", \"title\": \"The Lord of the Rings\", \"isbn\": \"0-395-19395-8\", \"price\": 22.99 }"
+        "], \"bicycle\": { \"color\": \"red\", \"price\": 399 } } }";
+    const char* letters = "[\"a\", \"b\", \"c\", \"d\", \"e\", \"f\", \"g\"]";
+    const char* filters = "{ \"a\": [3, 5, 1, 2, 4, 6, {\"b\": \"j\"}, {\"b\": \"k\"}, {\"b\": {}}, {\"b\": \"kilo\"}],"
+        "\"o\": {\"p\": 1, \"q\": 2, \"r\": 3, \"s\": 5, \"t\": {\"u\": 6}}, \"e\": \"f\" }";
+    const char* bad[] = { "", "a", "$.", "$..", "$[", "$[1", "$[01]", "$[-0]", "$.1a", "$.[0]", "$ ", "$['a\\v']",
+        "$[\"a\\'\"]", "$['\\uDC00']", "$[?@.a==]", "$[?1]", "$[?@.* == 1]", "$[?@..a == 1]", "$[?length(@) == 1]",
+        "$[?(@.a]", "$[?!1]", "$[?@ == {}]", "$[9007199254740992]", "$[-9007199254740992]" };
+    lept_value v, * out[2];
+    lept_path* p;
+    size_t i;
+
+    TEST_PATH("[\"Nigel Rees\",\"Evelyn Waugh\",\"Herman Melville\",\"J. R. R. Tolkien\"]", store, "$.store.book[*].author");
+    TEST_PATH("[\"Nigel Rees\",\"Evelyn Waugh\",\"Herman Melville\",\"J. R. R. Tolkien\"]", store, "$..author");
+    TEST_PATH("[8.95,12.99,8.99,22.99,399]", store, "$.store..price");
+    TEST_PATH("[\"Moby Dick\"]", store, "$..book[2].title");
+    TEST_PATH("[\"The Lord of the Rings\"]", store, "$..book[-1].title");
+    TEST_PATH("[\"Sayings of the Century\",\"Sword of Honour\"]", store, "$..book[0,1].title");
+    TEST_PATH("[\"Sayings of the Century\",\"Sword of Honour\"]", store, "$..book[:2].title");
+    TEST_PATH("[\"Moby Dick\",\"The Lord of the Rings\"]", store, "$..book[?@.isbn].title");
+    TEST_PATH("[\"Sayings of the Century\",\"Moby Dick\"]", store, "$..book[?@.price<10].title");
+    TEST_PATH("[\"red\"]", store, "$ .store ['bicycle'][\"color\"]");
+
+    TEST_PATH("[\"b\",\"c\"]", letters, "$[1:3]");
+    TEST_PATH("[\"f\",\"g\"]", letters, "$[5:]");
+    TEST_PATH("[\"b\",\"d\"]", letters, "$[1:5:2]");
+    TEST_PATH("[\"f\",\"d\"]", letters, "$[5:1:-2]");
+    TEST_PATH("[\"g\",\"f\",\"e\",\"d\",\"c\",\"b\",\"a\"]", letters, "$[::-1]");
+    TEST_PATH("[\"e\",\"f\"]", letters, "$[-3:-1]");
+    TEST_PATH("[]", letters, "$[1:3:0]");
+    TEST_PATH("[]", letters, "$[-8]");
+    TEST_PATH("[\"a\",\"a\",\"g\"]", letters, "$[0, 0, -1]");
+
+    TEST_PATH("[{\"b\":\"kilo\"}]", filters, "$.a[?@.b == 'kilo']");
+    TEST_PATH("[{\"b\":\"kilo\"}]", filters, "$.a[?(@.b == \"kilo\")]");
+    TEST_PATH("[5,4,6]", filters, "$.a[?@>3.5]");
+    TEST_PATH("[{\"b\":\"j\"},{\"b\":\"k\"},{\"b\":{}},{\"b\":\"kilo\"}]", filters, "$.a[?@.b]");
+    TEST_PATH("[1,2,1,2]", filters, "$.o[?@<3, ?@<3]");
+    TEST_PATH("[1,{\"b\":\"k\"}]", filters, "$.a[?@<2 || @.b == \"k\"]");
+    TEST_PATH("[{\"b\":\"k\"},{\"b\":\"kilo\"}]", filters, "$.a[?@.b > 'j']");
+    TEST_PATH("[2,3]", filters, "$.o[?@>1 && @<4]");
+    TEST_PATH("[{\"u\":6}]", filters, "$.o[?@.u || @.x]");
+    TEST_PATH("[3,5,1,2,4,6]", filters, "$.a[?(@.b == $.x)]");
+    TEST_PATH("[3,5,1,2,4,6]", filters, "$.a[?!@.b]");
+    TEST_PATH("[\"f\"]", filters, "$[?@ == $.e && !(@ != 'f')]");
+    TEST_PATH("[\"f\"]", filters, "$['\\u0065']");
+    TEST_PATH("[[[1]],[1],1]", "[[[1]]]", "$..[0]");
+    TEST_PATH("[{\"a\":1}]", "{\"a\":1}", "$");
+    TEST_PATH("[]", "{\"a\":1}", "$.a.b[0]");
+    TEST_PATH("[]", "[true, null, false]", "$[?@ == 1]");
+    TEST_PATH("[true,null]", "[true, null, false]", "$[?@ == true || @ == null]");
+
+    for (i = 0; i < sizeof(bad) / sizeof(*bad); i++)
+        EXPECT_TRUE(lept_path_compile(bad[i]) == NULL);
+    /* the largest indices I-JSON allows still compile */
+    TEST_PATH("[]", letters, "$[9007199254740991]");
+    TEST_PATH("[]", letters, "$[-9007199254740991]");
+    TEST_PATH("[\"a\",\"g\"]", letters, "$[-9007199254740991:9007199254740991:6]");
+
+    /* the count goes past what fits in out */
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, store));
+    p = lept_path_compile("$..*");
+    EXPECT_EQ_SIZE_T(23, lept_path_query(p, &v, NULL, 0));
+    EXPECT_EQ_SIZE_T(23, lept_path_query(p, &v, out, 2));
+    EXPECT_TRUE(out[0] == lept_find_object_value(&v, "store", 5));
+    lept_path_free(p);
+    lept_free(&v);
+}
+
+#define TEST_NEXT(error, expect, at, it)\
+    do {\
+        lept_value v;\
+        char* s;\
+        size_t len;\
+        EXPECT_EQ_INT(error, lept_next(&it, &v));\
+        EXPECT_EQ_SIZE_T(at, it.offset);\
+        if (error == LEPT_PARSE_OK) {\
+            s = lept_stringify(&v, &len);\
+            EXPECT_EQ_STRING(expect, s, len);\
+            free(s);\
+        }\
+        lept_free(&v);\
+    } while(0)
+
+static void test_parse_many() {
+    const char* lines = "{\"a\":1}\n[2, \"\\u00e9\"]\r\n\"x\"\n";
+    const char* concatenated = " 1 2{}[]\"s\"true";
+    const char* bad = "1\n{\"a\" 1}\n[3]\n[4";
+    lept_many it;
+    char* stack;
+
+    it = lept_parse_many(lines, strlen(lines));
+    TEST_NEXT(LEPT_PARSE_OK, "{\"a\":1}", 0, it);
+    TEST_NEXT(LEPT_PARSE_OK, "[2,\"\xC3\xA9\"]", 8, it);
+    stack = it.stack;
+    TEST_NEXT(LEPT_PARSE_OK, "\"x\"", 23, it);
+    EXPECT_TRUE(it.stack == stack);
+    TEST_NEXT(LEPT_PARSE_END, "", 23, it);
+    TEST_NEXT(LEPT_PARSE_END, "", 23, it);
+    lept_many_free(&it);
+
+    it = lept_parse_many(concatenated, strlen(concatenated));
+    TEST_NEXT(LEPT_PARSE_OK, "1", 1, it);
+    TEST_NEXT(LEPT_PARSE_OK, "2", 3, it);
+    TEST_NEXT(LEPT_PARSE_OK, "{}", 4, it);
+    TEST_NEXT(LEPT_PARSE_OK, "[]", 6, it);
+    TEST_NEXT(LEPT_PARSE_OK, "\"s\"", 8, it);
+    TEST_NEXT(LEPT_PARSE_OK, "true", 11, it);
+    TEST_NEXT(LEPT_PARSE_END, "", 11, it);
+    lept_many_free(&it);
+
+    /* a bad record is skipped up to the end of its line */
+    it = lept_parse_many(bad, strlen(bad));
+    TEST_NEXT(LEPT_PARSE_OK, "1", 0, it);
+    TEST_NEXT(LEPT_PARSE_MISS_COLON, "", 2, it);
+    TEST_NEXT(LEPT_PARSE_OK, "[3]", 10, it);
+    TEST_NEXT(LEPT_PARSE_MISS_COMMA_OR_SQUARE_BRACKET, "", 14, it);
+    TEST_NEXT(LEPT_PARSE_END, "", 14, it);
+    lept_many_free(&it);
+
+    it = lept_parse_many(" \n ", 3);
+    TEST_NEXT(LEPT_PARSE_END, "", 0, it);
+    lept_many_free(&it);
+}
+
+typedef struct {
+    lept_many it;           /* what lept_next() gives for the same input */
+    size_t count, stop;
+    int ok;
+}lines_check;
+
+static int check_line(void* ctx, size_t offset, int ret, lept_value* v) {
+    lines_check* c = (lines_check*)ctx;
+    lept_value e;
+    int expect = lept_next(&c->it, &e);
+    if (expect != ret || c->it.offset != offset || (ret == LEPT_PARSE_OK && !lept_is_equal(&e, v)))
+        c->ok = 0;
+    lept_free(&e);
+    return ++c->count != c->stop;
+}
+
+static void test_parse_lines() {
+    static const unsigned threads[] = { 1, 2, 5 };
+    counting_heap h = { 0, 0, 0 };
+    lept_allocator a;
+    lines_check c;
+    lept_value v;
+    char* json;
+    size_t len = 0, i, n = 0;
+
+    /* enough records for several chunks, a few of them bad */
+    json = (char*)malloc(4000000);
+    for (i = 0; len < 3900000; i++) {
+        if (i % 10007 == 5)
+            len += sprintf(json + len, "{\"id\":%u,\"bad\" 1}\n", (unsigned)i);
+        else if (i % 3 == 0)
+            len += sprintf(json + len, "[%u,\"\\u00e9\",true,null]\n", (unsigned)i);
+        else
+            len += sprintf(json + len, "{\"id\":%u,\"name\":\"user%u\",\"geo\":{\"lat\":%u.5}}  \r\n", (unsigned)i, (unsigned)i, (unsigned)i);
+        n++;
+    }
+    for (i = 0; i < sizeof(threads) / sizeof(*threads); i++) {
+        c.it = lept_parse_many(json, len);
+        c.count = 0;
+        c.stop = 0;
+        c.ok = 1;
+        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_lines(json, len, threads[i], check_line, &c));
+        EXPECT_EQ_SIZE_T(n, c.count);
+        EXPECT_TRUE(c.ok);
+        EXPECT_EQ_INT(LEPT_PARSE_END, lept_next(&c.it, &v));
+        lept_many_free(&c.it);
+    }
+
+    /* the callback stops it part way */
+    c.it = lept_parse_many(json, len);
+    c.count = 0;
+    c.stop = n / 2;
+    c.ok = 1;
+    EXPECT_EQ_INT(LEPT_PARSE_STOPPED, lept_parse_lines(json, len, 3, check_line, &c));
+    EXPECT_EQ_SIZE_T(n / 2, c.count);
+    EXPECT_TRUE(c.ok);
+    lept_many_free(&c.it);
+
+    /* on one thread, an allocator need not be thread-safe */
+    a.alloc = counting_alloc;
+    a.resize = counting_resize;
+    a.release = counting_release;
+    a.ctx = &h;
+    c.it = lept_parse_many(json, len);
+    c.count = 0;
+    c.stop = 0;
+    c.ok = 1;
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_lines_a(&a, json, len, 1, check_line, &c));
+    EXPECT_EQ_SIZE_T(n, c.count);
+    EXPECT_TRUE(c.ok);
+    EXPECT_TRUE(h.calls > 0);
+    EXPECT_EQ_SIZE_T(0, h.live);
+    EXPECT_EQ_SIZE_T(0, h.mismatches);
+    lept_many_free(&c.it);
+    free(json);
+
+    c.it = lept_parse_many("", 0);
+    c.count = 0;
+    c.stop = 0;
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_lines("", 0, 4, check_line, &c));
+    EXPECT_EQ_SIZE_T(0, c.count);
+    lept_many_free(&c.it);
+}
+
+/* Walks elements and members in order with lept_tape_next(), and checks the lookups by index on the way. */
+static int tape_equal(lept_cursor c, const lept_value* v) {
+    lept_cursor e;
+    size_t i, n;
+    if (lept_tape_get_type(c) != lept_get_type(v))
+        return 0;
+    switch (lept_get_type(v)) {
+        case LEPT_NUMBER:
+            return lept_tape_is_int64(c) == lept_is_int64(v) && lept_tape_get_number(c) == lept_get_number(v);
+        case LEPT_STRING:
+            return lept_tape_get_string_length(c) == lept_get_string_length(v) &&
+                memcmp(lept_tape_get_string(c), lept_get_string(v), lept_get_string_length(v) + 1) == 0;
+        case LEPT_ARRAY:
+            if ((n = lept_tape_get_array_size(c)) != lept_get_array_size(v))
+                return 0;
+            for (i = 0, e = n > 0 ? lept_tape_get_array_element(c, 0) : c; i < n; i++, e = lept_tape_next(e))
+                if (e.index != lept_tape_get_array_element(c, i).index || !tape_equal(e, lept_get_array_element((lept_value*)v, i)))
+                    return 0;
+            return n == 0 || e.tape == NULL;
+        case LEPT_OBJECT:
+            if ((n = lept_tape_get_object_size(c)) != lept_get_object_size(v))
+                return 0;
+            for (i = 0, e = n > 0 ? lept_tape_get_object_value(c, 0) : c; i < n; i++, e = lept_tape_next(e))
+                if (e.index != lept_tape_get_object_value(c, i).index ||
+                    lept_tape_get_object_key_length(c, i) != lept_get_object_key_length(v, i) ||
+                    memcmp(lept_tape_get_object_key(c, i), lept_get_object_key(v, i), lept_get_object_key_length(v, i) + 1) != 0 ||
+                    !tape_equal(e, lept_get_object_value((lept_value*)v, i)))
+                    return 0;
+            return n == 0 || e.tape == NULL;
+        default:
+            return 1;
+    }
+}
+
+#define TEST_TAPE(json)\
+    do {\
+        lept_value v;\
+        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, json));\
+        EXPECT_EQ_INT(LEPT_PARSE_OK, lept_tape_parse(&t, json, strlen(json)));\
+        EXPECT_TRUE(tape_equal(lept_tape_root(&t), &v));\
+        lept_free(&v);\
+    } while(0)
+
+#define TEST_TAPE_ERROR(error, json)\
+    do {\
+        EXPECT_EQ_INT(error, lept_tape_parse(&t, json, strlen(json)));\
+        EXPECT_EQ_SIZE_T(0, t.size);\
+    } while(0)
+
+static void test_tape() {
+    lept_tape t;
+    lept_cursor c, e;
+    lept_value v;
+    char* json;
+    size_t i, len;
+
+    lept_tape_init(&t);
+    TEST_TAPE("null");
+    TEST_TAPE("false");
+    TEST_TAPE("true");
+    TEST_TAPE("-1.5e300");
+    TEST_TAPE("-9223372036854775808");
+    TEST_TAPE("\"\"");
+    TEST_TAPE("\"Hello\\u0000World\"");
+    TEST_TAPE("[]");
+    TEST_TAPE("{}");
+    TEST_TAPE("[ null , false , true , 123 , \"abc\", [], {} ]");
+    TEST_TAPE(" { "
+        "\"n\" : null , "
+        "\"f\" : false , "
+        "\"t\" : true , "
+        "\"i\" : 123 , "
+        "\"s\" : \"abc\", "
+        "\"a\" : [ 1, 2, [ 3 ], { \"x\" : [ ] } ],"
+        "\"o\" : { \"1\" : 1, \"2\" : 2.5, \"3\" : \"\\u0041\" }"
+        " } ");
+
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_tape_parse(&t, "{\"a\":[1,{\"b\":\"c\"}],\"a\":2,\"d\":true}", 34));
+    c = lept_tape_root(&t);
+    EXPECT_EQ_SIZE_T(3, lept_tape_get_object_size(c));
+    EXPECT_EQ_SIZE_T(0, lept_tape_find_object_index(c, "a", 1));
+    EXPECT_EQ_SIZE_T(2, lept_tape_find_object_index(c, "d", 1));
+    EXPECT_EQ_SIZE_T(LEPT_KEY_NOT_EXIST, lept_tape_find_object_index(c, "b", 1));
+    EXPECT_TRUE(lept_tape_find_object_value(c, "b", 1).tape == NULL);
+    EXPECT_TRUE(lept_tape_get_boolean(lept_tape_find_object_value(c, "d", 1)));
+    EXPECT_EQ_INT64(2, lept_tape_get_int64(lept_tape_get_object_value(c, 1)));
+    e = lept_tape_get_array_element(lept_tape_find_object_value(c, "a", 1), 1);
+    EXPECT_EQ_STRING("c", lept_tape_get_string(lept_tape_find_object_value(e, "b", 1)), lept_tape_get_string_length(lept_tape_find_object_value(e, "b", 1)));
+    EXPECT_TRUE(lept_tape_next(e).tape == NULL);
+    EXPECT_TRUE(lept_tape_next(c).tape == NULL);
+
+    TEST_TAPE_ERROR(LEPT_PARSE_EXPECT_VALUE, "");
+    TEST_TAPE_ERROR(LEPT_PARSE_INVALID_VALUE, "[1.]");
+    TEST_TAPE_ERROR(LEPT_PARSE_MISS_QUOTATION_MARK, "[\"abc");
+    TEST_TAPE_ERROR(LEPT_PARSE_INVALID_STRING_ESCAPE, "{\"\\v\":1}");
+    TEST_TAPE_ERROR(LEPT_PARSE_MISS_KEY, "{1:1}");
+    TEST_TAPE_ERROR(LEPT_PARSE_MISS_COLON, "{\"a\",1}");
+    TEST_TAPE_ERROR(LEPT_PARSE_MISS_COMMA_OR_SQUARE_BRACKET, "[1}");
+    TEST_TAPE_ERROR(LEPT_PARSE_MISS_COMMA_OR_CURLY_BRACKET, "{\"a\":1]");
+    TEST_TAPE_ERROR(LEPT_PARSE_ROOT_NOT_SINGULAR, "[] []");
+    TEST_TAPE_ERROR(LEPT_PARSE_INVALID_UTF8, "[\"\xC0\x80\"]");
+
+    /* the buffers grow past their first size, and are kept for the next parse */
+    json = (char*)malloc(3000 * 64);
+    len = 0;
+    json[len++] = '[';
+    for (i = 0; i < 3000; i++)
+        len += sprintf(json + len, "%s{\"k%u\" : [%u, \"\\\\\\\"%u\xC3\xA9\", -0.5]}\n",
+            i ? ", " : "", (unsigned)(i % 7), (unsigned)i, (unsigned)i);
+    json[len++] = ']';
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_n(&v, json, len));
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_tape_parse(&t, json, len));
+    EXPECT_TRUE(tape_equal(lept_tape_root(&t), &v));
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_tape_parse(&t, json, len));
+    EXPECT_TRUE(tape_equal(lept_tape_root(&t), &v));
+    lept_free(&v);
+    free(json);
+    lept_tape_free(&t);
 }
 
 int main() {
@@ -722,6 +2457,23 @@ int main() {
     test_move();
     test_swap();
     test_access();
+    test_document();
+    test_document_intern();
+    test_allocator();
+    test_parse_sax();
+    test_parse_sax_allocator();
+    test_parse_stream();
+    test_parse_indexed();
+    test_tape();
+    test_writer();
+    test_parse_lazy();
+    test_parse_lazy_allocator();
+    test_parse_select();
+    test_parse_select_allocator();
+    test_pointer();
+    test_path();
+    test_parse_many();
+    test_parse_lines();
     printf("%d/%d (%3.2f%%) passed\n", test_pass, test_count, test_pass * 100.0 / test_count);
     return main_ret;
 }